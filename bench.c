@@ -0,0 +1,693 @@
+#define _GNU_SOURCE  // for syscall()
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define MATRIX_IMPLEMENTATION
+#include "matrix.h"
+
+// Benchmark configuration
+
+#define BENCH_MAX_SIZES 16
+#define BENCH_MAX_REPS 1000
+
+/// Largest side for which O(n^3) and I/O-bound operations are measured
+#define BENCH_MATMUL_MAX_SIZE 1024
+#define BENCH_PRINT_MAX_SIZE 1024
+
+/// Number of doubles in every array of the STREAM-like triad;
+/// large enough for 3 arrays to not fit in any cache
+#define ROOF_STREAM_LEN (8 * 1024 * 1024)
+
+/// Number of independent multiply-add chains used to saturate the FP units,
+/// enough to cover the latency of 2 FMA ports with 8-wide vectors
+#define ROOF_FMA_CHAINS 64
+#define ROOF_FMA_ITERS (1 << 20)
+
+/// Strict C11 modes don't contract `a * b + c` into a fused multiply-add, so the peak
+/// is measured with explicit fma() calls where the hardware supports them
+#ifdef FP_FAST_FMA
+#define ROOF_FMA(a, b, c) fma((a), (b), (c))
+#else
+#define ROOF_FMA(a, b, c) ((a) * (b) + (c))
+#endif
+
+/// Fully unrolling the loop over the chains keeps them in vector registers,
+/// instead of storing and reloading them on every iteration
+#if defined(__clang__)
+#define ROOF_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+#define ROOF_UNROLL _Pragma("GCC unroll 64")
+#else
+#define ROOF_UNROLL
+#endif
+
+typedef struct {
+    size_t sizes[BENCH_MAX_SIZES];
+    size_t sizes_len;
+    int warmup;
+    int reps;
+    int json;
+    int roofline;
+    double roofline_threshold;
+    int perf;
+    int threads;
+} bench_config;
+
+/// Hardware performance counters collected with `--perf`
+enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_EVENTS_LEN,
+};
+
+static char const* const perf_event_names[PERF_EVENTS_LEN] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses",
+};
+
+/// File descriptors of the opened counters, -1 for unavailable ones
+typedef struct {
+    int fds[PERF_EVENTS_LEN];
+} bench_perf;
+
+/// Hardware limits measured on the current host, with as many threads as the operations use
+typedef struct {
+    double peak_gbps;    // STREAM-like triad bandwidth
+    double peak_gflops;  // Independent multiply-add throughput
+} bench_roofs;
+
+/// Matrices shared by all operations on a single size.
+/// Every matrix is square, with `n` rows and columns.
+typedef struct {
+    size_t n;
+    matrix a;
+    matrix b;
+    matrix dest;
+    FILE* sink;
+    double total;  // Results of reductions, so that they aren't optimized out
+} bench_ctx;
+
+/// Describes a single measured operation
+typedef struct {
+    char const* name;
+    void (*run)(bench_ctx* ctx);
+    double (*flops)(size_t n);  // Floating-point operations per run
+    double (*bytes)(size_t n);  // Minimal number of bytes moved to/from memory per run
+    size_t max_size;            // 0 for no limit
+} bench_op;
+
+/// Statistics of a single (operation, size) pair
+typedef struct {
+    bench_op const* op;
+    size_t n;
+    double median;  // in seconds
+    double p99;     // in seconds
+    double gflops;  // at the median time
+    double gbps;    // at the median time
+    double roof;    // achieved fraction of the attainable performance, or NAN if not measured
+    double counters[PERF_EVENTS_LEN];  // per run, or NAN if not collected
+} bench_result;
+
+// Measured operations
+
+static double scale_func(double x) { return x * 0.5 + 0.25; }
+
+static void run_fill(bench_ctx* ctx) { matrix_fill_scalar(&ctx->a, 1.0); }
+static void run_fill_zero(bench_ctx* ctx) { matrix_fill_scalar(&ctx->dest, 0.0); }
+static void run_copy(bench_ctx* ctx) { matrix_copy_into(&ctx->a, &ctx->dest); }
+static void run_add(bench_ctx* ctx) { matrix_add(&ctx->a, &ctx->b); }
+static void run_mul_scalar(bench_ctx* ctx) { matrix_mul_scalar(&ctx->a, 1.0000001); }
+static void run_pow_scalar(bench_ctx* ctx) { matrix_pow_scalar(&ctx->a, 0.5); }
+static void run_map(bench_ctx* ctx) { matrix_map(&ctx->a, scale_func); }
+static void run_matmul(bench_ctx* ctx) { matrix_matmul_into(&ctx->a, &ctx->b, &ctx->dest); }
+static void run_transpose(bench_ctx* ctx) { matrix_transpose(&ctx->a); }
+static void run_print(bench_ctx* ctx) { matrix_print(&ctx->a, ctx->sink); }
+static void run_sum(bench_ctx* ctx) { ctx->total += matrix_sum(&ctx->a); }
+
+/// Multiplies the first row of a by b, which has fewer rows than there are threads
+static void run_matvec(bench_ctx* ctx) {
+    matrix a_row = matrix_rows(&ctx->a, 0, 1);
+    matrix dest_row = matrix_rows(&ctx->dest, 0, 1);
+    matrix_matmul_into(&a_row, &ctx->b, &dest_row);
+}
+
+/// Runs `run` in the deterministic mode, to compare it against the default one
+static void run_deterministic(bench_ctx* ctx, void (*run)(bench_ctx* ctx)) {
+    matrix_deterministic_set(true);
+    run(ctx);
+    matrix_deterministic_set(false);
+}
+
+static void run_sum_det(bench_ctx* ctx) { run_deterministic(ctx, run_sum); }
+static void run_matmul_det(bench_ctx* ctx) { run_deterministic(ctx, run_matmul); }
+static void run_matvec_det(bench_ctx* ctx) { run_deterministic(ctx, run_matvec); }
+
+static double n2(size_t n) { return (double)n * (double)n; }
+static double flops_none(size_t n) {
+    (void)n;
+    return 0.0;
+}
+static double flops_n2(size_t n) { return n2(n); }
+static double flops_matmul(size_t n) { return 2.0 * n2(n) * (double)n; }
+static double flops_matvec(size_t n) { return 2.0 * n2(n); }
+static double bytes_write(size_t n) { return 8.0 * n2(n); }
+static double bytes_read_write(size_t n) { return 16.0 * n2(n); }
+static double bytes_add(size_t n) { return 24.0 * n2(n); }
+static double bytes_matmul(size_t n) { return 24.0 * n2(n); }
+static double bytes_read(size_t n) { return 8.0 * n2(n); }
+static double bytes_matvec(size_t n) { return 8.0 * (n2(n) + 2.0 * (double)n); }
+
+static bench_op const bench_ops[] = {
+    {"fill_scalar", run_fill, flops_none, bytes_write, 0},
+    {"fill_zero", run_fill_zero, flops_none, bytes_write, 0},
+    {"copy_into", run_copy, flops_none, bytes_read_write, 0},
+    {"add", run_add, flops_n2, bytes_add, 0},
+    {"mul_scalar", run_mul_scalar, flops_n2, bytes_read_write, 0},
+    {"pow_scalar", run_pow_scalar, flops_n2, bytes_read_write, 0},
+    {"map", run_map, flops_n2, bytes_read_write, 0},
+    {"matmul_into", run_matmul, flops_matmul, bytes_matmul, BENCH_MATMUL_MAX_SIZE},
+    {"matmul_det", run_matmul_det, flops_matmul, bytes_matmul, BENCH_MATMUL_MAX_SIZE},
+    {"matvec", run_matvec, flops_matvec, bytes_matvec, 0},
+    {"matvec_det", run_matvec_det, flops_matvec, bytes_matvec, 0},
+    {"sum", run_sum, flops_n2, bytes_read, 0},
+    {"sum_det", run_sum_det, flops_n2, bytes_read, 0},
+    {"transpose", run_transpose, flops_none, bytes_read_write, 0},
+    {"print", run_print, flops_none, bytes_read, BENCH_PRINT_MAX_SIZE},
+};
+
+#define BENCH_OPS_LEN (sizeof(bench_ops) / sizeof(bench_ops[0]))
+
+// Helpers
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(void const* a, void const* b) {
+    double x = *(double const*)a;
+    double y = *(double const*)b;
+    return (x > y) - (x < y);
+}
+
+/// Returns the q-th quantile (0 <= q <= 1) of sorted samples, using the nearest-rank method
+static double quantile(double const* sorted, int len, double q) {
+    int rank = (int)ceil(q * len);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Hardware performance counters
+
+#ifdef __linux__
+
+static int perf_open(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;  // Also count threads started later, i.e. the pool threads
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t perf_cache_config(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+static void perf_init(bench_perf* p) {
+    p->fds[PERF_CYCLES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    p->fds[PERF_INSTRUCTIONS] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    p->fds[PERF_L1D_MISSES] =
+        perf_open(PERF_TYPE_HW_CACHE, perf_cache_config(PERF_COUNT_HW_CACHE_L1D));
+    p->fds[PERF_LLC_MISSES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    p->fds[PERF_DTLB_MISSES] =
+        perf_open(PERF_TYPE_HW_CACHE, perf_cache_config(PERF_COUNT_HW_CACHE_DTLB));
+}
+
+static void perf_start(bench_perf const* p) {
+    for (int i = 0; i < PERF_EVENTS_LEN; ++i) {
+        if (p->fds[i] >= 0) {
+            ioctl(p->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(p->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/// Stops the counters and stores their values divided by `runs`.
+/// Values are scaled up if the kernel had to multiplex the counters.
+static void perf_stop(bench_perf const* p, int runs, double* out) {
+    for (int i = 0; i < PERF_EVENTS_LEN; ++i) {
+        out[i] = NAN;
+        if (p->fds[i] < 0)
+            continue;
+
+        ioctl(p->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t data[3];  // value, time enabled, time running
+        if (read(p->fds[i], data, sizeof(data)) == (ssize_t)sizeof(data) && data[2] > 0)
+            out[i] = (double)data[0] * ((double)data[1] / (double)data[2]) / runs;
+    }
+}
+
+static void perf_close(bench_perf* p) {
+    for (int i = 0; i < PERF_EVENTS_LEN; ++i) {
+        if (p->fds[i] >= 0)
+            close(p->fds[i]);
+        p->fds[i] = -1;
+    }
+}
+
+#else
+
+static void perf_init(bench_perf* p) {
+    for (int i = 0; i < PERF_EVENTS_LEN; ++i) p->fds[i] = -1;
+}
+
+static void perf_start(bench_perf const* p) { (void)p; }
+
+static void perf_stop(bench_perf const* p, int runs, double* out) {
+    (void)p;
+    (void)runs;
+    for (int i = 0; i < PERF_EVENTS_LEN; ++i) out[i] = NAN;
+}
+
+static void perf_close(bench_perf* p) { (void)p; }
+
+#endif  // __linux__
+
+static int perf_any_available(bench_perf const* p) {
+    for (int i = 0; i < PERF_EVENTS_LEN; ++i) {
+        if (p->fds[i] >= 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Measurement
+
+/// Times an operation; if `perf` is not NULL, hardware counters are collected
+/// over all (non-warmup) repetitions as well.
+static bench_result measure(bench_op const* op, bench_ctx* ctx, bench_config const* cfg,
+                            bench_perf const* perf) {
+    static double samples[BENCH_MAX_REPS];
+    bench_result r;
+
+    for (int i = 0; i < cfg->warmup; ++i)
+        op->run(ctx);
+
+    if (perf)
+        perf_start(perf);
+
+    for (int i = 0; i < cfg->reps; ++i) {
+        double start = now();
+        op->run(ctx);
+        samples[i] = now() - start;
+    }
+
+    if (perf)
+        perf_stop(perf, cfg->reps, r.counters);
+    else
+        for (int i = 0; i < PERF_EVENTS_LEN; ++i) r.counters[i] = NAN;
+
+    qsort(samples, cfg->reps, sizeof(double), compare_doubles);
+
+    r.op = op;
+    r.n = ctx->n;
+    r.median = quantile(samples, cfg->reps, 0.5);
+    r.p99 = quantile(samples, cfg->reps, 0.99);
+    r.gflops = op->flops(ctx->n) / r.median * 1e-9;
+    r.gbps = op->bytes(ctx->n) / r.median * 1e-9;
+    r.roof = NAN;
+    return r;
+}
+
+// Roofline
+
+/// Sinks for results of the roofline kernels (one per thread), so that they aren't optimized out
+static volatile double* roof_sinks;
+
+/// Arrays of the STREAM-like triad
+static double* roof_a;
+static double* roof_b;
+static double* roof_c;
+
+/// Part `part` of `parts` of a roofline kernel, run by its own thread
+typedef struct {
+    void (*kernel)(size_t part, size_t parts);
+    size_t part;
+    size_t parts;
+} roof_part;
+
+static void* roof_part_run(void* arg) {
+    roof_part const* p = arg;
+    p->kernel(p->part, p->parts);
+    return NULL;
+}
+
+/// Runs every part of a kernel on its own thread (the first one on the calling thread),
+/// and returns the wall time it took
+static double roof_run(void (*kernel)(size_t part, size_t parts), size_t threads) {
+    roof_part* parts = malloc(sizeof(roof_part) * threads);
+    pthread_t* ids = malloc(sizeof(pthread_t) * threads);
+    int* started = calloc(threads, sizeof(int));
+    if (!parts || !ids || !started) {
+        fputs("bench: failed to allocate the roofline threads\n", stderr);
+        exit(1);
+    }
+
+    double start = now();
+    for (size_t i = 0; i < threads; ++i) {
+        parts[i] = (roof_part){kernel, i, threads};
+        if (i > 0)
+            started[i] = pthread_create(&ids[i], NULL, roof_part_run, &parts[i]) == 0;
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        if (!started[i])
+            kernel(i, threads);  // The calling thread, or a thread which couldn't be started
+    }
+    for (size_t i = 1; i < threads; ++i) {
+        if (started[i])
+            pthread_join(ids[i], NULL);
+    }
+    double elapsed = now() - start;
+
+    free(parts);
+    free(ids);
+    free(started);
+    return elapsed;
+}
+
+/// Range of the triad arrays of a single part
+static void roof_stream_range(size_t part, size_t parts, size_t* begin, size_t* end) {
+    *begin = ROOF_STREAM_LEN * part / parts;
+    *end = ROOF_STREAM_LEN * (part + 1) / parts;
+}
+
+/// Fills a part of the triad arrays, so that its pages end up near the thread using them
+static void roof_stream_init(size_t part, size_t parts) {
+    size_t begin, end;
+    roof_stream_range(part, parts, &begin, &end);
+    for (size_t i = begin; i < end; ++i) {
+        roof_a[i] = 0.0;
+        roof_b[i] = 1.0;
+        roof_c[i] = 2.0;
+    }
+}
+
+static void roof_stream_triad(size_t part, size_t parts) {
+    size_t begin, end;
+    roof_stream_range(part, parts, &begin, &end);
+    for (size_t i = begin; i < end; ++i)
+        roof_a[i] = roof_b[i] + 3.0 * roof_c[i];
+    roof_sinks[part] = roof_a[begin];
+}
+
+/// Measures the best bandwidth (in GB/s) of `a[i] = b[i] + s * c[i]`
+static double measure_peak_gbps(size_t threads) {
+    roof_a = malloc(sizeof(double) * ROOF_STREAM_LEN);
+    roof_b = malloc(sizeof(double) * ROOF_STREAM_LEN);
+    roof_c = malloc(sizeof(double) * ROOF_STREAM_LEN);
+    if (!roof_a || !roof_b || !roof_c) {
+        fputs("bench: failed to allocate the STREAM arrays\n", stderr);
+        exit(1);
+    }
+
+    roof_run(roof_stream_init, threads);
+    double best = INFINITY;
+    for (int rep = 0; rep < 5; ++rep) {
+        double elapsed = roof_run(roof_stream_triad, threads);
+        best = elapsed < best ? elapsed : best;
+    }
+
+    free(roof_a);
+    free(roof_b);
+    free(roof_c);
+    return 24.0 * ROOF_STREAM_LEN / best * 1e-9;
+}
+
+/// Runs ROOF_FMA_ITERS multiply-adds on each of ROOF_FMA_CHAINS independent chains
+static void roof_fma(size_t part, size_t parts) {
+    (void)parts;
+    double acc[ROOF_FMA_CHAINS];
+    for (int j = 0; j < ROOF_FMA_CHAINS; ++j)
+        acc[j] = 1.0 + j * 1e-3;
+
+    for (int i = 0; i < ROOF_FMA_ITERS; ++i) {
+        ROOF_UNROLL
+        for (int j = 0; j < ROOF_FMA_CHAINS; ++j)
+            acc[j] = ROOF_FMA(acc[j], 0.999999, 1e-6);
+    }
+
+    for (int j = 0; j < ROOF_FMA_CHAINS; ++j)
+        roof_sinks[part] = acc[j];
+}
+
+/// Measures the best throughput (in GFLOP/s) of independent multiply-adds
+static double measure_peak_gflops(size_t threads) {
+    double best = INFINITY;
+    for (int rep = 0; rep < 5; ++rep) {
+        double elapsed = roof_run(roof_fma, threads);
+        best = elapsed < best ? elapsed : best;
+    }
+
+    return 2.0 * ROOF_FMA_ITERS * ROOF_FMA_CHAINS * threads / best * 1e-9;
+}
+
+/// Measures the roofs with one thread per thread of the pool (if it's running),
+/// so that they're comparable with the operations
+static bench_roofs measure_roofs(void) {
+    size_t threads = matrix_threads_count();
+    roof_sinks = calloc(threads, sizeof(double));
+    if (!roof_sinks) {
+        fputs("bench: failed to allocate the roofline sinks\n", stderr);
+        exit(1);
+    }
+
+    bench_roofs roofs;
+    roofs.peak_gbps = measure_peak_gbps(threads);
+    roofs.peak_gflops = measure_peak_gflops(threads);
+    free((double*)roof_sinks);
+    return roofs;
+}
+
+/// Returns the fraction of the roofline-attainable performance reached by a result.
+/// Operations without any FLOPs are bound by bandwidth alone.
+static double roofline_fraction(bench_result const* r, bench_roofs const* roofs) {
+    double flops = r->op->flops(r->n);
+    if (flops == 0.0)
+        return r->gbps / roofs->peak_gbps;
+
+    double intensity = flops / r->op->bytes(r->n);  // FLOPs per byte
+    double attainable = intensity * roofs->peak_gbps;
+    attainable = attainable < roofs->peak_gflops ? attainable : roofs->peak_gflops;
+    return r->gflops / attainable;
+}
+
+// Reporting
+
+static void report_header(bench_config const* cfg, bench_roofs const* roofs) {
+    if (cfg->json) {
+        printf("{\n  \"threads\": %zu,\n", matrix_threads_count());
+        if (cfg->roofline)
+            printf("  \"roofs\": {\"peak_gbps\": %.6g, \"peak_gflops\": %.6g},\n",
+                   roofs->peak_gbps, roofs->peak_gflops);
+        fputs("  \"results\": [\n", stdout);
+        return;
+    }
+
+    printf("# %zu thread(s)\n", matrix_threads_count());
+    if (cfg->roofline)
+        printf("# peak bandwidth %.3f GB/s, peak throughput %.3f GFLOP/s\n"
+               "# '!' marks operations below %.0f%% of their roofline\n",
+               roofs->peak_gbps, roofs->peak_gflops, cfg->roofline_threshold * 100.0);
+    printf("%-12s %6s %12s %12s %10s %10s", "op", "size", "median_ms", "p99_ms", "GFLOP/s",
+           "GB/s");
+    if (cfg->roofline)
+        printf(" %8s", "roof%");
+    if (cfg->perf) {
+        printf(" %6s", "IPC");
+        for (int i = 0; i < PERF_EVENTS_LEN; ++i) printf(" %12s", perf_event_names[i]);
+    }
+    putchar('\n');
+}
+
+static void report(bench_result const* r, bench_config const* cfg, int first) {
+    int below = cfg->roofline && r->roof < cfg->roofline_threshold;
+
+    if (cfg->json) {
+        printf("%s    {\"op\": \"%s\", \"size\": %zu, \"median_s\": %.9g, \"p99_s\": %.9g, "
+               "\"gflops\": %.6g, \"gbps\": %.6g",
+               first ? "" : ",\n", r->op->name, r->n, r->median, r->p99, r->gflops, r->gbps);
+        if (cfg->roofline)
+            printf(", \"roofline_fraction\": %.6g, \"below_roofline\": %s", r->roof,
+                   below ? "true" : "false");
+        if (cfg->perf) {
+            fputs(", \"counters\": {", stdout);
+            for (int i = 0; i < PERF_EVENTS_LEN; ++i) {
+                printf(i ? ", \"%s\": " : "\"%s\": ", perf_event_names[i]);
+                if (isnan(r->counters[i]))
+                    fputs("null", stdout);
+                else
+                    printf("%.6g", r->counters[i]);
+            }
+            putchar('}');
+        }
+        putchar('}');
+        return;
+    }
+
+    printf("%-12s %6zu %12.4f %12.4f %10.3f %10.3f", r->op->name, r->n, r->median * 1e3,
+           r->p99 * 1e3, r->gflops, r->gbps);
+    if (cfg->roofline)
+        printf(" %7.1f%%%s", r->roof * 100.0, below ? "!" : " ");
+    if (cfg->perf) {
+        printf(" %6.2f", r->counters[PERF_INSTRUCTIONS] / r->counters[PERF_CYCLES]);
+        for (int i = 0; i < PERF_EVENTS_LEN; ++i) printf(" %12.4g", r->counters[i]);
+    }
+    putchar('\n');
+}
+
+static void report_footer(bench_config const* cfg) {
+    if (cfg->json)
+        fputs("\n  ]\n}\n", stdout);
+}
+
+// Entry point
+
+static void usage(char const* argv0) {
+    fprintf(stderr,
+            "Usage: %s [--json] [--reps N] [--warmup N] [--sizes N,N,...]\n"
+            "          [--no-roofline] [--roofline-threshold FRACTION] [--perf] [--threads N]\n"
+            "Times every matrix.h operation on square matrices of the provided sizes,\n"
+            "and compares them against the measured peak bandwidth and FLOP throughput.\n"
+            "--perf additionally collects per-run hardware counters (Linux only).\n"
+            "--threads runs the operations on a thread pool of N threads (0 for one per CPU);\n"
+            "the peaks are then measured with N threads, and counters include all of them.\n"
+            "Operations suffixed with _det run in the deterministic mode.\n",
+            argv0);
+}
+
+static int parse_sizes(char const* str, bench_config* cfg) {
+    cfg->sizes_len = 0;
+    while (*str && cfg->sizes_len < BENCH_MAX_SIZES) {
+        char* end;
+        unsigned long size = strtoul(str, &end, 10);
+        if (end == str || size == 0)
+            return 0;
+
+        cfg->sizes[cfg->sizes_len++] = size;
+        str = *end == ',' ? end + 1 : end;
+    }
+    return *str == '\0';
+}
+
+static int parse_args(int argc, char** argv, bench_config* cfg) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0)
+            cfg->json = 1;
+        else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+            cfg->reps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            cfg->warmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--perf") == 0)
+            cfg->perf = 1;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            cfg->threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--no-roofline") == 0)
+            cfg->roofline = 0;
+        else if (strcmp(argv[i], "--roofline-threshold") == 0 && i + 1 < argc)
+            cfg->roofline_threshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            if (!parse_sizes(argv[++i], cfg))
+                return 0;
+        } else
+            return 0;
+    }
+    return cfg->reps > 0 && cfg->reps <= BENCH_MAX_REPS && cfg->warmup >= 0 && cfg->threads >= 0;
+}
+
+int main(int argc, char** argv) {
+    bench_config cfg = {{64, 256, 1024, 2048}, 4, 2, 11, 0, 1, 0.5, 0, 1};
+    if (!parse_args(argc, argv, &cfg)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Counters are inherited by threads started after they're opened, so open them first
+    bench_perf perf;
+    if (cfg.perf) {
+        perf_init(&perf);
+        if (!perf_any_available(&perf))
+            fputs("bench: no hardware counters available "
+                  "(check /proc/sys/kernel/perf_event_paranoid)\n",
+                  stderr);
+    }
+
+    if (cfg.threads != 1 && !matrix_threads_init((size_t)cfg.threads))
+        fputs("bench: couldn't start the thread pool\n", stderr);
+
+    srand(420);  // To make runs comparable
+    bench_ctx ctx;
+    ctx.total = 0.0;
+    ctx.sink = fopen("/dev/null", "w");
+    if (!ctx.sink)
+        ctx.sink = tmpfile();
+
+    bench_roofs roofs = {NAN, NAN};
+    if (cfg.roofline)
+        roofs = measure_roofs();
+
+    int first = 1;
+    report_header(&cfg, &roofs);
+
+    for (size_t s = 0; s < cfg.sizes_len; ++s) {
+        ctx.n = cfg.sizes[s];
+        ctx.a = matrix_new_uniform(ctx.n, ctx.n, 0.5, 1.5);
+        ctx.b = matrix_new_uniform(ctx.n, ctx.n, 0.5, 1.5);
+        ctx.dest = matrix_new(ctx.n, ctx.n);
+
+        for (size_t i = 0; i < BENCH_OPS_LEN; ++i) {
+            bench_op const* op = &bench_ops[i];
+            if (op->max_size && ctx.n > op->max_size)
+                continue;
+
+            bench_result r = measure(op, &ctx, &cfg, cfg.perf ? &perf : NULL);
+            if (cfg.roofline)
+                r.roof = roofline_fraction(&r, &roofs);
+            report(&r, &cfg, first);
+            first = 0;
+            fflush(stdout);
+        }
+
+        matrix_del(&ctx.a);
+        matrix_del(&ctx.b);
+        matrix_del(&ctx.dest);
+    }
+
+    report_footer(&cfg);
+    fclose(ctx.sink);
+    matrix_threads_shutdown();
+    if (cfg.perf)
+        perf_close(&perf);
+    return 0;
+}
@@ -0,0 +1,6 @@
+set -ex
+
+CFLAGS="-std=c11 --pedantic -Wall -Wextra -Werror -O2 -march=native -DNDEBUG -DMATRIX_THREADS -pthread"
+LIBS="-lm"
+
+gcc $CFLAGS bench.c -o bench $LIBS
@@ -1,6 +1,24 @@
 set -ex
 
 CFLAGS="-std=c11 --pedantic -Wall -Wextra -Werror -ggdb -fsanitize=undefined"
+CXXFLAGS="-std=c++17 --pedantic -Wall -Wextra -Werror -ggdb -fsanitize=undefined"
 LIBS="-lm"
+FEATURES="-D_DEFAULT_SOURCE -DMATRIX_INSTRUMENT -DMATRIX_TRACE -DMATRIX_TRACK_ALLOCS \
+-DMATRIX_THREADS -DMATRIX_HUGEPAGES -DMATRIX_HUGEPAGE_THRESHOLD=65536 -DMATRIX_MMAP -DMATRIX_SHM -DMATRIX_DIST -DMATRIX_COW"
 
 gcc $CFLAGS test.c -o test $LIBS
+gcc $CFLAGS $FEATURES -pthread test.c -o test_features $LIBS
+
+# The C++ layer links against the implementation compiled as C, with external linkage
+CXX_FEATURES="-DMATRIX_COW"
+gcc $CFLAGS $CXX_FEATURES -DMATRIX_IMPLEMENTATION -DMATRIX_DEF= -x c -c matrix.h -o matrix.o
+g++ $CXXFLAGS $CXX_FEATURES test.cpp matrix.o -o test_cpp $LIBS
+
+# The std::mdspan interop is only compiled with C++23 and a standard library providing <mdspan>
+CXX23FLAGS="-std=c++23 --pedantic -Wall -Wextra -Werror -ggdb -fsanitize=undefined"
+if printf '#include <mdspan>\n#ifndef __cpp_lib_mdspan\n#error\n#endif\n' |
+    g++ $CXX23FLAGS -x c++ -fsyntax-only - 2>/dev/null; then
+    g++ $CXX23FLAGS $CXX_FEATURES test.cpp matrix.o -o test_cpp23 $LIBS
+else
+    rm -f test_cpp23
+fi
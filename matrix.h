@@ -12,13 +12,19 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
-#include <stddef.h>  // for size_t
-#include <stdio.h>   // for FILE*
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for uint64_t
+#include <stdio.h>    // for FILE*
 
 #ifndef MATRIX_DEF
 #define MATRIX_DEF static inline
 #endif // MATRIX_DEF
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Represents a dynamically-allocated matrix.
  *
@@ -90,6 +96,41 @@ MATRIX_DEF void matrix_del(matrix* m);
  */
 MATRIX_DEF matrix matrix_copy(matrix const* m);
 
+#ifdef MATRIX_COW
+
+/**
+ * Returns a matrix sharing the buffer of `m`, without copying it.
+ * Only available if `MATRIX_COW` is defined.
+ *
+ * Both matrices have to be destroyed with `matrix_del`, which only frees the buffer
+ * once no other matrix shares it. The first operation writing into a shared buffer
+ * (`matrix_add`, `matrix_set`, `matrix_fill_scalar`, ...) gives the matrix its own copy first,
+ * so that the other ones are unaffected. If that copy can't be allocated, `MATRIX_COW_OOM()`
+ * is called (`abort()` unless defined otherwise before including the implementation);
+ * it must not return, as the operation would then write into the shared buffer.
+ * Writes through `m->values` or views (`matrix_rows`) bypass this check -
+ * call `matrix_unshare` before them.
+ *
+ * `m` must have been allocated by the library (e.g. with `matrix_new`, but not mapped),
+ * and must not be const if its buffer is shared, as operations may replace `m->values`.
+ * Views of some rows of a shared matrix never hold a reference to its buffer;
+ * views of all of its rows can't be told apart from the matrix itself.
+ */
+MATRIX_DEF matrix matrix_share(matrix const* m);
+
+/**
+ * Gives `m` its own copy of its buffer if it's shared with other matrices,
+ * see `matrix_share`. Returns false (leaving `m` unchanged) if the copy can't be allocated.
+ */
+MATRIX_DEF bool matrix_unshare(matrix* m);
+
+/**
+ * Returns the number of matrices sharing the buffer of `m` (1 if it isn't shared).
+ */
+MATRIX_DEF size_t matrix_share_count(matrix const* m);
+
+#endif  // MATRIX_COW
+
 #endif  // MATRIX_NO_MALLOC
 
 /**
@@ -102,6 +143,12 @@ MATRIX_DEF void matrix_copy_into(matrix const* src, matrix* dest);
  */
 MATRIX_DEF size_t matrix_len(matrix const* m);
 
+/**
+ * Returns a matrix sharing `count` rows of `m`'s buffer, starting at `row`.
+ * Nothing is copied or allocated; the result is only valid as long as `m`'s buffer.
+ */
+MATRIX_DEF matrix matrix_rows(matrix const* m, size_t row, size_t count);
+
 /**
  * Dumps the matrix into a sink.
  * Rows are separated by a '\n'; columns by a ' '.
@@ -178,9 +225,20 @@ MATRIX_DEF void matrix_pow_scalar(matrix* a, double b);
 /**
  * Maps a function to every cell of the matrix,
  * such that `m_ij = func(m_ij)`.
+ *
+ * On large matrices with `MATRIX_THREADS`, `func` is called from several threads at once.
  */
 MATRIX_DEF void matrix_map(matrix* m, double(*func)(double));
 
+/**
+ * Returns the sum of every cell of the matrix.
+ *
+ * On large matrices with `MATRIX_THREADS`, the cells are summed in parallel,
+ * so the rounding of the result depends on the number of threads,
+ * unless the deterministic mode is enabled (see `matrix_deterministic_set`).
+ */
+MATRIX_DEF double matrix_sum(matrix const* m);
+
 #ifndef MATRIX_NO_MALLOC
 
 /**
@@ -205,379 +263,5324 @@ MATRIX_DEF matrix matrix_matmul(matrix const* a, matrix const* b);
 MATRIX_DEF void matrix_matmul_into(matrix const* a, matrix const* b, matrix* dest);
 
 /**
- * Transposes the matrix in-place.
+ * Selects the (⊕, ⊗) pair of operations used by `matrix_matmul_semiring`,
+ * such that `dest_ij = ⊕_k (a_ik ⊗ b_kj)`.
+ *
+ * - `MATRIX_SEMIRING_PLUS_TIMES` - (+, ×), the ordinary matrix multiplication
+ * - `MATRIX_SEMIRING_MIN_PLUS` - (min, +), e.g. shortest paths; empty sum is `INFINITY`
+ * - `MATRIX_SEMIRING_MAX_PLUS` - (max, +), e.g. longest paths; empty sum is `-INFINITY`
+ * - `MATRIX_SEMIRING_MAX_MIN` - (max, min), e.g. widest paths; empty sum is `-INFINITY`
+ * - `MATRIX_SEMIRING_OR_AND` - (∨, ∧), e.g. reachability; every non-zero cell
+ *   is treated as `true`, and the result only contains `0.0` and `1.0`
  */
-MATRIX_DEF void matrix_transpose(matrix* m);
-
-#endif  // MATRIX_H
-#ifdef MATRIX_IMPLEMENTATION
-
-#include <assert.h>
-#include <math.h>
-#include <stdbool.h>
-#include <stddef.h>
-#include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+typedef enum {
+    MATRIX_SEMIRING_PLUS_TIMES,
+    MATRIX_SEMIRING_MIN_PLUS,
+    MATRIX_SEMIRING_MAX_PLUS,
+    MATRIX_SEMIRING_MAX_MIN,
+    MATRIX_SEMIRING_OR_AND,
+} matrix_semiring;
 
 #ifndef MATRIX_NO_MALLOC
 
-MATRIX_DEF matrix matrix_new(size_t height, size_t width) {
-    matrix m;
-    m.height = height;
-    m.width = width;
-    m.values = malloc(sizeof(double) * height * width);
-    assert(m.values);
-    return m;
-}
+/**
+ * Performs the matrix multiplication of a and b over the provided semiring.
+ * a's width must be the same as b's height.
+ *
+ * Returns a newly-allocated matrix of a's height and b's width.
+ * The new matrix needs to be then deallocated with `matrix_del`.
+ */
+MATRIX_DEF matrix matrix_matmul_semiring(matrix const* a, matrix const* b, matrix_semiring s);
 
-MATRIX_DEF matrix matrix_new_zeroed(size_t height, size_t width) {
-    matrix m;
-    m.height = height;
-    m.width = width;
-    m.values = calloc(height * width, sizeof(double));
-    assert(m.values);
-    return m;
-}
+#endif  // MATRIX_NO_MALLOC
 
-MATRIX_DEF matrix matrix_new_repeated(size_t height, size_t width, double x) {
-    matrix m = matrix_new(height, width);
-    matrix_fill_scalar(&m, x);
-    return m;
-}
+/**
+ * Performs the matrix multiplication of a and b over the provided semiring.
+ * a's width must be the same as b's height,
+ * dest's height must be the same as a's height and
+ * dest's width must be the same as b's width.
+ *
+ * This function is useful if you want to avoid malloc completely.
+ */
+MATRIX_DEF void matrix_matmul_semiring_into(matrix const* a, matrix const* b, matrix* dest,
+                                            matrix_semiring s);
 
-MATRIX_DEF matrix matrix_new_uniform(size_t height, size_t width, double a, double b) {
-    matrix m = matrix_new(height, width);
-    matrix_fill_uniform(&m, a, b);
-    return m;
-}
+/**
+ * Represents the right-hand operand of a matrix multiplication,
+ * re-arranged by `matrix_pack_b` into contiguous, cache-sized panels,
+ * in the order in which `matrix_matmul_packed` reads them.
+ *
+ * @property height - number of rows of the original matrix
+ * @property width - number of columns of the original matrix
+ * @property values - pointer to the array of `height * width` packed cells
+ * @property block_n - number of columns in a single panel, set by `matrix_pack_b_into`
+ */
+typedef struct {
+    size_t height;
+    size_t width;
+    double* values;
+    size_t block_n;
+} matrix_packed;
 
-MATRIX_DEF void matrix_del(matrix* m) {
-    assert(m && m->values);
-    assert(m->values);
-    free(m->values);
-    m->values = NULL;
-}
+#ifndef MATRIX_NO_MALLOC
 
-MATRIX_DEF matrix matrix_copy(matrix const* m) {
-    assert(m && m->values);
-    matrix m2 = matrix_new(m->height, m->width);
-    matrix_copy_into(m, &m2);
-    return m2;
-}
+/**
+ * Packs b for use as the right-hand operand of `matrix_matmul_packed`.
+ * This is useful when many different matrices are multiplied by the same b,
+ * as the packing cost is only paid once.
+ *
+ * Returned matrix needs to be later destroyed with `matrix_packed_del`.
+ */
+MATRIX_DEF matrix_packed matrix_pack_b(matrix const* b);
+
+/**
+ * Deallocates the underlaying dynamic buffer used by a packed matrix,
+ * and sets `m->values = NULL`.
+ */
+MATRIX_DEF void matrix_packed_del(matrix_packed* m);
 
 #endif  // MATRIX_NO_MALLOC
 
-MATRIX_DEF void matrix_copy_into(matrix const* src, matrix* dest) {
-    size_t src_len = matrix_len(src);
-    assert(src_len == matrix_len(dest));
-    memcpy(dest->values, src->values, sizeof(double) * src_len);
-}
+/**
+ * Packs b into `dest` for use as the right-hand operand of `matrix_matmul_packed`.
+ * dest must have the same size as b.
+ */
+MATRIX_DEF void matrix_pack_b_into(matrix const* b, matrix_packed* dest);
 
-MATRIX_DEF size_t matrix_len(matrix const* m) {
-    assert(m);
-    return m->height * m->width;
-}
+/**
+ * Performs the matrix multiplication of a and a packed b.
+ * a's width must be the same as b's height,
+ * dest's height must be the same as a's height and
+ * dest's width must be the same as b's width.
+ *
+ * Gives exactly the same results as `matrix_matmul_into`.
+ */
+MATRIX_DEF void matrix_matmul_packed(matrix const* a, matrix_packed const* b, matrix* dest);
 
-MATRIX_DEF void matrix_print(matrix const* m, FILE* sink) {
-    assert(m && m->values);
-    for (size_t row = 0; row < m->height; ++row) {
-        for (size_t col = 0; col < m->width; ++col) {
-            fprintf(sink, "%f ", matrix_get(m, row, col));
-        }
-        fputc('\n', sink);
-    }
-}
+/**
+ * Transposes the matrix in-place.
+ */
+MATRIX_DEF void matrix_transpose(matrix* m);
 
-MATRIX_DEF double matrix_get(matrix const* m, size_t row, size_t col) {
-    assert(m && m->values);
-    assert(row < m->height);
-    assert(col < m->width);
+/**
+ * Enables or disables the deterministic mode, in which every result is bit-identical
+ * regardless of the number of threads and of their scheduling. It's enabled by default
+ * if `MATRIX_DETERMINISTIC` is defined.
+ *
+ * - `matrix_sum` adds a fixed number of chunks (each one by pairwise summation)
+ *   instead of one contiguous range per thread
+ * - the matrix multiplication only splits dest by rows, so every cell is accumulated
+ *   in the same order as in the serial algorithm; otherwise, products with fewer rows than
+ *   threads are split along a's width into partial products summed afterwards
+ *
+ * Must not be called while any operation is running.
+ */
+MATRIX_DEF void matrix_deterministic_set(bool enabled);
 
-    return m->values[row * m->width + col];
-}
+/**
+ * Returns true if the deterministic mode is enabled.
+ */
+MATRIX_DEF bool matrix_deterministic_get(void);
 
-MATRIX_DEF void matrix_set(matrix const* m, size_t row, size_t col, double value) {
-    assert(m && m->values);
-    assert(row < m->height);
-    assert(col < m->width);
+/**
+ * Blocking parameters of the matrix multiplication and transposition kernels.
+ *
+ * The defaults come from the `MATRIX_MATMUL_BLOCK_K`, `MATRIX_MATMUL_BLOCK_N`,
+ * `MATRIX_TRANSPOSE_BLOCK` and `MATRIX_MATMUL_UNROLL` macros. On first use, they are
+ * overridden by the contents of the `MATRIX_TUNING` environment variable
+ * (in the `matrix_tuning_parse` format), or, if it's not set, by the file pointed to
+ * by the `MATRIX_TUNING_FILE` environment variable.
+ *
+ * @property matmul_block_k - number of rows of b multiplied at once by every row of a
+ * @property matmul_block_n - number of columns of b multiplied at once by every row of a
+ * @property transpose_block - side of the tiles swapped by the square matrix transposition
+ * @property matmul_unroll - number of rows of a (1, 2 or 4) multiplied at once by every row of b
+ */
+typedef struct {
+    size_t matmul_block_k;
+    size_t matmul_block_n;
+    size_t transpose_block;
+    size_t matmul_unroll;
+} matrix_tuning;
 
-    m->values[row * m->width + col] = value;
-}
+/**
+ * Returns the blocking parameters currently used by the kernels.
+ */
+MATRIX_DEF matrix_tuning matrix_tuning_get(void);
 
-MATRIX_DEF void matrix_fill_scalar(matrix* m, double value) {
-    size_t end = matrix_len(m);
-    for (size_t i = 0; i < end; ++i) {
-        m->values[i] = value;
-    }
-}
+/**
+ * Replaces the blocking parameters used by the kernels.
+ * Every parameter must be non-zero, and `matmul_unroll` must be 1, 2 or 4.
+ */
+MATRIX_DEF void matrix_tuning_set(matrix_tuning const* t);
 
-MATRIX_DEF void matrix_fill_uniform(matrix* m, double a, double b) {
-    assert(b > a);
-    double len = b - a;
-    double r;
+/**
+ * Parses blocking parameters from a string of whitespace-separated `key=value` pairs,
+ * e.g. `"matmul_block_k=128 matmul_block_n=256 transpose_block=32"`.
+ * Missing keys keep their value from `out`.
+ *
+ * Returns `false` (leaving `out` in an unspecified state) if the string is malformed,
+ * contains an unknown key, a value which isn't a positive decimal number fitting in `size_t`,
+ * or a `matmul_unroll` other than 1, 2 or 4.
+ */
+MATRIX_DEF bool matrix_tuning_parse(char const* str, matrix_tuning* out);
 
-    size_t end = matrix_len(m);
-    for (size_t i = 0; i < end; ++i) {
-        r = (double)rand() / (double)RAND_MAX;  // Generate a random float in range <0, 1>
-        m->values[i] = a + r * len;  // Interpolate the random number to be in correct range
-    }
-}
+/**
+ * Writes blocking parameters into a file, in the `matrix_tuning_parse` format.
+ * Returns `false` if the file couldn't be written.
+ */
+MATRIX_DEF bool matrix_tuning_save(matrix_tuning const* t, char const* path);
 
-MATRIX_DEF void matrix_add(matrix* a, matrix const* b) {
-    assert(a && a->values);
-    assert(b && b->values);
-    assert(a->height == b->height);
-    assert(a->width == b->width);
-    size_t end = matrix_len(a);
+/**
+ * Reads blocking parameters from a file written by `matrix_tuning_save`,
+ * and makes the kernels use them.
+ * Returns `false` (keeping the current parameters) if the file couldn't be read or parsed.
+ */
+MATRIX_DEF bool matrix_tuning_load(char const* path);
 
-    for (size_t i = 0; i < end; ++i)
-        a->values[i] += b->values[i];
-}
+#ifndef MATRIX_NO_MALLOC
 
-MATRIX_DEF void matrix_sub(matrix* a, matrix const* b) {
-    assert(a && a->values);
-    assert(b && b->values);
-    assert(a->height == b->height);
-    assert(a->width == b->width);
-    size_t end = matrix_len(a);
+/**
+ * Measures the kernels with different blocking and unrolling parameters on matrices
+ * of roughly `size` x `size` cells (square and rectangular shapes),
+ * makes the kernels use the fastest parameters, and returns them.
+ *
+ * The result can be persisted with `matrix_tuning_save` and restored on startup
+ * through `matrix_tuning_load` or the `MATRIX_TUNING_FILE` environment variable.
+ * A `size` of a few hundred usually gives stable results in under a few seconds.
+ */
+MATRIX_DEF matrix_tuning matrix_autotune(size_t size);
 
-    for (size_t i = 0; i < end; ++i)
-        a->values[i] -= b->values[i];
-}
+#endif  // MATRIX_NO_MALLOC
 
-MATRIX_DEF void matrix_mul(matrix* a, matrix const* b) {
-    assert(a && a->values);
-    assert(b && b->values);
-    assert(a->height == b->height);
-    assert(a->width == b->width);
-    size_t end = matrix_len(a);
+/**
+ * Represents a matrix of booleans, with 64 columns packed into every word.
+ * Every row starts at a new word, and unused bits at the end
+ * of every row must be kept at `0`.
+ *
+ * @property height - number of rows
+ * @property width - number of columns
+ * @property words - pointer to the array of `height * matrix_bits_row_words(width)` words
+ */
+typedef struct {
+    size_t height;
+    size_t width;
+    uint64_t* words;
+} matrix_bits;
 
-    for (size_t i = 0; i < end; ++i)
-        a->values[i] *= b->values[i];
-}
+/**
+ * Returns the number of words used by a single row of a `matrix_bits`
+ * with the provided width.
+ */
+MATRIX_DEF size_t matrix_bits_row_words(size_t width);
 
-MATRIX_DEF void matrix_add_scalar(matrix* a, double b) {
-    assert(a && a->values);
-    size_t end = matrix_len(a);
+#ifndef MATRIX_NO_MALLOC
 
-    for (size_t i = 0; i < end; ++i)
-        a->values[i] += b;
-}
+/**
+ * Allocates a new bit matrix with the provided size,
+ * with every cell set to `false`.
+ *
+ * Such matrix needs to be later destroyed with `matrix_bits_del`.
+ */
+MATRIX_DEF matrix_bits matrix_bits_new(size_t height, size_t width);
 
-MATRIX_DEF void matrix_sub_scalar(matrix* a, double b) {
-    assert(a && a->values);
-    size_t end = matrix_len(a);
+/**
+ * Allocates a new bit matrix with the same size as `m`,
+ * with cells set to `true` wherever `m` has a non-zero value.
+ *
+ * Such matrix needs to be later destroyed with `matrix_bits_del`.
+ */
+MATRIX_DEF matrix_bits matrix_bits_from_matrix(matrix const* m);
 
-    for (size_t i = 0; i < end; ++i)
-        a->values[i] -= b;
-}
+/**
+ * Deallocates the underlaying dynamic buffer used by a bit matrix,
+ * and sets `m->words = NULL`.
+ */
+MATRIX_DEF void matrix_bits_del(matrix_bits* m);
 
-MATRIX_DEF void matrix_mul_scalar(matrix* a, double b) {
-    assert(a && a->values);
-    size_t end = matrix_len(a);
+/**
+ * Performs the boolean matrix multiplication of a and b,
+ * such that `dest_ij = OR_k (a_ik AND b_kj)`.
+ * a's width must be the same as b's height.
+ *
+ * Returns a newly-allocated bit matrix of a's height and b's width.
+ * The new matrix needs to be then deallocated with `matrix_bits_del`.
+ */
+MATRIX_DEF matrix_bits matrix_bits_matmul(matrix_bits const* a, matrix_bits const* b);
 
-    for (size_t i = 0; i < end; ++i)
-        a->values[i] *= b;
-}
+#endif  // MATRIX_NO_MALLOC
 
-MATRIX_DEF void matrix_pow_scalar(matrix* a, double b) {
-    assert(a && a->values);
-    size_t end = matrix_len(a);
+/**
+ * Fills the `dest` bit matrix with `true` wherever `src` has a non-zero value.
+ * Both matrices must have the same size.
+ */
+MATRIX_DEF void matrix_bits_from_matrix_into(matrix const* src, matrix_bits* dest);
 
-    for (size_t i = 0; i < end; ++i)
-        a->values[i] = pow(a->values[i], b);
-}
+/**
+ * Fills the `dest` matrix with `1.0` wherever `src` is `true`, and `0.0` elsewhere.
+ * Both matrices must have the same size.
+ */
+MATRIX_DEF void matrix_bits_to_matrix_into(matrix_bits const* src, matrix* dest);
+
+/**
+ * Retrieves the value from a particular cell of the bit matrix `m`.
+ */
+MATRIX_DEF bool matrix_bits_get(matrix_bits const* m, size_t row, size_t col);
+
+/**
+ * Sets a value of a particular cell of the bit matrix `m`.
+ */
+MATRIX_DEF void matrix_bits_set(matrix_bits const* m, size_t row, size_t col, bool value);
+
+/**
+ * Returns the number of `true` cells in the bit matrix.
+ */
+MATRIX_DEF size_t matrix_bits_count(matrix_bits const* m);
+
+/**
+ * Performs element-wise conjunction of b into a,
+ * such that `a_ij = a_ij AND b_ij`.
+ */
+MATRIX_DEF void matrix_bits_and(matrix_bits* a, matrix_bits const* b);
+
+/**
+ * Performs element-wise disjunction of b into a,
+ * such that `a_ij = a_ij OR b_ij`.
+ */
+MATRIX_DEF void matrix_bits_or(matrix_bits* a, matrix_bits const* b);
+
+/**
+ * Performs element-wise exclusive disjunction of b into a,
+ * such that `a_ij = a_ij XOR b_ij`.
+ */
+MATRIX_DEF void matrix_bits_xor(matrix_bits* a, matrix_bits const* b);
+
+/**
+ * Performs the boolean matrix multiplication of a and b,
+ * such that `dest_ij = OR_k (a_ik AND b_kj)`.
+ * a's width must be the same as b's height,
+ * dest's height must be the same as a's height and
+ * dest's width must be the same as b's width.
+ *
+ * Every set bit of a row of a ORs a whole row of b into dest,
+ * 64 columns at a time.
+ */
+MATRIX_DEF void matrix_bits_matmul_into(matrix_bits const* a, matrix_bits const* b,
+                                        matrix_bits* dest);
+
+/**
+ * Replaces a square bit matrix (an adjacency matrix of a graph)
+ * with its transitive closure in-place, such that `m_ij` is `true`
+ * iff there's a path of at least one edge from i to j.
+ *
+ * Uses Warshall's algorithm, with rows ORed 64 columns at a time.
+ */
+MATRIX_DEF void matrix_bits_transitive_closure(matrix_bits* m);
+
+/**
+ * Represents a square diagonal matrix, storing only its diagonal.
+ *
+ * @property size - number of rows and columns
+ * @property values - pointer to the array of `size` diagonal cells
+ */
+typedef struct {
+    size_t size;
+    double* values;
+} matrix_diag;
+
+/**
+ * Represents a banded matrix, storing only cells with `row - lower <= col <= row + upper`.
+ * A tridiagonal matrix is a square banded matrix with `lower = upper = 1`.
+ *
+ * Cells are kept row-by-row, with `lower + upper + 1` cells per row,
+ * such that `m_ij = values[i * (lower + upper + 1) + (j - i + lower)]`.
+ * Slots outside of the matrix (e.g. left of the first column) must be kept at `0.0`.
+ *
+ * @property height - number of rows
+ * @property width - number of columns
+ * @property lower - number of sub-diagonals
+ * @property upper - number of super-diagonals
+ * @property values - pointer to the array of `matrix_banded_len` cells
+ */
+typedef struct {
+    size_t height;
+    size_t width;
+    size_t lower;
+    size_t upper;
+    double* values;
+} matrix_banded;
+
+/**
+ * Represents a square symmetric matrix, storing only its lower triangle.
+ *
+ * Cells are packed row-by-row, such that for `i >= j`,
+ * `m_ij = m_ji = values[i * (i + 1) / 2 + j]`.
+ *
+ * @property size - number of rows and columns
+ * @property values - pointer to the array of `matrix_sym_len` cells
+ */
+typedef struct {
+    size_t size;
+    double* values;
+} matrix_sym;
+
+/**
+ * Returns the number of stored cells of a banded matrix.
+ */
+MATRIX_DEF size_t matrix_banded_len(matrix_banded const* m);
+
+/**
+ * Returns the number of stored cells of a symmetric matrix (`size * (size + 1) / 2`).
+ */
+MATRIX_DEF size_t matrix_sym_len(matrix_sym const* m);
+
+#ifndef MATRIX_NO_MALLOC
+
+/**
+ * Allocates a new diagonal matrix of the provided size, filled with `0.0`.
+ *
+ * Such matrix needs to be later destroyed with `matrix_diag_del`.
+ */
+MATRIX_DEF matrix_diag matrix_diag_new(size_t size);
+
+/**
+ * Allocates a new banded matrix of the provided size and bandwidth, filled with `0.0`.
+ *
+ * Such matrix needs to be later destroyed with `matrix_banded_del`.
+ */
+MATRIX_DEF matrix_banded matrix_banded_new(size_t height, size_t width, size_t lower,
+                                           size_t upper);
+
+/**
+ * Allocates a new symmetric matrix of the provided size, filled with `0.0`.
+ *
+ * Such matrix needs to be later destroyed with `matrix_sym_del`.
+ */
+MATRIX_DEF matrix_sym matrix_sym_new(size_t size);
+
+/**
+ * Deallocates the underlaying dynamic buffer used by a diagonal matrix,
+ * and sets `m->values = NULL`.
+ */
+MATRIX_DEF void matrix_diag_del(matrix_diag* m);
+
+/**
+ * Deallocates the underlaying dynamic buffer used by a banded matrix,
+ * and sets `m->values = NULL`.
+ */
+MATRIX_DEF void matrix_banded_del(matrix_banded* m);
+
+/**
+ * Deallocates the underlaying dynamic buffer used by a symmetric matrix,
+ * and sets `m->values = NULL`.
+ */
+MATRIX_DEF void matrix_sym_del(matrix_sym* m);
+
+#endif  // MATRIX_NO_MALLOC
+
+/**
+ * Retrieves the value from a particular cell of the banded matrix `m`.
+ * Cells outside of the band are always `0.0`.
+ */
+MATRIX_DEF double matrix_banded_get(matrix_banded const* m, size_t row, size_t col);
+
+/**
+ * Sets a value of a particular cell of the banded matrix `m`.
+ * The cell must lie inside of the band.
+ */
+MATRIX_DEF void matrix_banded_set(matrix_banded const* m, size_t row, size_t col, double value);
+
+/**
+ * Retrieves the value from a particular cell of the symmetric matrix `m`.
+ */
+MATRIX_DEF double matrix_sym_get(matrix_sym const* m, size_t row, size_t col);
+
+/**
+ * Sets a value of a particular cell of the symmetric matrix `m`,
+ * and the mirrored cell `m_col,row` at the same time.
+ */
+MATRIX_DEF void matrix_sym_set(matrix_sym const* m, size_t row, size_t col, double value);
+
+/**
+ * Fills the `dest` diagonal matrix with the diagonal of a square `src`.
+ */
+MATRIX_DEF void matrix_diag_from_matrix_into(matrix const* src, matrix_diag* dest);
+
+/**
+ * Fills the `dest` banded matrix with cells of `src` lying inside of the band.
+ * Both matrices must have the same size.
+ */
+MATRIX_DEF void matrix_banded_from_matrix_into(matrix const* src, matrix_banded* dest);
+
+/**
+ * Fills the `dest` symmetric matrix with the lower triangle of a square `src`.
+ */
+MATRIX_DEF void matrix_sym_from_matrix_into(matrix const* src, matrix_sym* dest);
+
+/**
+ * Fills the `dest` matrix with all cells of a diagonal matrix, including the zeros.
+ */
+MATRIX_DEF void matrix_diag_to_matrix_into(matrix_diag const* src, matrix* dest);
+
+/**
+ * Fills the `dest` matrix with all cells of a banded matrix, including the zeros.
+ */
+MATRIX_DEF void matrix_banded_to_matrix_into(matrix_banded const* src, matrix* dest);
+
+/**
+ * Fills the `dest` matrix with all cells of a symmetric matrix.
+ */
+MATRIX_DEF void matrix_sym_to_matrix_into(matrix_sym const* src, matrix* dest);
+
+/**
+ * Performs the matrix multiplication of a diagonal a and a dense b,
+ * such that `dest_ij = a_ii * b_ij`, in O(size * b's width).
+ * dest must have the same size as b.
+ */
+MATRIX_DEF void matrix_diag_matmul_into(matrix_diag const* a, matrix const* b, matrix* dest);
+
+/**
+ * Performs the matrix multiplication of a banded a and a dense b,
+ * in O(a's height * (lower + upper + 1) * b's width).
+ * a's width must be the same as b's height,
+ * dest's height must be the same as a's height and
+ * dest's width must be the same as b's width.
+ */
+MATRIX_DEF void matrix_banded_matmul_into(matrix_banded const* a, matrix const* b, matrix* dest);
+
+/**
+ * Performs the matrix multiplication of a symmetric a and a dense b,
+ * reading every stored cell of a only once.
+ * a's size must be the same as b's height,
+ * dest must have the same size as b.
+ */
+MATRIX_DEF void matrix_sym_matmul_into(matrix_sym const* a, matrix const* b, matrix* dest);
+
+/**
+ * Solves `a * x = b` for a tridiagonal a (a square banded matrix with `lower = upper = 1`)
+ * using the Thomas algorithm in O(size * b's width), replacing b with x.
+ * Every column of b is treated as a separate right-hand side.
+ *
+ * No pivoting is done, so a should be e.g. diagonally dominant.
+ * `scratch` must point to an array of at least a's height doubles.
+ */
+MATRIX_DEF void matrix_tridiag_solve(matrix_banded const* a, matrix* b, double* scratch);
+
+/**
+ * Represents the Kronecker product `a ⊗ b` without materializing it.
+ * The product has `a->height * b->height` rows and `a->width * b->width` columns,
+ * and only borrows both operands.
+ *
+ * @property a - the left operand
+ * @property b - the right operand
+ */
+typedef struct {
+    matrix const* a;
+    matrix const* b;
+} matrix_kron_op;
+
+#ifndef MATRIX_NO_MALLOC
+
+/**
+ * Computes the Kronecker product of a and b, such that
+ * `dest_(i*bh + p),(j*bw + q) = a_ij * b_pq`.
+ *
+ * Returns a newly-allocated matrix of `a's height * b's height` rows and
+ * `a's width * b's width` columns.
+ * The new matrix needs to be then deallocated with `matrix_del`.
+ */
+MATRIX_DEF matrix matrix_kron(matrix const* a, matrix const* b);
+
+#endif  // MATRIX_NO_MALLOC
+
+/**
+ * Computes the Kronecker product of a and b, such that
+ * `dest_(i*bh + p),(j*bw + q) = a_ij * b_pq`.
+ * dest's height must be `a's height * b's height` and
+ * dest's width must be `a's width * b's width`.
+ */
+MATRIX_DEF void matrix_kron_into(matrix const* a, matrix const* b, matrix* dest);
+
+/**
+ * Returns the number of doubles required by the `scratch` buffer of `matrix_kron_matvec`
+ * (`a's width * b's height`).
+ */
+MATRIX_DEF size_t matrix_kron_scratch_len(matrix_kron_op const* op);
+
+/**
+ * Computes `y = (a ⊗ b) * x` without materializing `a ⊗ b`,
+ * where x has `a's width * b's width` elements and y has
+ * `a's height * b's height` elements.
+ *
+ * Uses the row-major form of `(A ⊗ B) vec(X) = vec(B X Aᵀ)`: with x read row-by-row
+ * as an `a's width × b's width` matrix X, y is `A X Bᵀ` stored row-by-row.
+ * This takes O(aw·bw·bh + ah·aw·bh) operations instead of O(ah·bh·aw·bw).
+ *
+ * `scratch` must point to an array of at least `matrix_kron_scratch_len` doubles.
+ */
+MATRIX_DEF void matrix_kron_matvec(matrix_kron_op const* op, double const* x, double* y,
+                                   double* scratch);
+
+/**
+ * Writes a matrix into a file.
+ *
+ * Matrix files start with a 32-byte header: the magic string `MATRIX01`, then
+ * height, width and a reserved field as unsigned 64-bit integers, followed by
+ * `height * width` row-major doubles. All numbers use the native byte order.
+ *
+ * Returns false if the file couldn't be written.
+ */
+MATRIX_DEF bool matrix_save(matrix const* m, char const* path);
+
+/**
+ * Reads the height and width of the matrix stored in a file written by `matrix_save`.
+ * Returns false if the file couldn't be read or isn't a matrix file.
+ */
+MATRIX_DEF bool matrix_file_shape(char const* path, size_t* height, size_t* width);
+
+/**
+ * Reads the matrix stored in a file written by `matrix_save` into dest,
+ * which must have the same shape as the stored matrix.
+ * Returns false if the file couldn't be read, isn't a matrix file or its shape doesn't match.
+ */
+MATRIX_DEF bool matrix_load_into(char const* path, matrix* dest);
+
+#ifndef MATRIX_NO_MALLOC
+
+/**
+ * Reads the matrix stored in a file written by `matrix_save`.
+ *
+ * Returns a newly-allocated matrix, which needs to be then deallocated with `matrix_del`,
+ * or a matrix with NULL `values` if the file couldn't be read.
+ */
+MATRIX_DEF matrix matrix_load(char const* path);
+
+/**
+ * Multiplies the matrices stored in files `a_path` and `b_path` (in the `matrix_save` format),
+ * and writes the product into `dest_path`, without ever holding any of them in memory.
+ *
+ * The product is computed in tiles, so that the tiles of a, b and dest in memory
+ * take at most about `memory_budget` bytes. With `MATRIX_THREADS`, tiles for the next step
+ * are read on a separate thread while the current ones are multiplied.
+ *
+ * Returns false if any of the files couldn't be read or written,
+ * the shapes don't match, or the budget is too small for even a single cell per tile.
+ */
+MATRIX_DEF bool matrix_matmul_ooc(char const* a_path, char const* b_path, char const* dest_path,
+                                  size_t memory_budget);
+
+#endif  // MATRIX_NO_MALLOC
+
+#if defined(MATRIX_SHM) && !defined(MATRIX_MMAP)
+#define MATRIX_MMAP
+#endif
+
+#ifdef MATRIX_MMAP
+
+/**
+ * How `matrix_open_mapped` maps a matrix file.
+ *
+ * @value MATRIX_MAP_READ - read-only; writing into `values` crashes
+ * @value MATRIX_MAP_SHARED - writes go to the file (the file is created if it doesn't exist)
+ * @value MATRIX_MAP_SNAPSHOT - writes are private to this mapping, and pages are copied
+ *   only when first written to. Pages which weren't written to yet may or may not reflect
+ *   later changes of the file made by others.
+ */
+typedef enum {
+    MATRIX_MAP_READ,
+    MATRIX_MAP_SHARED,
+    MATRIX_MAP_SNAPSHOT,
+} matrix_map_mode;
+
+/**
+ * Maps a matrix file (in the `matrix_save` format) of the given shape into memory,
+ * so that `values` of the returned matrix live in the file.
+ *
+ * Only available if `MATRIX_MMAP` is defined (requires POSIX).
+ * Snapshots are a cheap alternative to `matrix_copy` of persisted matrices:
+ * only the pages which get modified are ever copied.
+ *
+ * Returns a matrix with NULL `values` if the file couldn't be opened or mapped,
+ * or it holds a matrix of a different shape. The returned matrix needs to be then
+ * closed with `matrix_close_mapped` (not `matrix_del`).
+ */
+MATRIX_DEF matrix matrix_open_mapped(char const* path, size_t height, size_t width,
+                                     matrix_map_mode mode);
+
+/**
+ * Flushes changes of a matrix opened in the `MATRIX_MAP_SHARED` mode into its file,
+ * waiting for the write to finish. Returns false on failure.
+ */
+MATRIX_DEF bool matrix_sync(matrix const* m);
+
+/**
+ * Unmaps a matrix returned by `matrix_open_mapped`. Changes of a `MATRIX_MAP_SHARED` matrix
+ * reach the file eventually even without `matrix_sync`.
+ */
+MATRIX_DEF void matrix_close_mapped(matrix* m);
+
+#ifdef MATRIX_SHM
+
+/**
+ * Creates a POSIX shared memory object with the provided name (e.g. "/weights"),
+ * holding a zeroed matrix of the given shape, and maps it for reading and writing.
+ *
+ * Only available if `MATRIX_SHM` is defined (which implies `MATRIX_MMAP`).
+ * Other processes can then map the same matrix with `matrix_shm_attach`;
+ * several producers can fill disjoint `matrix_rows` of it concurrently.
+ *
+ * Returns a matrix with NULL `values` if the object already exists or couldn't be created.
+ * The returned matrix needs to be then detached with `matrix_shm_detach`,
+ * and the object eventually removed with `matrix_shm_unlink`.
+ */
+MATRIX_DEF matrix matrix_shm_create(char const* name, size_t height, size_t width);
+
+/**
+ * Maps the matrix of a shared memory object created by `matrix_shm_create`,
+ * read-only unless `writable` is set.
+ *
+ * Returns a matrix with NULL `values` if the object doesn't exist,
+ * or holds a matrix of a different shape.
+ */
+MATRIX_DEF matrix matrix_shm_attach(char const* name, size_t height, size_t width,
+                                    bool writable);
+
+/**
+ * Unmaps a matrix returned by `matrix_shm_create` or `matrix_shm_attach`.
+ */
+MATRIX_DEF void matrix_shm_detach(matrix* m);
+
+/**
+ * Removes a shared memory object. Processes which have it mapped keep using it
+ * until they detach. Returns false if the object doesn't exist.
+ */
+MATRIX_DEF bool matrix_shm_unlink(char const* name);
+
+#endif  // MATRIX_SHM
+
+#endif  // MATRIX_MMAP
+
+#if defined(MATRIX_DIST) && !defined(MATRIX_NO_MALLOC)
+
+/**
+ * Reliable, ordered point-to-point channels between `size` processes (ranks).
+ * Only available if `MATRIX_DIST` is defined.
+ *
+ * `send` and `recv` transfer exactly `len` bytes to or from another rank,
+ * blocking until done, and return false on failure. Any implementation
+ * (e.g. over TCP or MPI) can be used by filling in this struct;
+ * `matrix_socket_mesh` provides one over Unix domain sockets.
+ *
+ * @property rank - index of the current process, in `[0, size)`
+ * @property size - number of processes
+ * @property user - data of the implementation
+ */
+typedef struct matrix_transport {
+    size_t rank;
+    size_t size;
+    bool (*send)(struct matrix_transport* t, size_t to, void const* data, size_t len);
+    bool (*recv)(struct matrix_transport* t, size_t from, void* data, size_t len);
+    void* user;
+} matrix_transport;
+
+/**
+ * Forks `size - 1` worker processes, connected with the current one (and each other)
+ * by Unix domain sockets, and fills `t` with a transport over them.
+ *
+ * Like `fork`, this returns in every process: with `t->rank` 0 in the current one,
+ * and 1 to `size - 1` in the workers. Workers should exit once done,
+ * after calling `matrix_socket_mesh_close`. Returns false (in the current process only)
+ * if the sockets or processes couldn't be created.
+ */
+MATRIX_DEF bool matrix_socket_mesh(size_t size, matrix_transport* t);
+
+/**
+ * Closes a transport created by `matrix_socket_mesh`. In rank 0, also waits for all workers
+ * to exit, and returns false if any of them didn't exit with status 0.
+ */
+MATRIX_DEF bool matrix_socket_mesh_close(matrix_transport* t);
+
+/**
+ * Returns the range `[*begin, *end)` of `n` rows or columns assigned to `part` out of `parts`,
+ * when they're split as evenly as possible in order.
+ */
+MATRIX_DEF void matrix_grid_range(size_t n, size_t parts, size_t part, size_t* begin,
+                                  size_t* end);
+
+/**
+ * Computes `dest = a * b` of matrices distributed over a 2D grid of processes with SUMMA.
+ * Must be called by all ranks of the transport at once.
+ *
+ * Ranks form a `grid_rows x grid_cols` grid row by row (rank `i * grid_cols + j` is at `(i, j)`),
+ * and `grid_rows * grid_cols` must equal the number of ranks. The global `n x m` matrix A,
+ * `m x p` matrix B and `n x p` matrix C are split into blocks with `matrix_grid_range`:
+ * the process at `(i, j)` passes its blocks
+ * - `a` - rows `range(n, grid_rows, i)`, columns `range(m, grid_cols, j)` of A
+ * - `b` - rows `range(m, grid_rows, i)`, columns `range(p, grid_cols, j)` of B
+ * - `dest` - rows `range(n, grid_rows, i)`, columns `range(p, grid_cols, j)` of C
+ *
+ * Panels of A are broadcast along grid rows and panels of B along grid columns,
+ * so every process only ever holds its own blocks and one panel of each.
+ * Panels are `matmul_block_k` (see `matrix_tuning`) of rank 0 wide.
+ * Returns false if the transport failed.
+ */
+MATRIX_DEF bool matrix_matmul_summa(matrix_transport* t, size_t grid_rows, size_t grid_cols,
+                                    size_t m, matrix const* a, matrix const* b, matrix* dest);
+
+#endif  // MATRIX_DIST && !MATRIX_NO_MALLOC
+
+#if defined(MATRIX_INSTRUMENT) || defined(MATRIX_TRACE)
+
+/**
+ * Identifies an instrumented operation.
+ * Every value corresponds to the function with the same name.
+ *
+ * Accessors (`matrix_get`, `matrix_set`, ...) and allocation functions are not instrumented.
+ * Operations called by another instrumented operation (e.g. `matrix_fill_scalar`
+ * inside of `matrix_matmul_into`) are attributed to the outermost one only.
+ */
+typedef enum {
+    MATRIX_OP_COPY_INTO,
+    MATRIX_OP_PRINT,
+    MATRIX_OP_FILL_SCALAR,
+    MATRIX_OP_FILL_UNIFORM,
+    MATRIX_OP_ADD,
+    MATRIX_OP_SUB,
+    MATRIX_OP_MUL,
+    MATRIX_OP_ADD_SCALAR,
+    MATRIX_OP_SUB_SCALAR,
+    MATRIX_OP_MUL_SCALAR,
+    MATRIX_OP_POW_SCALAR,
+    MATRIX_OP_MAP,
+    MATRIX_OP_SUM,
+    MATRIX_OP_MATMUL_SEMIRING_INTO,
+    MATRIX_OP_PACK_B_INTO,
+    MATRIX_OP_MATMUL_PACKED,
+    MATRIX_OP_TRANSPOSE,
+    MATRIX_OP_BITS_MATMUL_INTO,
+    MATRIX_OP_BITS_TRANSITIVE_CLOSURE,
+    MATRIX_OP_DIAG_MATMUL_INTO,
+    MATRIX_OP_BANDED_MATMUL_INTO,
+    MATRIX_OP_SYM_MATMUL_INTO,
+    MATRIX_OP_TRIDIAG_SOLVE,
+    MATRIX_OP_KRON_INTO,
+    MATRIX_OP_KRON_MATVEC,
+    MATRIX_OP_MATMUL_OOC,
+    MATRIX_OP_MATMUL_SUMMA,
+    MATRIX_OP_COUNT,
+} matrix_op;
+
+/**
+ * Returns the name of an operation, without the `matrix_` prefix.
+ */
+MATRIX_DEF char const* matrix_op_name(matrix_op op);
+
+#endif  // MATRIX_INSTRUMENT || MATRIX_TRACE
+
+#ifdef MATRIX_INSTRUMENT
+
+/**
+ * Cumulative statistics of a single operation.
+ *
+ * @property name - name of the operation, without the `matrix_` prefix
+ * @property calls - number of completed calls
+ * @property nanoseconds - total wall time spent in the operation
+ * @property flops - total number of floating-point operations performed
+ * @property bytes - total (minimal) number of bytes read and written
+ */
+typedef struct {
+    char const* name;
+    uint64_t calls;
+    uint64_t nanoseconds;
+    uint64_t flops;
+    uint64_t bytes;
+} matrix_op_stats;
+
+/**
+ * Callback invoked before (`end == false`) and after (`end == true`)
+ * every instrumented operation, with the shape of its first matrix argument.
+ * Time spent in the callback is not counted towards the operation.
+ */
+typedef void (*matrix_hook)(void* user, matrix_op op, bool end, size_t height, size_t width);
+
+/**
+ * Copies current statistics of every operation into `out`,
+ * which must have room for `MATRIX_OP_COUNT` elements (indexed by `matrix_op`).
+ */
+MATRIX_DEF void matrix_stats_snapshot(matrix_op_stats* out);
+
+/**
+ * Zeroes statistics of every operation.
+ */
+MATRIX_DEF void matrix_stats_reset(void);
+
+/**
+ * Installs a callback invoked around every instrumented operation,
+ * or removes it if `hook` is NULL.
+ */
+MATRIX_DEF void matrix_set_hook(matrix_hook hook, void* user);
+
+#endif  // MATRIX_INSTRUMENT
+
+#ifdef MATRIX_TRACE
+
+/**
+ * Enables or disables recording of trace events (enabled by default).
+ *
+ * When `MATRIX_TRACE` is defined, every instrumented operation (see `matrix_op`)
+ * records its name, start and end time, shape and calling thread into a per-thread ring buffer
+ * of `MATRIX_TRACE_CAPACITY` events. Once a buffer is full, the oldest events are overwritten.
+ *
+ * With `MATRIX_THREADS`, the buffer of a thread which exits is handed over to the next thread
+ * which starts recording (so threads which never ran at the same time may share a track),
+ * and `matrix_trace_clear` frees the ones not in use. Without it, every thread which ever
+ * recorded an event keeps its buffer until the program exits.
+ */
+MATRIX_DEF void matrix_trace_enable(bool enabled);
+
+/**
+ * Writes recorded events as Chrome trace JSON, which can be opened
+ * in `chrome://tracing` or <https://ui.perfetto.dev>.
+ *
+ * Events recorded concurrently with the dump may be omitted or, if their ring buffer
+ * wraps around during the dump, torn - so preferably dump once the work is done.
+ */
+MATRIX_DEF void matrix_trace_dump(FILE* sink);
+
+/**
+ * Discards all recorded events (and, with `MATRIX_THREADS`, the buffers of exited threads).
+ * Must not run concurrently with any matrix operations.
+ */
+MATRIX_DEF void matrix_trace_clear(void);
+
+#endif  // MATRIX_TRACE
+
+#ifdef MATRIX_THREADS
+
+/**
+ * Starts the library thread pool with `count` participating threads (including the caller),
+ * or one per online processor if `count` is 0.
+ *
+ * Only available if `MATRIX_THREADS` is defined (requires pthreads).
+ * Work is split into `count` contiguous ranges, and range `i` goes to thread `i`,
+ * unless that thread is busy with an asynchronous operation; another thread takes it then.
+ * Returns false if the pool is already running or the threads couldn't be started.
+ */
+MATRIX_DEF bool matrix_threads_init(size_t count);
+
+/**
+ * Stops the library thread pool. Must not be called while any operation is running.
+ */
+MATRIX_DEF void matrix_threads_shutdown(void);
+
+/**
+ * Returns the number of threads participating in parallel operations (1 if the pool isn't running).
+ */
+MATRIX_DEF size_t matrix_threads_count(void);
+
+#ifndef MATRIX_NO_MALLOC
+
+/**
+ * Handle of an operation running on the library thread pool.
+ * Every handle must be eventually passed to `matrix_wait`, which frees it.
+ */
+typedef struct matrix_future matrix_future;
+
+/**
+ * Starts `matrix_matmul_into(a, b, dest)` on the library thread pool, and returns right away.
+ * None of the matrices may be used (or dest read) until the operation is done.
+ *
+ * If the pool isn't running, the operation is performed before returning.
+ * If the handle couldn't be allocated, the operation is performed before returning NULL
+ * (`matrix_poll` and `matrix_wait` accept NULL handles).
+ */
+MATRIX_DEF matrix_future* matrix_matmul_async(matrix const* a, matrix const* b, matrix* dest);
+
+/**
+ * Starts `matrix_transpose(m)` on the library thread pool, see `matrix_matmul_async`.
+ */
+MATRIX_DEF matrix_future* matrix_transpose_async(matrix* m);
+
+/**
+ * Starts `matrix_copy_into(src, dest)` on the library thread pool, see `matrix_matmul_async`.
+ */
+MATRIX_DEF matrix_future* matrix_copy_into_async(matrix const* src, matrix* dest);
+
+/**
+ * Starts `matrix_fill_scalar(m, x)` on the library thread pool, see `matrix_matmul_async`.
+ */
+MATRIX_DEF matrix_future* matrix_fill_scalar_async(matrix* m, double x);
+
+/**
+ * Returns whether the operation of a handle is done, without blocking.
+ */
+MATRIX_DEF bool matrix_poll(matrix_future const* f);
+
+/**
+ * Waits until the operation of a handle is done, and frees the handle.
+ * If no pool thread started the operation yet, it's performed by the calling thread.
+ *
+ * In a forked child, operations which weren't done at the time of the fork are performed
+ * by the calling thread, from the start. The result of an in-place operation
+ * (e.g. `matrix_transpose_async`) which was already running then is unspecified.
+ */
+MATRIX_DEF void matrix_wait(matrix_future* f);
+
+/**
+ * Graph of tasks with dependencies, run by the library thread pool.
+ *
+ * Every task declares which data it reads and writes, identified by pointers
+ * (e.g. `values` of a tile). Tasks run in parallel, except that a task runs only after
+ * all previously added tasks which write data it reads or writes,
+ * or read data it writes. Ready tasks are kept in a deque per thread,
+ * and idle threads steal from the deques of other threads.
+ */
+typedef struct matrix_graph matrix_graph;
+
+/**
+ * Function run by a task of a `matrix_graph`
+ */
+typedef void (*matrix_task_fn)(void* ctx);
+
+/**
+ * Creates an empty task graph, which needs to be later destroyed with `matrix_graph_del`.
+ * Returns NULL if it couldn't be allocated.
+ */
+MATRIX_DEF matrix_graph* matrix_graph_new(void);
+
+/**
+ * Destroys a task graph.
+ */
+MATRIX_DEF void matrix_graph_del(matrix_graph* g);
+
+/**
+ * Adds a task calling `fn(ctx)`, which reads data identified by `reads_len` pointers in `reads`,
+ * and writes data identified by `writes_len` pointers in `writes`.
+ * Returns false if memory couldn't be allocated (the graph is then left unchanged).
+ */
+MATRIX_DEF bool matrix_graph_add(matrix_graph* g, matrix_task_fn fn, void* ctx,
+                                 void const* const* reads, size_t reads_len,
+                                 void const* const* writes, size_t writes_len);
+
+/**
+ * Runs all tasks of a graph on the calling thread and the library thread pool,
+ * and returns once all of them are done. The graph is then empty and can be reused.
+ *
+ * Library operations called by the tasks don't parallelize themselves any further.
+ * Returns false (without running anything) if memory couldn't be allocated.
+ */
+MATRIX_DEF bool matrix_graph_run(matrix_graph* g);
+
+#endif  // MATRIX_NO_MALLOC
+
+#endif  // MATRIX_THREADS
+
+#if defined(MATRIX_TRACK_ALLOCS) && !defined(MATRIX_NO_MALLOC)
+
+/**
+ * Statistics of buffers allocated by the library (`matrix_new`, `matrix_copy`,
+ * `matrix_matmul`, `matrix_bits_new`, `matrix_pack_b`, ...).
+ *
+ * @property live_bytes - number of bytes currently allocated
+ * @property live_allocations - number of buffers currently allocated
+ * @property peak_bytes - highest value of `live_bytes` (since the last `matrix_alloc_reset_peak`)
+ * @property total_allocations - number of buffers ever allocated
+ */
+typedef struct {
+    size_t live_bytes;
+    size_t live_allocations;
+    size_t peak_bytes;
+    size_t total_allocations;
+} matrix_alloc_stats;
+
+/**
+ * Returns current allocation statistics.
+ *
+ * Only available if `MATRIX_TRACK_ALLOCS` is defined. In that mode every buffer
+ * is prefixed by a small header, which links it into a list of live buffers.
+ */
+MATRIX_DEF matrix_alloc_stats matrix_alloc_stats_get(void);
+
+/**
+ * Resets the `peak_bytes` statistic to the current `live_bytes`.
+ */
+MATRIX_DEF void matrix_alloc_reset_peak(void);
+
+/**
+ * Writes a line describing every buffer which is still allocated (its kind, shape and size)
+ * into `sink`, and returns the number of such buffers.
+ */
+MATRIX_DEF size_t matrix_alloc_report_leaks(FILE* sink);
+
+/**
+ * Makes the program call `matrix_alloc_report_leaks(stderr)` on exit
+ * (if there are any outstanding buffers). Repeated calls have no further effect.
+ */
+MATRIX_DEF void matrix_alloc_report_leaks_at_exit(void);
+
+#endif  // MATRIX_TRACK_ALLOCS && !MATRIX_NO_MALLOC
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // MATRIX_H
+#ifdef MATRIX_IMPLEMENTATION
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(MATRIX_INSTRUMENT) || defined(MATRIX_TRACE) || defined(MATRIX_TRACK_ALLOCS) || \
+    defined(MATRIX_THREADS) || defined(MATRIX_COW)
+#include <stdatomic.h>
+#endif
+
+#if defined(MATRIX_INSTRUMENT) || defined(MATRIX_TRACE)
+#define MATRIX__OBSERVE_OPS
+#endif
+
+#ifdef MATRIX_THREADS
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#if (defined(MATRIX_HUGEPAGES) && !defined(MATRIX_NO_MALLOC)) || defined(MATRIX_MMAP)
+#include <sys/mman.h>
+#endif
+
+#if defined(MATRIX_DIST) && !defined(MATRIX_NO_MALLOC)
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifdef MATRIX_MMAP
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MATRIX__STREAM_STORES
+#endif
+
+#if defined(MATRIX_TRACE) && defined(MATRIX_NO_MALLOC)
+#error "MATRIX_TRACE requires dynamic allocation of trace buffers"
+#endif
+
+// Clocks
+
+/// Reads a clock suitable for measuring durations. Wall clocks may be stepped back
+/// (e.g. by NTP), so a monotonic one is used whenever the headers provide it.
+MATRIX_DEF void matrix__clock(struct timespec* ts) {
+#if defined(CLOCK_MONOTONIC)
+    clock_gettime(CLOCK_MONOTONIC, ts);
+#elif defined(TIME_MONOTONIC)
+    timespec_get(ts, TIME_MONOTONIC);
+#else
+    timespec_get(ts, TIME_UTC);
+#endif
+}
+
+// Instrumentation and tracing
+
+#ifdef MATRIX__OBSERVE_OPS
+
+/// Names of operations, indexed by matrix_op
+static char const* const matrix__op_names[MATRIX_OP_COUNT] = {
+    "copy_into",
+    "print",
+    "fill_scalar",
+    "fill_uniform",
+    "add",
+    "sub",
+    "mul",
+    "add_scalar",
+    "sub_scalar",
+    "mul_scalar",
+    "pow_scalar",
+    "map",
+    "sum",
+    "matmul_semiring_into",
+    "pack_b_into",
+    "matmul_packed",
+    "transpose",
+    "bits_matmul_into",
+    "bits_transitive_closure",
+    "diag_matmul_into",
+    "banded_matmul_into",
+    "sym_matmul_into",
+    "tridiag_solve",
+    "kron_into",
+    "kron_matvec",
+    "matmul_ooc",
+    "matmul_summa",
+};
+
+/// Depth of nested instrumented operations on the current thread
+static _Thread_local unsigned matrix__op_depth;
+
+/// State of a single instrumented call, kept on the stack of the operation
+typedef struct {
+    matrix_op op;
+    bool outermost;
+    size_t height;
+    size_t width;
+    uint64_t start;
+} matrix__op_scope;
+
+/// Returns the current time in nanoseconds, see `matrix__clock`
+MATRIX_DEF uint64_t matrix__nanoseconds(void) {
+    struct timespec ts;
+    matrix__clock(&ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+MATRIX_DEF char const* matrix_op_name(matrix_op op) {
+    assert(op < MATRIX_OP_COUNT);
+    return matrix__op_names[op];
+}
+
+#endif  // MATRIX__OBSERVE_OPS
+
+#ifdef MATRIX_INSTRUMENT
+
+static struct {
+    _Atomic uint64_t calls;
+    _Atomic uint64_t nanoseconds;
+    _Atomic uint64_t flops;
+    _Atomic uint64_t bytes;
+} matrix__op_counters[MATRIX_OP_COUNT];
+
+static matrix_hook _Atomic matrix__hook;
+static void* _Atomic matrix__hook_user;
+
+/// Invokes the user hook, if there's one
+MATRIX_DEF void matrix__call_hook(matrix__op_scope const* scope, bool end) {
+    matrix_hook hook = atomic_load_explicit(&matrix__hook, memory_order_acquire);
+    if (hook)
+        hook(atomic_load_explicit(&matrix__hook_user, memory_order_relaxed), scope->op, end,
+             scope->height, scope->width);
+}
+
+/// Adds a finished call to the op counters
+MATRIX_DEF void matrix__count_op(matrix__op_scope const* scope, uint64_t elapsed, double flops,
+                                 double bytes) {
+    atomic_fetch_add_explicit(&matrix__op_counters[scope->op].calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&matrix__op_counters[scope->op].nanoseconds, elapsed,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&matrix__op_counters[scope->op].flops, (uint64_t)flops,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&matrix__op_counters[scope->op].bytes, (uint64_t)bytes,
+                              memory_order_relaxed);
+}
+
+MATRIX_DEF void matrix_stats_snapshot(matrix_op_stats* out) {
+    assert(out);
+    for (int op = 0; op < MATRIX_OP_COUNT; ++op) {
+        out[op].name = matrix__op_names[op];
+        out[op].calls = atomic_load_explicit(&matrix__op_counters[op].calls, memory_order_relaxed);
+        out[op].nanoseconds =
+            atomic_load_explicit(&matrix__op_counters[op].nanoseconds, memory_order_relaxed);
+        out[op].flops = atomic_load_explicit(&matrix__op_counters[op].flops, memory_order_relaxed);
+        out[op].bytes = atomic_load_explicit(&matrix__op_counters[op].bytes, memory_order_relaxed);
+    }
+}
+
+MATRIX_DEF void matrix_stats_reset(void) {
+    for (int op = 0; op < MATRIX_OP_COUNT; ++op) {
+        atomic_store_explicit(&matrix__op_counters[op].calls, 0, memory_order_relaxed);
+        atomic_store_explicit(&matrix__op_counters[op].nanoseconds, 0, memory_order_relaxed);
+        atomic_store_explicit(&matrix__op_counters[op].flops, 0, memory_order_relaxed);
+        atomic_store_explicit(&matrix__op_counters[op].bytes, 0, memory_order_relaxed);
+    }
+}
+
+MATRIX_DEF void matrix_set_hook(matrix_hook hook, void* user) {
+    atomic_store_explicit(&matrix__hook_user, user, memory_order_relaxed);
+    atomic_store_explicit(&matrix__hook, hook, memory_order_release);
+}
+
+#endif  // MATRIX_INSTRUMENT
+
+#ifdef MATRIX_TRACE
+
+#ifndef MATRIX_TRACE_CAPACITY
+#define MATRIX_TRACE_CAPACITY 16384
+#endif  // MATRIX_TRACE_CAPACITY
+
+/// A single finished operation
+typedef struct {
+    matrix_op op;
+    size_t height;
+    size_t width;
+    uint64_t start;
+    uint64_t end;
+} matrix__trace_event;
+
+/// Ring buffer of events of a single thread.
+/// Only the owning thread writes events, and publishes them by bumping `written`.
+typedef struct matrix__trace_buffer {
+    struct matrix__trace_buffer* next;
+    unsigned tid;
+    _Atomic bool in_use;  // Cleared once the owning thread exits
+    _Atomic uint64_t written;
+    matrix__trace_event events[MATRIX_TRACE_CAPACITY];
+} matrix__trace_buffer;
+
+/// Lock-free list of buffers of all threads which have recorded an event.
+/// Buffers are only prepended, and only unlinked by `matrix_trace_clear`.
+static matrix__trace_buffer* _Atomic matrix__trace_buffers;
+static _Atomic unsigned matrix__trace_next_tid;
+static _Atomic bool matrix__trace_enabled = true;
+static _Thread_local matrix__trace_buffer* matrix__trace_local;
+
+#ifdef MATRIX_THREADS
+
+/// Key whose destructor gives up the buffer of an exiting thread
+static pthread_key_t matrix__trace_key;
+static pthread_once_t matrix__trace_key_once = PTHREAD_ONCE_INIT;
+static bool matrix__trace_key_ok;
+
+static void matrix__trace_thread_exit(void* buf) {
+    matrix__trace_local = NULL;
+    atomic_store_explicit(&((matrix__trace_buffer*)buf)->in_use, false, memory_order_release);
+}
+
+static void matrix__trace_key_create(void) {
+    matrix__trace_key_ok = pthread_key_create(&matrix__trace_key, matrix__trace_thread_exit) == 0;
+}
+
+/// Takes over the buffer of a thread which has exited, if there is one
+MATRIX_DEF matrix__trace_buffer* matrix__trace_buffer_reuse(void) {
+    for (matrix__trace_buffer* buf = atomic_load_explicit(&matrix__trace_buffers,
+                                                          memory_order_acquire);
+         buf; buf = buf->next) {
+        bool in_use = false;
+        if (atomic_compare_exchange_strong_explicit(&buf->in_use, &in_use, true,
+                                                    memory_order_acquire, memory_order_relaxed))
+            return buf;
+    }
+    return NULL;
+}
+
+#endif  // MATRIX_THREADS
+
+/// Returns the buffer of the current thread, taking one on first use
+MATRIX_DEF matrix__trace_buffer* matrix__trace_buffer_get(void) {
+    if (matrix__trace_local)
+        return matrix__trace_local;
+
+    matrix__trace_buffer* buf = NULL;
+#ifdef MATRIX_THREADS
+    pthread_once(&matrix__trace_key_once, matrix__trace_key_create);
+    if (matrix__trace_key_ok)
+        buf = matrix__trace_buffer_reuse();
+#endif
+
+    if (!buf) {
+        buf = malloc(sizeof(matrix__trace_buffer));
+        if (!buf)
+            return NULL;
+
+        buf->tid = atomic_fetch_add_explicit(&matrix__trace_next_tid, 1, memory_order_relaxed) + 1;
+        atomic_init(&buf->in_use, true);
+        atomic_init(&buf->written, 0);
+        buf->next = atomic_load_explicit(&matrix__trace_buffers, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&matrix__trace_buffers, &buf->next, buf,
+                                                      memory_order_release, memory_order_relaxed));
+    }
+
+#ifdef MATRIX_THREADS
+    if (matrix__trace_key_ok)
+        pthread_setspecific(matrix__trace_key, buf);
+#endif
+    matrix__trace_local = buf;
+    return buf;
+}
+
+/// Appends a finished operation to the current thread's buffer
+MATRIX_DEF void matrix__trace_op(matrix__op_scope const* scope, uint64_t end) {
+    if (!atomic_load_explicit(&matrix__trace_enabled, memory_order_relaxed))
+        return;
+
+    matrix__trace_buffer* buf = matrix__trace_buffer_get();
+    if (!buf)
+        return;
+
+    uint64_t written = atomic_load_explicit(&buf->written, memory_order_relaxed);
+    matrix__trace_event* e = &buf->events[written % MATRIX_TRACE_CAPACITY];
+    e->op = scope->op;
+    e->height = scope->height;
+    e->width = scope->width;
+    e->start = scope->start;
+    e->end = end;
+    atomic_store_explicit(&buf->written, written + 1, memory_order_release);
+}
+
+MATRIX_DEF void matrix_trace_enable(bool enabled) {
+    atomic_store_explicit(&matrix__trace_enabled, enabled, memory_order_relaxed);
+}
+
+MATRIX_DEF void matrix_trace_dump(FILE* sink) {
+    assert(sink);
+    bool first = true;
+    fputs("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [", sink);
+
+    for (matrix__trace_buffer* buf = atomic_load_explicit(&matrix__trace_buffers,
+                                                          memory_order_acquire);
+         buf; buf = buf->next) {
+        uint64_t written = atomic_load_explicit(&buf->written, memory_order_acquire);
+        uint64_t begin = written > MATRIX_TRACE_CAPACITY ? written - MATRIX_TRACE_CAPACITY : 0;
+
+        fprintf(sink,
+                "%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                "\"args\": {\"name\": \"matrix thread %u\"}}",
+                first ? "" : ",", buf->tid, buf->tid);
+        first = false;
+
+        for (uint64_t i = begin; i < written; ++i) {
+            matrix__trace_event const* e = &buf->events[i % MATRIX_TRACE_CAPACITY];
+            fprintf(sink,
+                    ",\n  {\"name\": \"%s\", \"cat\": \"matrix\", \"ph\": \"X\", "
+                    "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u, "
+                    "\"args\": {\"height\": %zu, \"width\": %zu}}",
+                    matrix__op_names[e->op], (double)e->start * 1e-3,
+                    (double)(e->end - e->start) * 1e-3, buf->tid, e->height, e->width);
+        }
+    }
+
+    fputs("\n]}\n", sink);
+}
+
+MATRIX_DEF void matrix_trace_clear(void) {
+    // Nothing records events meanwhile, so buffers of exited threads can be unlinked and freed
+    matrix__trace_buffer* kept = NULL;
+    matrix__trace_buffer** tail = &kept;
+    matrix__trace_buffer* buf = atomic_load_explicit(&matrix__trace_buffers, memory_order_acquire);
+    while (buf) {
+        matrix__trace_buffer* next = buf->next;
+        if (atomic_load_explicit(&buf->in_use, memory_order_acquire)) {
+            atomic_store_explicit(&buf->written, 0, memory_order_relaxed);
+            *tail = buf;
+            tail = &buf->next;
+        } else {
+            free(buf);
+        }
+        buf = next;
+    }
+
+    *tail = NULL;
+    atomic_store_explicit(&matrix__trace_buffers, kept, memory_order_release);
+}
+
+#endif  // MATRIX_TRACE
+
+#ifdef MATRIX__OBSERVE_OPS
+
+MATRIX_DEF matrix__op_scope matrix__op_begin(matrix_op op, size_t height, size_t width) {
+    matrix__op_scope scope = {op, matrix__op_depth++ == 0, height, width, 0};
+
+    if (scope.outermost) {
+#ifdef MATRIX_INSTRUMENT
+        matrix__call_hook(&scope, false);
+#endif
+        scope.start = matrix__nanoseconds();
+    }
+    return scope;
+}
+
+MATRIX_DEF void matrix__op_end(matrix__op_scope const* scope, double flops, double bytes) {
+    --matrix__op_depth;
+    if (!scope->outermost)
+        return;
+
+    // Without a monotonic clock, a step back must not wrap the elapsed time around
+    uint64_t end = matrix__nanoseconds();
+    if (end < scope->start)
+        end = scope->start;
+
+#ifdef MATRIX_TRACE
+    matrix__trace_op(scope, end);
+#endif
+
+#ifdef MATRIX_INSTRUMENT
+    matrix__count_op(scope, end - scope->start, flops, bytes);
+    matrix__call_hook(scope, true);
+#else
+    (void)flops;
+    (void)bytes;
+#endif
+}
+
+/// Starts instrumenting the current function as `op`, on a matrix of the provided shape.
+/// Must be matched by a MATRIX__OP_END before every return.
+#define MATRIX__OP_BEGIN(op, height, width) \
+    matrix__op_scope matrix__scope = matrix__op_begin((op), (height), (width))
+
+/// Finishes instrumenting the current function, which has
+/// performed the provided number of FLOPs and moved the provided number of bytes.
+#define MATRIX__OP_END(flops, bytes) matrix__op_end(&matrix__scope, (flops), (bytes))
+
+#else
+
+#define MATRIX__OP_BEGIN(op, height, width) ((void)0)
+#define MATRIX__OP_END(flops, bytes) ((void)0)
+
+#endif  // MATRIX__OBSERVE_OPS
+
+// Thread pool
+
+/// Function processing the range [begin, end) of some work
+typedef void (*matrix__range_fn)(void* ctx, size_t begin, size_t end);
+
+/// Returns the range of [0, n) assigned to `part` out of `parts`.
+/// Ranges are contiguous, and their boundaries are multiples of `grain`.
+MATRIX_DEF void matrix__parallel_range(size_t n, size_t grain, size_t part, size_t parts,
+                                       size_t* begin, size_t* end) {
+    size_t chunks = (n + grain - 1) / grain;
+    size_t b = chunks * part / parts * grain;
+    size_t e = chunks * (part + 1) / parts * grain;
+    *begin = b < n ? b : n;
+    *end = e < n ? e : n;
+}
+
+#ifdef MATRIX_THREADS
+
+#ifndef MATRIX_MAX_THREADS
+#define MATRIX_MAX_THREADS 256
+#endif  // MATRIX_MAX_THREADS
+
+static pthread_t matrix__pool_threads[MATRIX_MAX_THREADS];
+static size_t matrix__pool_count = 1;
+static pthread_mutex_t matrix__pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t matrix__pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t matrix__pool_done = PTHREAD_COND_INITIALIZER;
+static bool matrix__pool_stop;
+
+/// Current job, published by bumping `matrix__pool_generation` (guarded by `matrix__pool_lock`).
+/// It's split into `matrix__pool_parts` ranges, each one run by whichever thread claims it first.
+static unsigned long matrix__pool_generation;
+static unsigned long matrix__pool_start_generation;
+static matrix__range_fn matrix__pool_fn;
+static void* matrix__pool_ctx;
+static size_t matrix__pool_n;
+static size_t matrix__pool_grain;
+static size_t matrix__pool_parts;
+static size_t matrix__pool_remaining;  // parts not finished yet
+static bool matrix__pool_claimed[MATRIX_MAX_THREADS];
+
+/// Task queued for any pool thread, run after the pending parallel loop (if any)
+typedef struct matrix__task {
+    void (*run)(struct matrix__task* task);
+    struct matrix__task* next;
+} matrix__task;
+
+/// Queue of tasks (guarded by `matrix__pool_lock`)
+static matrix__task* matrix__pool_queue_head;
+static matrix__task* matrix__pool_queue_tail;
+
+/// Number of forks this process is descended from since the library was loaded,
+/// see `matrix__fork_child`
+static unsigned long matrix__pool_forks;
+
+/// Set while a thread dispatches a job; concurrent callers fall back to running serially
+static atomic_flag matrix__pool_busy = ATOMIC_FLAG_INIT;
+
+/// Set on threads while they run a range of a job, so that nested parallel loops run serially
+static _Thread_local bool matrix__pool_in_parallel;
+
+/// Index of the current thread in the pool (0 for threads outside of it),
+/// which is the part of every job it tries to claim first
+static _Thread_local size_t matrix__pool_self;
+
+/// Claims and runs parts of the current job, starting from `first`, until all are claimed.
+/// Must be called with `matrix__pool_lock` held.
+MATRIX_DEF void matrix__pool_help(size_t first) {
+    for (size_t i = 0; i < matrix__pool_parts; ++i) {
+        size_t part = (first + i) % matrix__pool_parts;
+        if (matrix__pool_claimed[part])
+            continue;
+
+        matrix__pool_claimed[part] = true;
+        matrix__range_fn fn = matrix__pool_fn;
+        void* ctx = matrix__pool_ctx;
+        size_t begin, end;
+        matrix__parallel_range(matrix__pool_n, matrix__pool_grain, part, matrix__pool_parts,
+                               &begin, &end);
+        pthread_mutex_unlock(&matrix__pool_lock);
+
+        bool was_in_parallel = matrix__pool_in_parallel;
+        matrix__pool_in_parallel = true;
+        if (begin < end)
+            fn(ctx, begin, end);
+        matrix__pool_in_parallel = was_in_parallel;
+
+        pthread_mutex_lock(&matrix__pool_lock);
+        if (--matrix__pool_remaining == 0)
+            pthread_cond_broadcast(&matrix__pool_done);
+    }
+}
+
+static void* matrix__pool_worker(void* arg) {
+    matrix__pool_self = (size_t)(uintptr_t)arg;
+
+    pthread_mutex_lock(&matrix__pool_lock);
+    unsigned long seen = matrix__pool_start_generation;
+    for (;;) {
+        while (!matrix__pool_stop && matrix__pool_generation == seen && !matrix__pool_queue_head)
+            pthread_cond_wait(&matrix__pool_wake, &matrix__pool_lock);
+
+        // A job published while this thread ran a task may be already done,
+        // in which case there's nothing left to claim
+        if (matrix__pool_generation != seen) {
+            seen = matrix__pool_generation;
+            matrix__pool_help(matrix__pool_self);
+            continue;
+        }
+
+        // Queued tasks are still run on stop, so that nobody waits for them forever.
+        // Parallel loops inside of them are dispatched like from any other thread.
+        matrix__task* task = matrix__pool_queue_head;
+        if (!task)
+            break;
+
+        matrix__pool_queue_head = task->next;
+        if (!matrix__pool_queue_head)
+            matrix__pool_queue_tail = NULL;
+        pthread_mutex_unlock(&matrix__pool_lock);
+        task->run(task);
+        pthread_mutex_lock(&matrix__pool_lock);
+    }
+    pthread_mutex_unlock(&matrix__pool_lock);
+    return NULL;
+}
+
+/// Fork handlers, see "Forking"
+static void matrix__fork_prepare(void);
+static void matrix__fork_parent(void);
+static void matrix__fork_child(void);
+
+static void matrix__fork_register(void) {
+    pthread_atfork(matrix__fork_prepare, matrix__fork_parent, matrix__fork_child);
+}
+
+MATRIX_DEF bool matrix_threads_init(size_t count) {
+    static pthread_once_t registered = PTHREAD_ONCE_INIT;
+    pthread_once(&registered, matrix__fork_register);
+
+    if (count == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        count = online > 0 ? (size_t)online : 1;
+    }
+    if (count > MATRIX_MAX_THREADS)
+        count = MATRIX_MAX_THREADS;
+    if (matrix__pool_count > 1)
+        return false;
+
+    // A job may be published before a new worker first takes the lock,
+    // so workers start from the generation current at this point rather than the one they see.
+    pthread_mutex_lock(&matrix__pool_lock);
+    matrix__pool_stop = false;
+    matrix__pool_start_generation = matrix__pool_generation;
+    size_t started = 1;
+    for (; started < count; ++started) {
+        if (pthread_create(&matrix__pool_threads[started], NULL, matrix__pool_worker,
+                           (void*)(uintptr_t)started))
+            break;
+    }
+    matrix__pool_count = started;
+    pthread_mutex_unlock(&matrix__pool_lock);
+
+    if (started < count) {
+        matrix_threads_shutdown();
+        return false;
+    }
+    return true;
+}
+
+MATRIX_DEF void matrix_threads_shutdown(void) {
+    pthread_mutex_lock(&matrix__pool_lock);
+    matrix__pool_stop = true;
+    pthread_cond_broadcast(&matrix__pool_wake);
+    pthread_mutex_unlock(&matrix__pool_lock);
+
+    for (size_t i = 1; i < matrix__pool_count; ++i)
+        pthread_join(matrix__pool_threads[i], NULL);
+    matrix__pool_count = 1;
+}
+
+MATRIX_DEF size_t matrix_threads_count(void) {
+    return matrix__pool_count;
+}
+
+/// Queues a task for the pool threads.
+/// Returns false (without queueing it) if the pool isn't running.
+MATRIX_DEF bool matrix__pool_submit(matrix__task* task) {
+    pthread_mutex_lock(&matrix__pool_lock);
+    bool running = matrix__pool_count > 1 && !matrix__pool_stop;
+    if (running) {
+        task->next = NULL;
+        if (matrix__pool_queue_tail)
+            matrix__pool_queue_tail->next = task;
+        else
+            matrix__pool_queue_head = task;
+        matrix__pool_queue_tail = task;
+        pthread_cond_signal(&matrix__pool_wake);
+    }
+    pthread_mutex_unlock(&matrix__pool_lock);
+    return running;
+}
+
+/// Removes a task from the queue if no pool thread started it yet.
+/// Must be called with `matrix__pool_lock` held. Returns false if the task wasn't queued.
+MATRIX_DEF bool matrix__pool_unqueue(matrix__task* task) {
+    matrix__task* prev = NULL;
+    for (matrix__task* t = matrix__pool_queue_head; t; prev = t, t = t->next) {
+        if (t != task)
+            continue;
+
+        if (prev)
+            prev->next = t->next;
+        else
+            matrix__pool_queue_head = t->next;
+        if (matrix__pool_queue_tail == t)
+            matrix__pool_queue_tail = prev;
+        return true;
+    }
+    return false;
+}
+
+#endif  // MATRIX_THREADS
+
+#if defined(MATRIX_THREADS) && !defined(MATRIX_NO_MALLOC)
+
+// Asynchronous operations
+
+typedef enum {
+    MATRIX__ASYNC_MATMUL,
+    MATRIX__ASYNC_TRANSPOSE,
+    MATRIX__ASYNC_COPY_INTO,
+    MATRIX__ASYNC_FILL_SCALAR,
+} matrix__async_op;
+
+struct matrix_future {
+    matrix__task task;
+    matrix__async_op op;
+    matrix const* src;
+    matrix const* b;
+    matrix* dest;
+    double x;
+    unsigned long forks;  // `matrix__pool_forks` when the operation was started
+    bool done;            // guarded by `matrix__pool_lock`
+};
+
+/// Signalled whenever some future is done
+static pthread_cond_t matrix__future_done = PTHREAD_COND_INITIALIZER;
+
+/// Performs the operation of a future, on whichever thread runs it
+MATRIX_DEF void matrix__future_perform(matrix_future* f) {
+    switch (f->op) {
+        case MATRIX__ASYNC_MATMUL:
+            matrix_matmul_into(f->src, f->b, f->dest);
+            break;
+        case MATRIX__ASYNC_TRANSPOSE:
+            matrix_transpose(f->dest);
+            break;
+        case MATRIX__ASYNC_COPY_INTO:
+            matrix_copy_into(f->src, f->dest);
+            break;
+        case MATRIX__ASYNC_FILL_SCALAR:
+            matrix_fill_scalar(f->dest, f->x);
+            break;
+    }
+}
+
+static void matrix__future_run(matrix__task* task) {
+    matrix_future* f = (matrix_future*)task;
+    matrix__future_perform(f);
+
+    pthread_mutex_lock(&matrix__pool_lock);
+    f->done = true;
+    pthread_cond_broadcast(&matrix__future_done);
+    pthread_mutex_unlock(&matrix__pool_lock);
+}
+
+/// Queues an operation on the pool, or performs it right away if the pool isn't running
+/// (or the future couldn't be allocated, in which case NULL is returned)
+MATRIX_DEF matrix_future* matrix__async(matrix__async_op op, matrix const* src, matrix const* b,
+                                        matrix* dest, double x) {
+    matrix_future* f = malloc(sizeof(matrix_future));
+    matrix_future local = {
+        {matrix__future_run, NULL}, op, src, b, dest, x, matrix__pool_forks, false};
+    if (!f) {
+        matrix__future_perform(&local);
+        return NULL;
+    }
+
+    *f = local;
+    if (!matrix__pool_submit(&f->task)) {
+        matrix__future_perform(f);
+        f->done = true;
+    }
+    return f;
+}
+
+MATRIX_DEF matrix_future* matrix_matmul_async(matrix const* a, matrix const* b, matrix* dest) {
+    return matrix__async(MATRIX__ASYNC_MATMUL, a, b, dest, 0.0);
+}
+
+MATRIX_DEF matrix_future* matrix_transpose_async(matrix* m) {
+    return matrix__async(MATRIX__ASYNC_TRANSPOSE, NULL, NULL, m, 0.0);
+}
+
+MATRIX_DEF matrix_future* matrix_copy_into_async(matrix const* src, matrix* dest) {
+    return matrix__async(MATRIX__ASYNC_COPY_INTO, src, NULL, dest, 0.0);
+}
+
+MATRIX_DEF matrix_future* matrix_fill_scalar_async(matrix* m, double x) {
+    return matrix__async(MATRIX__ASYNC_FILL_SCALAR, NULL, NULL, m, x);
+}
+
+MATRIX_DEF bool matrix_poll(matrix_future const* f) {
+    if (!f)
+        return true;
+
+    pthread_mutex_lock(&matrix__pool_lock);
+    bool done = f->done;
+    pthread_mutex_unlock(&matrix__pool_lock);
+    return done;
+}
+
+MATRIX_DEF void matrix_wait(matrix_future* f) {
+    if (!f)
+        return;
+
+    // An operation which no pool thread started yet is performed by the waiting thread,
+    // which also keeps tasks waiting for other tasks from deadlocking the pool.
+    // Operations started before a fork have no pool thread to finish them in the child.
+    pthread_mutex_lock(&matrix__pool_lock);
+    bool unqueued = matrix__pool_unqueue(&f->task);
+    bool orphaned = !unqueued && !f->done && f->forks != matrix__pool_forks;
+    while (!unqueued && !orphaned && !f->done)
+        pthread_cond_wait(&matrix__future_done, &matrix__pool_lock);
+    pthread_mutex_unlock(&matrix__pool_lock);
+
+    if (unqueued || orphaned)
+        matrix__future_perform(f);
+    free(f);
+}
+
+
+// Task graphs
+
+#define MATRIX__GRAPH_NONE SIZE_MAX
+
+typedef struct {
+    matrix_task_fn fn;
+    void* ctx;
+    atomic_size_t pending;  // number of unfinished predecessors
+    size_t* successors;
+    size_t successors_len;
+    size_t successors_cap;
+} matrix__graph_task;
+
+/// Accesses of a single piece of data: the last task writing it,
+/// and tasks reading it since then
+typedef struct {
+    void const* data;
+    size_t last_writer;
+    size_t* readers;
+    size_t readers_len;
+    size_t readers_cap;
+} matrix__graph_data;
+
+struct matrix_graph {
+    matrix__graph_task* tasks;
+    size_t len;
+    size_t cap;
+
+    // Open-addressing hash table, with a power of two capacity
+    matrix__graph_data* data;
+    size_t data_len;
+    size_t data_cap;
+};
+
+/// Makes sure `*items` has room for at least `need` elements of `size` bytes
+MATRIX_DEF bool matrix__reserve(void** items, size_t* cap, size_t size, size_t need) {
+    if (need <= *cap)
+        return true;
+
+    size_t new_cap = *cap ? *cap * 2 : 8;
+    while (new_cap < need)
+        new_cap *= 2;
+    void* grown = realloc(*items, new_cap * size);
+    if (!grown)
+        return false;
+
+    *items = grown;
+    *cap = new_cap;
+    return true;
+}
+
+MATRIX_DEF matrix_graph* matrix_graph_new(void) {
+    return calloc(1, sizeof(matrix_graph));
+}
+
+/// Empties a graph, keeping its memory
+MATRIX_DEF void matrix__graph_clear(matrix_graph* g) {
+    for (size_t i = 0; i < g->data_cap; ++i) {
+        g->data[i].data = NULL;
+        g->data[i].readers_len = 0;
+    }
+    g->data_len = 0;
+    for (size_t i = 0; i < g->len; ++i)
+        g->tasks[i].successors_len = 0;
+    g->len = 0;
+}
+
+MATRIX_DEF void matrix_graph_del(matrix_graph* g) {
+    assert(g);
+    for (size_t i = 0; i < g->data_cap; ++i)
+        free(g->data[i].readers);
+    for (size_t i = 0; i < g->cap; ++i)
+        free(g->tasks[i].successors);
+    free(g->data);
+    free(g->tasks);
+    free(g);
+}
+
+/// Makes sure the table of accesses has room for `extra` more pieces of data.
+/// Returns false if it couldn't be grown.
+MATRIX_DEF bool matrix__graph_reserve_data(matrix_graph* g, size_t extra) {
+    if (2 * (g->data_len + extra) <= g->data_cap)
+        return true;
+
+    size_t cap = g->data_cap ? 2 * g->data_cap : 64;
+    while (2 * (g->data_len + extra) > cap)
+        cap *= 2;
+    matrix__graph_data* table = calloc(cap, sizeof(matrix__graph_data));
+    if (!table)
+        return false;
+
+    for (size_t i = 0; i < g->data_cap; ++i) {
+        matrix__graph_data* old = &g->data[i];
+        if (!old->data) {
+            free(old->readers);
+            continue;
+        }
+
+        size_t slot = ((uintptr_t)old->data >> 4) & (cap - 1);
+        while (table[slot].data)
+            slot = (slot + 1) & (cap - 1);
+        table[slot] = *old;
+    }
+    free(g->data);
+    g->data = table;
+    g->data_cap = cap;
+    return true;
+}
+
+/// Returns the accesses of a piece of data, adding them if needed.
+/// The table must have room for them, see `matrix__graph_reserve_data`.
+MATRIX_DEF matrix__graph_data* matrix__graph_find(matrix_graph* g, void const* data) {
+    assert(2 * (g->data_len + 1) <= g->data_cap);
+
+    // Empty slots may still hold the memory of a cleared graph's readers
+    size_t slot = ((uintptr_t)data >> 4) & (g->data_cap - 1);
+    while (g->data[slot].data && g->data[slot].data != data)
+        slot = (slot + 1) & (g->data_cap - 1);
+
+    matrix__graph_data* d = &g->data[slot];
+    if (!d->data) {
+        d->data = data;
+        d->last_writer = MATRIX__GRAPH_NONE;
+        d->readers_len = 0;
+        ++g->data_len;
+    }
+    return d;
+}
+
+/// Makes task `to` run after task `from`
+MATRIX_DEF bool matrix__graph_edge(matrix_graph* g, size_t from, size_t to) {
+    if (from == MATRIX__GRAPH_NONE || from == to)
+        return true;
+
+    matrix__graph_task* t = &g->tasks[from];
+    if (t->successors_len && t->successors[t->successors_len - 1] == to)
+        return true;
+    if (!matrix__reserve((void**)&t->successors, &t->successors_cap, sizeof(size_t),
+                         t->successors_len + 1))
+        return false;
+
+    t->successors[t->successors_len++] = to;
+    ++g->tasks[to].pending;
+    return true;
+}
+
+MATRIX_DEF bool matrix_graph_add(matrix_graph* g, matrix_task_fn fn, void* ctx,
+                                 void const* const* reads, size_t reads_len,
+                                 void const* const* writes, size_t writes_len) {
+    assert(g && fn);
+    assert(reads || !reads_len);
+    assert(writes || !writes_len);
+
+    size_t old_cap = g->cap;
+    if (!matrix__reserve((void**)&g->tasks, &g->cap, sizeof(matrix__graph_task), g->len + 1))
+        return false;
+    for (size_t i = old_cap; i < g->cap; ++i)
+        g->tasks[i] = (matrix__graph_task){NULL, NULL, 0, NULL, 0, 0};
+
+    // Every table slot, edge and reader list is reserved up front, so that nothing changes
+    // on failure (data added to the table without any accesses is the same as absent data)
+    size_t id = g->len;
+    if (!matrix__graph_reserve_data(g, reads_len + writes_len))
+        return false;
+    for (size_t i = 0; i < reads_len + writes_len; ++i) {
+        void const* data = i < reads_len ? reads[i] : writes[i - reads_len];
+        matrix__graph_data* d = matrix__graph_find(g, data);
+        bool ok = matrix__reserve((void**)&d->readers, &d->readers_cap, sizeof(size_t),
+                                  d->readers_len + 1);
+        for (size_t j = 0; ok && j < d->readers_len + 1; ++j) {
+            size_t from = j < d->readers_len ? d->readers[j] : d->last_writer;
+            if (from == MATRIX__GRAPH_NONE)
+                continue;
+            matrix__graph_task* t = &g->tasks[from];
+            ok = matrix__reserve((void**)&t->successors, &t->successors_cap, sizeof(size_t),
+                                 t->successors_len + 1);
+        }
+        if (!ok)
+            return false;
+    }
+
+    matrix__graph_task* task = &g->tasks[id];
+    task->fn = fn;
+    task->ctx = ctx;
+    atomic_init(&task->pending, 0);
+    g->len = id + 1;
+
+    // Reading depends on the last write; writing on the last write and all reads since then
+    for (size_t i = 0; i < reads_len; ++i) {
+        matrix__graph_data* d = matrix__graph_find(g, reads[i]);
+        matrix__graph_edge(g, d->last_writer, id);
+        if (!d->readers_len || d->readers[d->readers_len - 1] != id)
+            d->readers[d->readers_len++] = id;
+    }
+    for (size_t i = 0; i < writes_len; ++i) {
+        matrix__graph_data* d = matrix__graph_find(g, writes[i]);
+        matrix__graph_edge(g, d->last_writer, id);
+        for (size_t j = 0; j < d->readers_len; ++j)
+            matrix__graph_edge(g, d->readers[j], id);
+        d->last_writer = id;
+        d->readers_len = 0;
+    }
+    return true;
+}
+
+/// Deque of ready tasks of a single thread. The owner pushes and pops at the bottom,
+/// other threads steal from the top. Every task is pushed once in total,
+/// so `items` never needs more room than the number of tasks.
+typedef struct {
+    pthread_mutex_t lock;
+    size_t top;
+    size_t bottom;
+    size_t* items;
+} matrix__graph_deque;
+
+/// State shared by all threads running a graph.
+/// Participants without any ready task to run or steal park on `wake`
+/// until `version` changes, which happens on every push and once the graph is done.
+typedef struct {
+    matrix_graph* g;
+    matrix__graph_deque* deques;
+    size_t participants;
+    atomic_size_t remaining;
+    atomic_size_t helpers_left;  // changed under `lock` once the helpers run
+    atomic_size_t version;
+    atomic_size_t parked;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} matrix__graph_run;
+
+/// Pool task making a pool thread participate in running a graph
+typedef struct {
+    matrix__task task;
+    matrix__graph_run* run;
+    size_t participant;
+} matrix__graph_helper;
+
+MATRIX_DEF void matrix__graph_push(matrix__graph_deque* d, size_t id) {
+    pthread_mutex_lock(&d->lock);
+    d->items[d->bottom++] = id;
+    pthread_mutex_unlock(&d->lock);
+}
+
+MATRIX_DEF size_t matrix__graph_pop(matrix__graph_deque* d, bool steal) {
+    size_t id = MATRIX__GRAPH_NONE;
+    pthread_mutex_lock(&d->lock);
+    if (d->top < d->bottom)
+        id = steal ? d->items[d->top++] : d->items[--d->bottom];
+    pthread_mutex_unlock(&d->lock);
+    return id;
+}
+
+/// Wakes up parked participants after `version` was bumped
+MATRIX_DEF void matrix__graph_wake(matrix__graph_run* run) {
+    atomic_fetch_add(&run->version, 1);
+    if (atomic_load(&run->parked)) {
+        pthread_mutex_lock(&run->lock);
+        pthread_cond_broadcast(&run->wake);
+        pthread_mutex_unlock(&run->lock);
+    }
+}
+
+/// Runs ready tasks (its own, or stolen from others) until the whole graph is done
+MATRIX_DEF void matrix__graph_participate(matrix__graph_run* run, size_t participant) {
+    matrix__graph_deque* own = &run->deques[participant];
+    while (atomic_load(&run->remaining)) {
+        size_t seen = atomic_load(&run->version);
+        size_t id = matrix__graph_pop(own, false);
+        for (size_t i = 1; id == MATRIX__GRAPH_NONE && i < run->participants; ++i)
+            id = matrix__graph_pop(&run->deques[(participant + i) % run->participants], true);
+
+        // Nothing was ready when `seen` was read, so park until something is pushed
+        if (id == MATRIX__GRAPH_NONE) {
+            pthread_mutex_lock(&run->lock);
+            atomic_fetch_add(&run->parked, 1);
+            while (atomic_load(&run->version) == seen)
+                pthread_cond_wait(&run->wake, &run->lock);
+            atomic_fetch_sub(&run->parked, 1);
+            pthread_mutex_unlock(&run->lock);
+            continue;
+        }
+
+        matrix__graph_task* task = &run->g->tasks[id];
+        task->fn(task->ctx);
+        bool pushed = false;
+        for (size_t i = 0; i < task->successors_len; ++i) {
+            size_t next = task->successors[i];
+            if (atomic_fetch_sub(&run->g->tasks[next].pending, 1) == 1) {
+                matrix__graph_push(own, next);
+                pushed = true;
+            }
+        }
+        if (atomic_fetch_sub(&run->remaining, 1) == 1 || pushed)
+            matrix__graph_wake(run);
+    }
+}
+
+static void matrix__graph_help(matrix__task* task) {
+    matrix__graph_helper* helper = (matrix__graph_helper*)task;
+    matrix__graph_run* run = helper->run;
+    matrix__pool_in_parallel = true;
+    matrix__graph_participate(run, helper->participant);
+    matrix__pool_in_parallel = false;
+
+    // run lives on the stack of `matrix_graph_run`, which may return right after this
+    pthread_mutex_lock(&run->lock);
+    atomic_fetch_sub(&run->helpers_left, 1);
+    pthread_cond_broadcast(&run->wake);
+    pthread_mutex_unlock(&run->lock);
+}
+
+MATRIX_DEF bool matrix_graph_run(matrix_graph* g) {
+    assert(g);
+    size_t participants = matrix_threads_count();
+    size_t n = g->len;
+    matrix__graph_run run;
+    run.g = g;
+    run.participants = participants;
+    matrix__graph_helper* helpers = malloc(sizeof(matrix__graph_helper) * participants);
+    run.deques = malloc(sizeof(matrix__graph_deque) * participants);
+    size_t* items = malloc(sizeof(size_t) * (n ? n : 1) * participants);
+    if (!helpers || !run.deques || !items) {
+        free(helpers);
+        free(run.deques);
+        free(items);
+        return false;
+    }
+
+    for (size_t i = 0; i < participants; ++i) {
+        pthread_mutex_init(&run.deques[i].lock, NULL);
+        run.deques[i].top = run.deques[i].bottom = 0;
+        run.deques[i].items = items + i * n;
+    }
+
+    // Initially ready tasks are dealt out to all participants
+    size_t ready = 0;
+    for (size_t id = 0; id < n; ++id)
+        if (atomic_load(&g->tasks[id].pending) == 0)
+            matrix__graph_push(&run.deques[ready++ % participants], id);
+    atomic_init(&run.remaining, n);
+    atomic_init(&run.helpers_left, participants - 1);
+    atomic_init(&run.version, 0);
+    atomic_init(&run.parked, 0);
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.wake, NULL);
+
+    for (size_t i = 1; i < participants; ++i) {
+        helpers[i] = (matrix__graph_helper){{matrix__graph_help, NULL}, &run, i};
+        if (!matrix__pool_submit(&helpers[i].task))
+            atomic_fetch_sub(&run.helpers_left, 1);
+    }
+
+    // Tasks run serially inside, as every pool thread is busy running the graph
+    bool was_in_parallel = matrix__pool_in_parallel;
+    matrix__pool_in_parallel = true;
+    matrix__graph_participate(&run, 0);
+    matrix__pool_in_parallel = was_in_parallel;
+
+    // Helpers which didn't start yet are no longer needed; the others are about to finish
+    pthread_mutex_lock(&matrix__pool_lock);
+    for (size_t i = 1; i < participants; ++i)
+        if (matrix__pool_unqueue(&helpers[i].task))
+            atomic_fetch_sub(&run.helpers_left, 1);
+    pthread_mutex_unlock(&matrix__pool_lock);
+
+    pthread_mutex_lock(&run.lock);
+    while (atomic_load(&run.helpers_left))
+        pthread_cond_wait(&run.wake, &run.lock);
+    pthread_mutex_unlock(&run.lock);
+
+    pthread_cond_destroy(&run.wake);
+    pthread_mutex_destroy(&run.lock);
+    for (size_t i = 0; i < participants; ++i)
+        pthread_mutex_destroy(&run.deques[i].lock);
+    free(helpers);
+    free(run.deques);
+    free(items);
+    matrix__graph_clear(g);
+    return true;
+}
+
+#endif  // MATRIX_THREADS && !MATRIX_NO_MALLOC
+
+/// Calls `fn` on contiguous ranges of [0, n) (with boundaries at multiples of `grain`),
+/// in parallel on the library thread pool if it's running. Returns once all ranges are done.
+MATRIX_DEF void matrix__parallel_for(size_t n, size_t grain, matrix__range_fn fn, void* ctx) {
+#ifdef MATRIX_THREADS
+    size_t count = matrix__pool_count;
+    if (count > 1 && n > grain && !matrix__pool_in_parallel &&
+        !atomic_flag_test_and_set_explicit(&matrix__pool_busy, memory_order_acquire)) {
+        pthread_mutex_lock(&matrix__pool_lock);
+        matrix__pool_fn = fn;
+        matrix__pool_ctx = ctx;
+        matrix__pool_n = n;
+        matrix__pool_grain = grain;
+        matrix__pool_parts = count;
+        matrix__pool_remaining = count;
+        memset(matrix__pool_claimed, 0, sizeof(bool) * count);
+        ++matrix__pool_generation;
+        pthread_cond_broadcast(&matrix__pool_wake);
+
+        // Parts of threads busy with queued tasks are done by the others, this one included
+        matrix__pool_help(matrix__pool_self);
+        while (matrix__pool_remaining)
+            pthread_cond_wait(&matrix__pool_done, &matrix__pool_lock);
+        pthread_mutex_unlock(&matrix__pool_lock);
+
+        atomic_flag_clear_explicit(&matrix__pool_busy, memory_order_release);
+        return;
+    }
+#endif
+    (void)grain;
+    if (n)
+        fn(ctx, 0, n);
+}
+
+/// Returns the number of threads `matrix__parallel_for` splits work across
+MATRIX_DEF size_t matrix__parallel_width(void) {
+#ifdef MATRIX_THREADS
+    return matrix__pool_count;
+#else
+    return 1;
+#endif
+}
+
+// Deterministic mode
+
+#ifdef MATRIX_DETERMINISTIC
+static bool matrix__deterministic = true;
+#else
+static bool matrix__deterministic = false;
+#endif  // MATRIX_DETERMINISTIC
+
+MATRIX_DEF void matrix_deterministic_set(bool enabled) {
+    matrix__deterministic = enabled;
+}
+
+MATRIX_DEF bool matrix_deterministic_get(void) {
+    return matrix__deterministic;
+}
+
+// Allocation
+
+#ifndef MATRIX_NO_MALLOC
+
+#ifdef MATRIX_HUGEPAGES
+
+#ifndef MATRIX_HUGEPAGE_THRESHOLD
+#define MATRIX_HUGEPAGE_THRESHOLD (32u << 20)
+#endif  // MATRIX_HUGEPAGE_THRESHOLD
+
+#define MATRIX__HUGEPAGE_SIZE ((size_t)2 << 20)
+
+/// Returns `bytes` rounded up to a whole number of huge pages
+MATRIX_DEF size_t matrix__hugepage_len(size_t bytes) {
+    return (bytes + MATRIX__HUGEPAGE_SIZE - 1) / MATRIX__HUGEPAGE_SIZE * MATRIX__HUGEPAGE_SIZE;
+}
+
+#ifdef MATRIX_THREADS
+static void matrix__first_touch_range(void* ctx, size_t begin, size_t end) {
+    memset((char*)ctx + begin, 0, end - begin);
+}
+#endif
+
+#endif  // MATRIX_HUGEPAGES
+
+/// Allocates `bytes` bytes, optionally zeroed.
+///
+/// With `MATRIX_HUGEPAGES`, buffers of at least `MATRIX_HUGEPAGE_THRESHOLD` bytes are mapped
+/// directly, aligned to and advised to be backed by huge pages. Their pages are then touched
+/// by the thread pool with the same partitioning parallel operations use,
+/// so that on NUMA machines every thread's range lands on its own node.
+MATRIX_DEF void* matrix__raw_alloc(size_t bytes, bool zeroed) {
+#ifdef MATRIX_HUGEPAGES
+    if (bytes >= MATRIX_HUGEPAGE_THRESHOLD) {
+        size_t len = matrix__hugepage_len(bytes);
+        size_t mapped_len = len + MATRIX__HUGEPAGE_SIZE;
+        char* mapped = mmap(NULL, mapped_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                            -1, 0);
+        if (mapped == MAP_FAILED)
+            return NULL;
+
+        // Trim the mapping down to `len` bytes starting at a huge page boundary
+        size_t head = (MATRIX__HUGEPAGE_SIZE - (uintptr_t)mapped % MATRIX__HUGEPAGE_SIZE) %
+                      MATRIX__HUGEPAGE_SIZE;
+        char* p = mapped + head;
+        if (head)
+            munmap(mapped, head);
+        if (mapped_len - head > len)
+            munmap(p + len, mapped_len - head - len);
+
+#ifdef MADV_HUGEPAGE
+        madvise(p, len, MADV_HUGEPAGE);
+#endif
+#ifdef MATRIX_THREADS
+        matrix__parallel_for(bytes, 64, matrix__first_touch_range, p);
+#endif
+        return p;
+    }
+#endif  // MATRIX_HUGEPAGES
+    return zeroed ? calloc(bytes, 1) : malloc(bytes);
+}
+
+/// Frees a buffer of `bytes` bytes returned by `matrix__raw_alloc`
+MATRIX_DEF void matrix__raw_free(void* ptr, size_t bytes) {
+#ifdef MATRIX_HUGEPAGES
+    if (bytes >= MATRIX_HUGEPAGE_THRESHOLD) {
+        munmap(ptr, matrix__hugepage_len(bytes));
+        return;
+    }
+#endif
+    (void)bytes;
+    free(ptr);
+}
+
+#ifdef MATRIX_TRACK_ALLOCS
+
+/// Header placed in front of every tracked buffer.
+/// Padded to a cache line, so that the buffer itself stays well-aligned.
+typedef union matrix__alloc_header {
+    struct {
+        union matrix__alloc_header* prev;
+        union matrix__alloc_header* next;
+        char const* kind;
+        size_t bytes;
+        size_t height;
+        size_t width;
+    } info;
+    unsigned char padding[64];
+} matrix__alloc_header;
+
+static matrix__alloc_header matrix__alloc_list =
+    {{&matrix__alloc_list, &matrix__alloc_list, "", 0, 0, 0}};
+static atomic_flag matrix__alloc_lock = ATOMIC_FLAG_INIT;
+static _Atomic size_t matrix__alloc_live_bytes;
+static _Atomic size_t matrix__alloc_live_count;
+static _Atomic size_t matrix__alloc_peak_bytes;
+static _Atomic size_t matrix__alloc_total_count;
+
+MATRIX_DEF void matrix__alloc_list_lock(void) {
+    while (atomic_flag_test_and_set_explicit(&matrix__alloc_lock, memory_order_acquire));
+}
+
+MATRIX_DEF void matrix__alloc_list_unlock(void) {
+    atomic_flag_clear_explicit(&matrix__alloc_lock, memory_order_release);
+}
+
+#endif  // MATRIX_TRACK_ALLOCS
+
+/// Allocates a buffer for a `kind` matrix of the provided shape (used for reporting only),
+/// optionally zeroing it. Returns NULL on failure.
+MATRIX_DEF void* matrix__alloc(size_t bytes, bool zeroed, char const* kind, size_t height,
+                               size_t width) {
+#ifdef MATRIX_TRACK_ALLOCS
+    matrix__alloc_header* h = matrix__raw_alloc(sizeof(matrix__alloc_header) + bytes, zeroed);
+    if (!h)
+        return NULL;
+
+    h->info.kind = kind;
+    h->info.bytes = bytes;
+    h->info.height = height;
+    h->info.width = width;
+
+    matrix__alloc_list_lock();
+    h->info.prev = matrix__alloc_list.info.prev;
+    h->info.next = &matrix__alloc_list;
+    h->info.prev->info.next = h;
+    matrix__alloc_list.info.prev = h;
+    matrix__alloc_list_unlock();
+
+    size_t live = atomic_fetch_add_explicit(&matrix__alloc_live_bytes, bytes,
+                                            memory_order_relaxed) + bytes;
+    size_t peak = atomic_load_explicit(&matrix__alloc_peak_bytes, memory_order_relaxed);
+    while (live > peak && !atomic_compare_exchange_weak_explicit(
+                              &matrix__alloc_peak_bytes, &peak, live, memory_order_relaxed,
+                              memory_order_relaxed));
+    atomic_fetch_add_explicit(&matrix__alloc_live_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&matrix__alloc_total_count, 1, memory_order_relaxed);
+
+    return h + 1;
+#else
+    (void)kind;
+    (void)height;
+    (void)width;
+    return matrix__raw_alloc(bytes, zeroed);
+#endif
+}
+
+/// Frees a buffer of `bytes` bytes returned by `matrix__alloc`
+MATRIX_DEF void matrix__free(void* ptr, size_t bytes) {
+#ifdef MATRIX_TRACK_ALLOCS
+    matrix__alloc_header* h = (matrix__alloc_header*)ptr - 1;
+    assert(h->info.bytes == bytes);
+
+    matrix__alloc_list_lock();
+    h->info.prev->info.next = h->info.next;
+    h->info.next->info.prev = h->info.prev;
+    matrix__alloc_list_unlock();
+
+    atomic_fetch_sub_explicit(&matrix__alloc_live_bytes, h->info.bytes, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&matrix__alloc_live_count, 1, memory_order_relaxed);
+    matrix__raw_free(h, sizeof(matrix__alloc_header) + bytes);
+#else
+    matrix__raw_free(ptr, bytes);
+#endif
+}
+
+#ifdef MATRIX_TRACK_ALLOCS
+
+MATRIX_DEF matrix_alloc_stats matrix_alloc_stats_get(void) {
+    matrix_alloc_stats stats;
+    stats.live_bytes = atomic_load_explicit(&matrix__alloc_live_bytes, memory_order_relaxed);
+    stats.live_allocations = atomic_load_explicit(&matrix__alloc_live_count, memory_order_relaxed);
+    stats.peak_bytes = atomic_load_explicit(&matrix__alloc_peak_bytes, memory_order_relaxed);
+    stats.total_allocations =
+        atomic_load_explicit(&matrix__alloc_total_count, memory_order_relaxed);
+    return stats;
+}
+
+MATRIX_DEF void matrix_alloc_reset_peak(void) {
+    atomic_store_explicit(&matrix__alloc_peak_bytes,
+                          atomic_load_explicit(&matrix__alloc_live_bytes, memory_order_relaxed),
+                          memory_order_relaxed);
+}
+
+MATRIX_DEF size_t matrix_alloc_report_leaks(FILE* sink) {
+    assert(sink);
+    size_t count = 0;
+
+    matrix__alloc_list_lock();
+    for (matrix__alloc_header* h = matrix__alloc_list.info.next; h != &matrix__alloc_list;
+         h = h->info.next, ++count) {
+        fprintf(sink, "matrix.h: leaked %s %zu x %zu (%zu bytes) at %p\n", h->info.kind,
+                h->info.height, h->info.width, h->info.bytes, (void*)(h + 1));
+    }
+    matrix__alloc_list_unlock();
+
+    return count;
+}
+
+MATRIX_DEF void matrix__alloc_report_leaks_stderr(void) {
+    matrix_alloc_report_leaks(stderr);
+}
+
+MATRIX_DEF void matrix_alloc_report_leaks_at_exit(void) {
+    // Register the report once, no matter how many times this is called
+    static atomic_flag registered = ATOMIC_FLAG_INIT;
+    if (!atomic_flag_test_and_set(&registered))
+        atexit(matrix__alloc_report_leaks_stderr);
+}
+
+#endif  // MATRIX_TRACK_ALLOCS
+
+// Copy-on-write buffers
+
+#ifdef MATRIX_COW
+
+/// Buffer of `len` cells shared by `refs` (at least 2) matrices
+typedef struct {
+    double* values;
+    size_t len;
+    size_t refs;
+} matrix__cow_entry;
+
+/// Open-addressing table of shared buffers (guarded by `matrix__cow_lock`)
+static matrix__cow_entry* matrix__cow_table;
+static size_t matrix__cow_cap;
+static size_t matrix__cow_len;
+static atomic_flag matrix__cow_lock = ATOMIC_FLAG_INIT;
+
+/// Number of shared buffers, so that operations on unshared matrices
+/// don't need to take the lock while nothing is shared
+static atomic_size_t matrix__cow_shared;
+
+MATRIX_DEF void matrix__cow_acquire(void) {
+    while (atomic_flag_test_and_set_explicit(&matrix__cow_lock, memory_order_acquire)) {
+    }
+}
+
+MATRIX_DEF void matrix__cow_release(void) {
+    atomic_flag_clear_explicit(&matrix__cow_lock, memory_order_release);
+}
+
+/// Returns the preferred slot of a buffer in the table
+MATRIX_DEF size_t matrix__cow_home(double const* values) {
+    uint64_t hash = (uint64_t)(uintptr_t)values * UINT64_C(0x9E3779B97F4A7C15);
+    return (size_t)(hash >> 32) & (matrix__cow_cap - 1);
+}
+
+/// Returns the slot of a shared buffer, or `matrix__cow_cap` if it isn't shared
+MATRIX_DEF size_t matrix__cow_find(double const* values) {
+    if (!matrix__cow_len)
+        return matrix__cow_cap;
+
+    for (size_t i = matrix__cow_home(values);; i = (i + 1) & (matrix__cow_cap - 1)) {
+        if (matrix__cow_table[i].values == values)
+            return i;
+        if (!matrix__cow_table[i].values)
+            return matrix__cow_cap;
+    }
+}
+
+/// Returns the slot of the shared buffer m holds a reference to, or `matrix__cow_cap` if none.
+/// Views (`matrix_rows`) starting at the first row of a shared matrix have the same `values`,
+/// but fewer cells, and don't hold a reference.
+MATRIX_DEF size_t matrix__cow_find_owner(matrix const* m) {
+    size_t i = matrix__cow_find(m->values);
+    if (i < matrix__cow_cap && matrix__cow_table[i].len != matrix_len(m))
+        return matrix__cow_cap;
+    return i;
+}
+
+/// Adds a buffer (which isn't in the table yet) of `len` cells shared by 2 matrices.
+/// Returns false if the table couldn't be grown.
+MATRIX_DEF bool matrix__cow_insert(double* values, size_t len) {
+    if (2 * (matrix__cow_len + 1) > matrix__cow_cap) {
+        size_t old_cap = matrix__cow_cap;
+        matrix__cow_entry* old = matrix__cow_table;
+        size_t cap = old_cap ? 2 * old_cap : 16;
+        matrix__cow_entry* table = calloc(cap, sizeof(matrix__cow_entry));
+        if (!table)
+            return false;
+
+        matrix__cow_table = table;
+        matrix__cow_cap = cap;
+        for (size_t i = 0; i < old_cap; ++i) {
+            if (!old[i].values)
+                continue;
+            size_t j = matrix__cow_home(old[i].values);
+            while (table[j].values)
+                j = (j + 1) & (cap - 1);
+            table[j] = old[i];
+        }
+        free(old);
+    }
+
+    size_t i = matrix__cow_home(values);
+    while (matrix__cow_table[i].values)
+        i = (i + 1) & (matrix__cow_cap - 1);
+    matrix__cow_table[i].values = values;
+    matrix__cow_table[i].len = len;
+    matrix__cow_table[i].refs = 2;
+    atomic_store_explicit(&matrix__cow_shared, ++matrix__cow_len, memory_order_release);
+    return true;
+}
+
+/// Removes the buffer in slot i, shifting back the entries after it
+/// so that no lookup stops at the freed slot
+MATRIX_DEF void matrix__cow_remove(size_t i) {
+    size_t mask = matrix__cow_cap - 1;
+    for (size_t j = (i + 1) & mask; matrix__cow_table[j].values; j = (j + 1) & mask) {
+        size_t home = matrix__cow_home(matrix__cow_table[j].values);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            matrix__cow_table[i] = matrix__cow_table[j];
+            i = j;
+        }
+    }
+
+    matrix__cow_table[i].values = NULL;
+    matrix__cow_table[i].len = 0;
+    matrix__cow_table[i].refs = 0;
+    atomic_store_explicit(&matrix__cow_shared, --matrix__cow_len, memory_order_release);
+}
+
+/// Drops m's reference to its buffer. Returns false if it isn't shared,
+/// i.e. if m is its only owner.
+MATRIX_DEF bool matrix__cow_drop(matrix const* m) {
+    if (!atomic_load_explicit(&matrix__cow_shared, memory_order_acquire))
+        return false;
+
+    matrix__cow_acquire();
+    size_t i = matrix__cow_find_owner(m);
+    bool shared = i < matrix__cow_cap;
+    if (shared && --matrix__cow_table[i].refs == 1)
+        matrix__cow_remove(i);
+    matrix__cow_release();
+    return shared;
+}
+
+/// Called before writing into m: if its buffer is shared, gives m its own copy
+/// (with the old contents if `keep` is set, or uninitialized if they'll be overwritten anyway).
+/// Returns false if the copy couldn't be allocated, leaving m unchanged.
+MATRIX_DEF bool matrix__cow_write(matrix* m, bool keep) {
+    if (!atomic_load_explicit(&matrix__cow_shared, memory_order_acquire))
+        return true;
+
+    matrix__cow_acquire();
+    bool shared = matrix__cow_find_owner(m) < matrix__cow_cap;
+    matrix__cow_release();
+    if (!shared)
+        return true;
+
+    // m keeps its reference while copying, so that the buffer can't be freed under it
+    size_t bytes = sizeof(double) * matrix_len(m);
+    double* values = matrix__alloc(bytes, false, "matrix", m->height, m->width);
+    if (!values)
+        return false;
+    if (keep)
+        memcpy(values, m->values, bytes);
+
+    if (matrix__cow_drop(m))
+        m->values = values;
+    else
+        matrix__free(values, bytes);  // Every other matrix let go of the buffer in the meantime
+    return true;
+}
+
+#ifndef MATRIX_COW_OOM
+#define MATRIX_COW_OOM() abort()
+#endif  // MATRIX_COW_OOM
+
+/// Operations can't report errors, and writing into the shared buffer would change
+/// every matrix sharing it - so they call `MATRIX_COW_OOM` if the copy can't be allocated
+MATRIX_DEF void matrix__cow_write_or_oom(matrix* m, bool keep) {
+    if (!matrix__cow_write(m, keep))
+        MATRIX_COW_OOM();
+}
+
+#define MATRIX__COW_WRITE(m, keep) matrix__cow_write_or_oom((matrix*)(m), (keep))
+
+MATRIX_DEF matrix matrix_share(matrix const* m) {
+    assert(m && m->values);
+
+    matrix__cow_acquire();
+    size_t i = matrix__cow_find(m->values);
+    bool shared = true;
+    if (i == matrix__cow_cap)
+        shared = matrix__cow_insert(m->values, matrix_len(m));
+    else if (matrix__cow_table[i].len == matrix_len(m))
+        ++matrix__cow_table[i].refs;
+    else
+        shared = false;  // m is a view into a shared buffer, which it can't hand out
+    matrix__cow_release();
+
+    return shared ? *m : matrix_copy(m);
+}
+
+MATRIX_DEF bool matrix_unshare(matrix* m) {
+    assert(m && m->values);
+    return matrix__cow_write(m, true);
+}
+
+MATRIX_DEF size_t matrix_share_count(matrix const* m) {
+    assert(m && m->values);
+
+    matrix__cow_acquire();
+    size_t i = matrix__cow_find_owner(m);
+    size_t refs = i < matrix__cow_cap ? matrix__cow_table[i].refs : 1;
+    matrix__cow_release();
+    return refs;
+}
+
+#endif  // MATRIX_COW
+
+MATRIX_DEF matrix matrix_new(size_t height, size_t width) {
+    matrix m;
+    m.height = height;
+    m.width = width;
+    m.values = matrix__alloc(sizeof(double) * height * width, false, "matrix", height, width);
+    assert(m.values);
+    return m;
+}
+
+MATRIX_DEF matrix matrix_new_zeroed(size_t height, size_t width) {
+    matrix m;
+    m.height = height;
+    m.width = width;
+    m.values = matrix__alloc(sizeof(double) * height * width, true, "matrix", height, width);
+    assert(m.values);
+    return m;
+}
+
+MATRIX_DEF matrix matrix_new_repeated(size_t height, size_t width, double x) {
+    // Zeroed memory usually comes straight from the OS, without writing anything
+    if (x == 0.0 && !signbit(x))
+        return matrix_new_zeroed(height, width);
+
+    matrix m = matrix_new(height, width);
+    matrix_fill_scalar(&m, x);
+    return m;
+}
+
+MATRIX_DEF matrix matrix_new_uniform(size_t height, size_t width, double a, double b) {
+    matrix m = matrix_new(height, width);
+    matrix_fill_uniform(&m, a, b);
+    return m;
+}
+
+MATRIX_DEF void matrix_del(matrix* m) {
+    assert(m && m->values);
+    assert(m->values);
+#ifdef MATRIX_COW
+    if (matrix__cow_drop(m)) {
+        m->values = NULL;
+        return;
+    }
+#endif
+    matrix__free(m->values, sizeof(double) * m->height * m->width);
+    m->values = NULL;
+}
+
+MATRIX_DEF matrix matrix_copy(matrix const* m) {
+    assert(m && m->values);
+    matrix m2 = matrix_new(m->height, m->width);
+    matrix_copy_into(m, &m2);
+    return m2;
+}
+
+#endif  // MATRIX_NO_MALLOC
+
+#ifndef MATRIX__COW_WRITE
+#define MATRIX__COW_WRITE(m, keep) ((void)0)
+#endif  // MATRIX__COW_WRITE
+
+// Private helpers for elementwise operations
+
+#ifndef MATRIX_PARALLEL_THRESHOLD
+#define MATRIX_PARALLEL_THRESHOLD (1u << 15)
+#endif  // MATRIX_PARALLEL_THRESHOLD
+
+#ifndef MATRIX_STREAM_THRESHOLD
+#define MATRIX_STREAM_THRESHOLD (1u << 20)
+#endif  // MATRIX_STREAM_THRESHOLD
+
+typedef enum {
+    MATRIX__EW_COPY,
+    MATRIX__EW_FILL,
+    MATRIX__EW_ADD,
+    MATRIX__EW_SUB,
+    MATRIX__EW_MUL,
+    MATRIX__EW_ADD_SCALAR,
+    MATRIX__EW_MUL_SCALAR,
+    MATRIX__EW_POW_SCALAR,
+    MATRIX__EW_MAP,
+} matrix__ew_kind;
+
+/// Elementwise operation `a = f(a, b or x)`, split into ranges by `matrix__elementwise`
+typedef struct {
+    matrix__ew_kind kind;
+    double* a;
+    double const* b;
+    double x;
+    double (*func)(double);
+    size_t skew;  // cells in front of `a` in its cache line
+    bool stream;  // whether to bypass the cache when writing `a`
+} matrix__ew;
+
+#ifdef MATRIX__STREAM_STORES
+
+/// Fills `len` cells with non-temporal stores, which write whole cache lines to memory
+/// without reading them first or evicting anything from the cache
+MATRIX_DEF void matrix__stream_fill(double* a, double x, size_t len) {
+    size_t i = 0;
+    for (; i < len && (uintptr_t)(a + i) % 16; ++i)
+        a[i] = x;
+
+    __m128d v = _mm_set1_pd(x);
+    for (; i + 2 <= len; i += 2)
+        _mm_stream_pd(a + i, v);
+
+    for (; i < len; ++i)
+        a[i] = x;
+    _mm_sfence();
+}
+
+/// Copies `len` cells with non-temporal stores, see `matrix__stream_fill`
+MATRIX_DEF void matrix__stream_copy(double* a, double const* b, size_t len) {
+    size_t i = 0;
+    for (; i < len && (uintptr_t)(a + i) % 16; ++i)
+        a[i] = b[i];
+
+    for (; i + 2 <= len; i += 2)
+        _mm_stream_pd(a + i, _mm_loadu_pd(b + i));
+
+    for (; i < len; ++i)
+        a[i] = b[i];
+    _mm_sfence();
+}
+
+#endif  // MATRIX__STREAM_STORES
+
+static void matrix__elementwise_range(void* ctx, size_t begin, size_t end) {
+    matrix__ew const* ew = ctx;
+    begin = begin > ew->skew ? begin - ew->skew : 0;
+    end -= ew->skew;
+
+    double* a = ew->a;
+    double const* b = ew->b;
+    double x = ew->x;
+    switch (ew->kind) {
+        case MATRIX__EW_COPY:
+#ifdef MATRIX__STREAM_STORES
+            if (ew->stream) {
+                matrix__stream_copy(a + begin, b + begin, end - begin);
+                break;
+            }
+#endif
+            memcpy(a + begin, b + begin, sizeof(double) * (end - begin));
+            break;
+        case MATRIX__EW_FILL:
+            // All-zero bytes are +0.0, and memset is the fastest way to write them
+            if (x == 0.0 && !signbit(x)) {
+                memset(a + begin, 0, sizeof(double) * (end - begin));
+                break;
+            }
+#ifdef MATRIX__STREAM_STORES
+            if (ew->stream) {
+                matrix__stream_fill(a + begin, x, end - begin);
+                break;
+            }
+#endif
+            for (size_t i = begin; i < end; ++i)
+                a[i] = x;
+            break;
+        case MATRIX__EW_ADD:
+            for (size_t i = begin; i < end; ++i)
+                a[i] += b[i];
+            break;
+        case MATRIX__EW_SUB:
+            for (size_t i = begin; i < end; ++i)
+                a[i] -= b[i];
+            break;
+        case MATRIX__EW_MUL:
+            for (size_t i = begin; i < end; ++i)
+                a[i] *= b[i];
+            break;
+        case MATRIX__EW_ADD_SCALAR:
+            for (size_t i = begin; i < end; ++i)
+                a[i] += x;
+            break;
+        case MATRIX__EW_MUL_SCALAR:
+            for (size_t i = begin; i < end; ++i)
+                a[i] *= x;
+            break;
+        case MATRIX__EW_POW_SCALAR:
+            for (size_t i = begin; i < end; ++i)
+                a[i] = pow(a[i], x);
+            break;
+        case MATRIX__EW_MAP:
+            for (size_t i = begin; i < end; ++i)
+                a[i] = ew->func(a[i]);
+            break;
+    }
+}
+
+/// Performs an elementwise operation on `len` cells. Above `MATRIX_PARALLEL_THRESHOLD` cells,
+/// it's split across the thread pool into chunks starting at cache line boundaries of `a`,
+/// so that no two threads write into the same cache line.
+/// Above `MATRIX_STREAM_THRESHOLD` cells, which are unlikely to be read back from the cache,
+/// fills and copies use non-temporal stores (if available).
+MATRIX_DEF void matrix__elementwise(matrix__ew_kind kind, double* a, double const* b, double x,
+                                    double (*func)(double), size_t len) {
+    matrix__ew ew = {kind, a, b, x, func, 0, len >= MATRIX_STREAM_THRESHOLD};
+    if (len < MATRIX_PARALLEL_THRESHOLD) {
+        matrix__elementwise_range(&ew, 0, len);
+        return;
+    }
+
+    ew.skew = (uintptr_t)a % 64 / sizeof(double);
+    matrix__parallel_for(len + ew.skew, 64 / sizeof(double), matrix__elementwise_range, &ew);
+}
+
+MATRIX_DEF void matrix_copy_into(matrix const* src, matrix* dest) {
+    size_t src_len = matrix_len(src);
+    assert(src_len == matrix_len(dest));
+    MATRIX__OP_BEGIN(MATRIX_OP_COPY_INTO, src->height, src->width);
+    MATRIX__COW_WRITE(dest, false);
+    matrix__elementwise(MATRIX__EW_COPY, dest->values, src->values, 0.0, NULL, src_len);
+    MATRIX__OP_END(0.0, 16.0 * src_len);
+}
+
+MATRIX_DEF size_t matrix_len(matrix const* m) {
+    assert(m);
+    return m->height * m->width;
+}
+
+MATRIX_DEF matrix matrix_rows(matrix const* m, size_t row, size_t count) {
+    assert(m && m->values);
+    assert(row + count <= m->height);
+    matrix rows = {count, m->width, m->values + row * m->width};
+    return rows;
+}
+
+MATRIX_DEF void matrix_print(matrix const* m, FILE* sink) {
+    assert(m && m->values);
+    MATRIX__OP_BEGIN(MATRIX_OP_PRINT, m->height, m->width);
+    for (size_t row = 0; row < m->height; ++row) {
+        for (size_t col = 0; col < m->width; ++col) {
+            fprintf(sink, "%f ", matrix_get(m, row, col));
+        }
+        fputc('\n', sink);
+    }
+    MATRIX__OP_END(0.0, 8.0 * matrix_len(m));
+}
+
+MATRIX_DEF double matrix_get(matrix const* m, size_t row, size_t col) {
+    assert(m && m->values);
+    assert(row < m->height);
+    assert(col < m->width);
+
+    return m->values[row * m->width + col];
+}
+
+MATRIX_DEF void matrix_set(matrix const* m, size_t row, size_t col, double value) {
+    assert(m && m->values);
+    assert(row < m->height);
+    assert(col < m->width);
+    MATRIX__COW_WRITE(m, true);
+
+    m->values[row * m->width + col] = value;
+}
+
+MATRIX_DEF void matrix_fill_scalar(matrix* m, double value) {
+    size_t end = matrix_len(m);
+    MATRIX__OP_BEGIN(MATRIX_OP_FILL_SCALAR, m->height, m->width);
+    MATRIX__COW_WRITE(m, false);
+    matrix__elementwise(MATRIX__EW_FILL, m->values, NULL, value, NULL, end);
+    MATRIX__OP_END(0.0, 8.0 * end);
+}
+
+MATRIX_DEF void matrix_fill_uniform(matrix* m, double a, double b) {
+    assert(b > a);
+    double len = b - a;
+    double r;
+    MATRIX__OP_BEGIN(MATRIX_OP_FILL_UNIFORM, m->height, m->width);
+    MATRIX__COW_WRITE(m, false);
+
+    size_t end = matrix_len(m);
+    for (size_t i = 0; i < end; ++i) {
+        r = (double)rand() / (double)RAND_MAX;  // Generate a random float in range <0, 1>
+        m->values[i] = a + r * len;  // Interpolate the random number to be in correct range
+    }
+    MATRIX__OP_END(2.0 * end, 8.0 * end);
+}
+
+MATRIX_DEF void matrix_add(matrix* a, matrix const* b) {
+    assert(a && a->values);
+    assert(b && b->values);
+    assert(a->height == b->height);
+    assert(a->width == b->width);
+    size_t end = matrix_len(a);
+    MATRIX__OP_BEGIN(MATRIX_OP_ADD, a->height, a->width);
+    MATRIX__COW_WRITE(a, true);
+
+    matrix__elementwise(MATRIX__EW_ADD, a->values, b->values, 0.0, NULL, end);
+    MATRIX__OP_END(end, 24.0 * end);
+}
+
+MATRIX_DEF void matrix_sub(matrix* a, matrix const* b) {
+    assert(a && a->values);
+    assert(b && b->values);
+    assert(a->height == b->height);
+    assert(a->width == b->width);
+    size_t end = matrix_len(a);
+    MATRIX__OP_BEGIN(MATRIX_OP_SUB, a->height, a->width);
+    MATRIX__COW_WRITE(a, true);
+
+    matrix__elementwise(MATRIX__EW_SUB, a->values, b->values, 0.0, NULL, end);
+    MATRIX__OP_END(end, 24.0 * end);
+}
+
+MATRIX_DEF void matrix_mul(matrix* a, matrix const* b) {
+    assert(a && a->values);
+    assert(b && b->values);
+    assert(a->height == b->height);
+    assert(a->width == b->width);
+    size_t end = matrix_len(a);
+    MATRIX__OP_BEGIN(MATRIX_OP_MUL, a->height, a->width);
+    MATRIX__COW_WRITE(a, true);
+
+    matrix__elementwise(MATRIX__EW_MUL, a->values, b->values, 0.0, NULL, end);
+    MATRIX__OP_END(end, 24.0 * end);
+}
+
+MATRIX_DEF void matrix_add_scalar(matrix* a, double b) {
+    assert(a && a->values);
+    size_t end = matrix_len(a);
+    MATRIX__OP_BEGIN(MATRIX_OP_ADD_SCALAR, a->height, a->width);
+    MATRIX__COW_WRITE(a, true);
+
+    matrix__elementwise(MATRIX__EW_ADD_SCALAR, a->values, NULL, b, NULL, end);
+    MATRIX__OP_END(end, 16.0 * end);
+}
+
+MATRIX_DEF void matrix_sub_scalar(matrix* a, double b) {
+    assert(a && a->values);
+    size_t end = matrix_len(a);
+    MATRIX__OP_BEGIN(MATRIX_OP_SUB_SCALAR, a->height, a->width);
+    MATRIX__COW_WRITE(a, true);
+
+    matrix__elementwise(MATRIX__EW_ADD_SCALAR, a->values, NULL, -b, NULL, end);
+    MATRIX__OP_END(end, 16.0 * end);
+}
+
+MATRIX_DEF void matrix_mul_scalar(matrix* a, double b) {
+    assert(a && a->values);
+    size_t end = matrix_len(a);
+    MATRIX__OP_BEGIN(MATRIX_OP_MUL_SCALAR, a->height, a->width);
+    MATRIX__COW_WRITE(a, true);
+
+    matrix__elementwise(MATRIX__EW_MUL_SCALAR, a->values, NULL, b, NULL, end);
+    MATRIX__OP_END(end, 16.0 * end);
+}
+
+MATRIX_DEF void matrix_pow_scalar(matrix* a, double b) {
+    assert(a && a->values);
+    size_t end = matrix_len(a);
+    MATRIX__OP_BEGIN(MATRIX_OP_POW_SCALAR, a->height, a->width);
+    MATRIX__COW_WRITE(a, true);
+
+    matrix__elementwise(MATRIX__EW_POW_SCALAR, a->values, NULL, b, NULL, end);
+    MATRIX__OP_END(end, 16.0 * end);
+}
 
 MATRIX_DEF void matrix_map(matrix* m, double(*func)(double)) {
     assert(m && m->values);
-    size_t end = matrix_len(m);
+    size_t end = matrix_len(m);
+    MATRIX__OP_BEGIN(MATRIX_OP_MAP, m->height, m->width);
+    MATRIX__COW_WRITE(m, true);
+
+    matrix__elementwise(MATRIX__EW_MAP, m->values, NULL, 0.0, func, end);
+    MATRIX__OP_END(0.0, 16.0 * end);
+}
+
+// Private helpers for reductions
+
+/// Number of chunks summed by `matrix_sum` in the deterministic mode
+#define MATRIX__SUM_CHUNKS 64
+
+/// Number of cells summed by a plain loop at the leaves of the pairwise summation
+#define MATRIX__SUM_BLOCK 256
+
+typedef struct {
+    double const* values;
+    size_t len;
+    size_t parts;
+    bool pairwise;
+    double partials[MATRIX__SUM_CHUNKS];
+} matrix__sum_job;
+
+/// Sums `len` values over a binary tree, whose shape only depends on `len`,
+/// and whose leaves are runs of at most `MATRIX__SUM_BLOCK` cells
+MATRIX_DEF double matrix__sum_pairwise(double const* values, size_t len) {
+    if (len <= MATRIX__SUM_BLOCK) {
+        double sum = 0.0;
+        for (size_t i = 0; i < len; ++i)
+            sum += values[i];
+        return sum;
+    }
+
+    size_t half = (len / 2 + MATRIX__SUM_BLOCK - 1) / MATRIX__SUM_BLOCK * MATRIX__SUM_BLOCK;
+    return matrix__sum_pairwise(values, half) + matrix__sum_pairwise(values + half, len - half);
+}
+
+/// Sums the parts [begin, end) of a `matrix__sum_job` into its partials
+MATRIX_DEF void matrix__sum_range(void* ctx, size_t begin, size_t end) {
+    matrix__sum_job* job = ctx;
+    for (size_t part = begin; part < end; ++part) {
+        size_t first, last;
+        matrix__parallel_range(job->len, MATRIX__SUM_BLOCK, part, job->parts, &first, &last);
+
+        if (job->pairwise) {
+            job->partials[part] = matrix__sum_pairwise(job->values + first, last - first);
+        } else {
+            double sum = 0.0;
+            for (size_t i = first; i < last; ++i)
+                sum += job->values[i];
+            job->partials[part] = sum;
+        }
+    }
+}
+
+MATRIX_DEF double matrix_sum(matrix const* m) {
+    assert(m && m->values);
+    size_t len = matrix_len(m);
+    MATRIX__OP_BEGIN(MATRIX_OP_SUM, m->height, m->width);
+
+    // The deterministic mode always uses the same chunks, whichever threads sum them
+    matrix__sum_job job;
+    job.values = m->values;
+    job.len = len;
+    job.pairwise = matrix__deterministic;
+    job.parts = len < MATRIX_PARALLEL_THRESHOLD ? 1 : matrix__parallel_width();
+    if (job.pairwise || job.parts > MATRIX__SUM_CHUNKS)
+        job.parts = MATRIX__SUM_CHUNKS;
+
+    if (len < MATRIX_PARALLEL_THRESHOLD)
+        matrix__sum_range(&job, 0, job.parts);
+    else
+        matrix__parallel_for(job.parts, 1, matrix__sum_range, &job);
+
+    double sum = 0.0;
+    for (size_t part = 0; part < job.parts; ++part)
+        sum += job.partials[part];
+    MATRIX__OP_END(len, 8.0 * len);
+    return sum;
+}
+
+#ifndef MATRIX_NO_MALLOC
+
+MATRIX_DEF matrix matrix_matmul(matrix const* a, matrix const* b) {
+    assert(a && a->values);
+    assert(b && b->values);
+    assert(a->width == b->height);
+
+    matrix multiplied = matrix_new(a->height, b->width);
+    matrix_matmul_into(a, b, &multiplied);
+
+    return multiplied;
+}
+
+MATRIX_DEF matrix matrix_matmul_semiring(matrix const* a, matrix const* b, matrix_semiring s) {
+    assert(a && a->values);
+    assert(b && b->values);
+    assert(a->width == b->height);
+
+    matrix multiplied = matrix_new(a->height, b->width);
+    matrix_matmul_semiring_into(a, b, &multiplied, s);
+
+    return multiplied;
+}
+
+#endif  // MATRIX_NO_MALLOC
+
+// Private helpers for the blocked matrix multiplication
+
+#ifndef MATRIX_MATMUL_BLOCK_K
+#define MATRIX_MATMUL_BLOCK_K 128
+#endif  // MATRIX_MATMUL_BLOCK_K
+
+#ifndef MATRIX_MATMUL_BLOCK_N
+#define MATRIX_MATMUL_BLOCK_N 256
+#endif  // MATRIX_MATMUL_BLOCK_N
+
+#ifndef MATRIX_TRANSPOSE_BLOCK
+#define MATRIX_TRANSPOSE_BLOCK 32
+#endif  // MATRIX_TRANSPOSE_BLOCK
+
+#ifndef MATRIX_MATMUL_UNROLL
+#define MATRIX_MATMUL_UNROLL 2
+#endif  // MATRIX_MATMUL_UNROLL
+
+static matrix_tuning matrix__tuning_current = {
+    MATRIX_MATMUL_BLOCK_K,
+    MATRIX_MATMUL_BLOCK_N,
+    MATRIX_TRANSPOSE_BLOCK,
+    MATRIX_MATMUL_UNROLL,
+};
+
+#ifdef MATRIX_THREADS
+/// Pool threads and async tasks read the parameters while they may be replaced,
+/// so `matrix__tuning_current` is guarded by a lock
+static pthread_once_t matrix__tuning_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t matrix__tuning_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+static bool matrix__tuning_initialized = false;
+#endif  // MATRIX_THREADS
+
+/// Reads blocking parameters from a file written by `matrix_tuning_save` into `out`.
+/// Returns `false` (leaving `out` in an unspecified state) if the file couldn't be read or parsed.
+MATRIX_DEF bool matrix__tuning_read(char const* path, matrix_tuning* out) {
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return false;
+
+    char buf[256];
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    bool ok = !ferror(f) && feof(f);
+    fclose(f);
+    buf[len] = '\0';
+
+    return ok && matrix_tuning_parse(buf, out);
+}
+
+/// Loads the blocking parameters from the environment, see `matrix_tuning`
+static void matrix__tuning_init(void) {
+    char const* spec = getenv("MATRIX_TUNING");
+    char const* path = getenv("MATRIX_TUNING_FILE");
+    matrix_tuning t = matrix__tuning_current;
+
+    if (spec ? matrix_tuning_parse(spec, &t) : path && matrix__tuning_read(path, &t))
+        matrix__tuning_current = t;
+}
+
+/// Loads the blocking parameters from the environment, unless already done
+MATRIX_DEF void matrix__tuning_ensure_init(void) {
+#ifdef MATRIX_THREADS
+    pthread_once(&matrix__tuning_once, matrix__tuning_init);
+#else
+    if (!matrix__tuning_initialized) {
+        matrix__tuning_initialized = true;
+        matrix__tuning_init();
+    }
+#endif  // MATRIX_THREADS
+}
+
+/// Returns a snapshot of the current blocking parameters,
+/// loading them from the environment on the first call
+MATRIX_DEF matrix_tuning matrix__tuning(void) {
+    matrix__tuning_ensure_init();
+#ifdef MATRIX_THREADS
+    pthread_mutex_lock(&matrix__tuning_lock);
+    matrix_tuning t = matrix__tuning_current;
+    pthread_mutex_unlock(&matrix__tuning_lock);
+    return t;
+#else
+    return matrix__tuning_current;
+#endif  // MATRIX_THREADS
+}
+
+MATRIX_DEF matrix_tuning matrix_tuning_get(void) {
+    return matrix__tuning();
+}
+
+MATRIX_DEF void matrix_tuning_set(matrix_tuning const* t) {
+    assert(t);
+    assert(t->matmul_block_k && t->matmul_block_n && t->transpose_block);
+    assert(t->matmul_unroll == 1 || t->matmul_unroll == 2 || t->matmul_unroll == 4);
+
+    // Later calls must not replace these parameters by the ones from the environment
+    matrix__tuning_ensure_init();
+#ifdef MATRIX_THREADS
+    pthread_mutex_lock(&matrix__tuning_lock);
+    matrix__tuning_current = *t;
+    pthread_mutex_unlock(&matrix__tuning_lock);
+#else
+    matrix__tuning_current = *t;
+#endif  // MATRIX_THREADS
+}
+
+// Forking
+
+#ifdef MATRIX_THREADS
+
+/// Takes every library lock before fork, so that none of them
+/// is copied into the child while some other thread holds it
+static void matrix__fork_prepare(void) {
+    pthread_mutex_lock(&matrix__pool_lock);
+    pthread_mutex_lock(&matrix__tuning_lock);
+#if defined(MATRIX_COW) && !defined(MATRIX_NO_MALLOC)
+    matrix__cow_acquire();
+#endif
+#if defined(MATRIX_TRACK_ALLOCS) && !defined(MATRIX_NO_MALLOC)
+    matrix__alloc_list_lock();
+#endif
+}
+
+/// Releases the locks taken by `matrix__fork_prepare`
+static void matrix__fork_parent(void) {
+#if defined(MATRIX_TRACK_ALLOCS) && !defined(MATRIX_NO_MALLOC)
+    matrix__alloc_list_unlock();
+#endif
+#if defined(MATRIX_COW) && !defined(MATRIX_NO_MALLOC)
+    matrix__cow_release();
+#endif
+    pthread_mutex_unlock(&matrix__tuning_lock);
+    pthread_mutex_unlock(&matrix__pool_lock);
+}
+
+/// Forked children don't inherit the pool threads (e.g. workers of a prefork server),
+/// so they run everything serially. Queued tasks are dropped; futures of the parent
+/// are performed by whichever thread of the child waits for them.
+static void matrix__fork_child(void) {
+    static pthread_cond_t const cond_init = PTHREAD_COND_INITIALIZER;
+
+    // Threads which waited on these in the parent don't exist here
+    matrix__pool_wake = cond_init;
+    matrix__pool_done = cond_init;
+#ifndef MATRIX_NO_MALLOC
+    matrix__future_done = cond_init;
+#endif
+
+    matrix__pool_count = 1;
+    matrix__pool_queue_head = NULL;
+    matrix__pool_queue_tail = NULL;
+    ++matrix__pool_forks;
+    atomic_flag_clear(&matrix__pool_busy);
+
+    // The only thread of the child is the one which took the locks, so it may release them
+    matrix__fork_parent();
+}
+
+#endif  // MATRIX_THREADS
+
+MATRIX_DEF bool matrix_tuning_parse(char const* str, matrix_tuning* out) {
+    assert(str && out);
+    char key[32];
+    int consumed = 0;
+
+    while (sscanf(str, " %31[a-z_]=%n", key, &consumed) == 1 && consumed) {
+        str += consumed;
+        consumed = 0;
+
+        // strtoull skips whitespace and accepts signs (wrapping "-1" around), so require a digit
+        if (*str < '0' || *str > '9')
+            return false;
+        char* end;
+        errno = 0;
+        unsigned long long value = strtoull(str, &end, 10);
+        if (errno == ERANGE || value > SIZE_MAX)
+            return false;
+        str = end;
+
+        if (value == 0)
+            return false;
+        else if (strcmp(key, "matmul_block_k") == 0)
+            out->matmul_block_k = (size_t)value;
+        else if (strcmp(key, "matmul_block_n") == 0)
+            out->matmul_block_n = (size_t)value;
+        else if (strcmp(key, "transpose_block") == 0)
+            out->transpose_block = (size_t)value;
+        else if (strcmp(key, "matmul_unroll") == 0 && (value == 1 || value == 2 || value == 4))
+            out->matmul_unroll = (size_t)value;
+        else
+            return false;
+    }
+
+    // Only trailing whitespace may be left
+    while (*str == ' ' || *str == '\t' || *str == '\n' || *str == '\r') ++str;
+    return *str == '\0';
+}
+
+MATRIX_DEF bool matrix_tuning_save(matrix_tuning const* t, char const* path) {
+    assert(t && path);
+    FILE* f = fopen(path, "w");
+    if (!f)
+        return false;
+
+    fprintf(f, "matmul_block_k=%zu matmul_block_n=%zu transpose_block=%zu matmul_unroll=%zu\n",
+            t->matmul_block_k, t->matmul_block_n, t->transpose_block, t->matmul_unroll);
+    return fclose(f) == 0;
+}
+
+MATRIX_DEF bool matrix_tuning_load(char const* path) {
+    assert(path);
+    matrix_tuning t = matrix_tuning_get();
+    if (!matrix__tuning_read(path, &t))
+        return false;
+
+    matrix_tuning_set(&t);
+    return true;
+}
+
+/// Returns the identity element of the semiring's ⊕ operation
+MATRIX_DEF double matrix__semiring_zero(matrix_semiring s) {
+    switch (s) {
+    case MATRIX_SEMIRING_MIN_PLUS:
+        return INFINITY;
+    case MATRIX_SEMIRING_MAX_PLUS:
+    case MATRIX_SEMIRING_MAX_MIN:
+        return -INFINITY;
+    default:
+        return 0.0;
+    }
+}
+
+/// Performs `dest[j] = dest[j] ⊕ (x ⊗ b[j])` for every j < len.
+/// The loops are kept branch-free, so that compilers turn them
+/// into SIMD add/mul/min/max instructions.
+MATRIX_DEF void matrix__semiring_axpy(matrix_semiring s, double x, double const* restrict b,
+                                      double* restrict dest, size_t len) {
+    switch (s) {
+    case MATRIX_SEMIRING_PLUS_TIMES:
+        for (size_t j = 0; j < len; ++j)
+            dest[j] += x * b[j];
+        break;
+
+    case MATRIX_SEMIRING_MIN_PLUS:
+        for (size_t j = 0; j < len; ++j) {
+            double y = x + b[j];
+            dest[j] = y < dest[j] ? y : dest[j];
+        }
+        break;
+
+    case MATRIX_SEMIRING_MAX_PLUS:
+        for (size_t j = 0; j < len; ++j) {
+            double y = x + b[j];
+            dest[j] = y > dest[j] ? y : dest[j];
+        }
+        break;
+
+    case MATRIX_SEMIRING_MAX_MIN:
+        for (size_t j = 0; j < len; ++j) {
+            double y = x < b[j] ? x : b[j];
+            dest[j] = y > dest[j] ? y : dest[j];
+        }
+        break;
+
+    case MATRIX_SEMIRING_OR_AND:
+        if (x == 0.0)
+            break;
+        for (size_t j = 0; j < len; ++j)
+            dest[j] = b[j] != 0.0 ? 1.0 : dest[j];
+        break;
+    }
+}
+
+/// Performs `dest0[j] += x0 * b[j]` and `dest1[j] += x1 * b[j]` for every j < len,
+/// loading every cell of b once for both rows.
+MATRIX_DEF void matrix__axpy2(double x0, double x1, double const* restrict b,
+                              double* restrict dest0, double* restrict dest1, size_t len) {
+    for (size_t j = 0; j < len; ++j) {
+        dest0[j] += x0 * b[j];
+        dest1[j] += x1 * b[j];
+    }
+}
+
+/// Performs `dest_i[j] += x_i * b[j]` for 4 rows and every j < len,
+/// loading every cell of b once for all rows.
+MATRIX_DEF void matrix__axpy4(double x0, double x1, double x2, double x3,
+                              double const* restrict b, double* restrict dest0,
+                              double* restrict dest1, double* restrict dest2,
+                              double* restrict dest3, size_t len) {
+    for (size_t j = 0; j < len; ++j) {
+        dest0[j] += x0 * b[j];
+        dest1[j] += x1 * b[j];
+        dest2[j] += x2 * b[j];
+        dest3[j] += x3 * b[j];
+    }
+}
+
+/// Multiplies a[:, k_begin:k_end] by a (k_end - k_begin) x col_len panel of b
+/// (with consecutive panel rows `b_stride` elements apart), and accumulates
+/// the result into dest[:, col_begin:col_begin+col_len].
+/// Ordinary products handle `unroll` rows of a at once; every dest cell
+/// is still accumulated in order of increasing k.
+MATRIX_DEF void matrix__matmul_panel(matrix const* a, double const* b_panel, size_t b_stride,
+                                     matrix* dest, size_t k_begin, size_t k_end,
+                                     size_t col_begin, size_t col_len, matrix_semiring s,
+                                     size_t unroll) {
+    size_t row = 0;
+    size_t a_w = a->width;
+    size_t d_w = dest->width;
+
+    if (s == MATRIX_SEMIRING_PLUS_TIMES && unroll >= 4) {
+        for (; dest->height - row >= 4; row += 4) {
+            double const* a_row = a->values + row * a_w;
+            double* dest_row = dest->values + row * d_w + col_begin;
+
+            for (size_t k = k_begin; k < k_end; ++k)
+                matrix__axpy4(a_row[k], a_row[a_w + k], a_row[2 * a_w + k], a_row[3 * a_w + k],
+                              b_panel + (k - k_begin) * b_stride, dest_row, dest_row + d_w,
+                              dest_row + 2 * d_w, dest_row + 3 * d_w, col_len);
+        }
+    }
+
+    if (s == MATRIX_SEMIRING_PLUS_TIMES && unroll >= 2) {
+        for (; dest->height - row >= 2; row += 2) {
+            double const* a_row = a->values + row * a_w;
+            double* dest_row = dest->values + row * d_w + col_begin;
+
+            for (size_t k = k_begin; k < k_end; ++k)
+                matrix__axpy2(a_row[k], a_row[a_w + k], b_panel + (k - k_begin) * b_stride,
+                              dest_row, dest_row + d_w, col_len);
+        }
+    }
+
+    for (; row < dest->height; ++row) {
+        double const* a_row = a->values + row * a->width;
+        double* dest_row = dest->values + row * dest->width + col_begin;
+
+        for (size_t k = k_begin; k < k_end; ++k)
+            matrix__semiring_axpy(s, a_row[k], b_panel + (k - k_begin) * b_stride, dest_row,
+                                  col_len);
+    }
+}
+
+/// Returns the offset of the (k, col) panel of b packed by `matrix_pack_b_into`.
+/// Panels of the same columns are stored one after another,
+/// each one with `col_len` cells per row.
+MATRIX_DEF size_t matrix__packed_offset(size_t height, size_t k, size_t col, size_t col_len) {
+    return col * height + k * col_len;
+}
+
+/// Accumulates the product of a[:, k_begin:k_end] and b[k_begin:k_end, :] into dest.
+/// b is either a plain row-major array of b_height x b_width cells,
+/// or (if `packed` is set) an array created by `matrix_pack_b_into` with the provided block_n.
+MATRIX_DEF void matrix__matmul_accumulate_k(matrix const* a, double const* b_values,
+                                            size_t b_height, size_t b_width, bool packed,
+                                            size_t block_n, matrix* dest, matrix_semiring s,
+                                            size_t k_begin, size_t k_end) {
+    matrix_tuning tuning = matrix__tuning();
+    size_t block_k = tuning.matmul_block_k;
+
+    // Iterate over (k, col) panels of b, small enough to stay in the cache
+    // while every row of a is multiplied by them. Panels are visited in order
+    // of increasing k, so every dest cell is accumulated in the same order
+    // as in the naive algorithm.
+    for (size_t col = 0; col < b_width; col += block_n) {
+        size_t col_len = b_width - col < block_n ? b_width - col : block_n;
+
+        for (size_t k = k_begin; k < k_end; k += block_k) {
+            size_t panel_end = k_end - k < block_k ? k_end : k + block_k;
+
+            if (packed)
+                matrix__matmul_panel(a, b_values + matrix__packed_offset(b_height, k, col, col_len),
+                                     col_len, dest, k, panel_end, col, col_len, s,
+                                     tuning.matmul_unroll);
+            else
+                matrix__matmul_panel(a, b_values + k * b_width + col, b_width, dest, k, panel_end,
+                                     col, col_len, s, tuning.matmul_unroll);
+        }
+    }
+}
+
+/// Accumulates the blocked matrix multiplication of a and b into dest,
+/// see `matrix__matmul_accumulate_k`.
+MATRIX_DEF void matrix__matmul_accumulate(matrix const* a, double const* b_values,
+                                          size_t b_height, size_t b_width, bool packed,
+                                          size_t block_n, matrix* dest, matrix_semiring s) {
+    matrix__matmul_accumulate_k(a, b_values, b_height, b_width, packed, block_n, dest, s, 0,
+                                b_height);
+}
+
+#ifndef MATRIX_MATMUL_PARALLEL_THRESHOLD
+#define MATRIX_MATMUL_PARALLEL_THRESHOLD (1u << 18)
+#endif  // MATRIX_MATMUL_PARALLEL_THRESHOLD
+
+/// Arguments of `matrix__matmul_blocked`, shared by the threads working on it
+typedef struct {
+    matrix const* a;
+    double const* b_values;
+    size_t b_height;
+    size_t b_width;
+    bool packed;
+    size_t block_n;
+    matrix* dest;
+    matrix_semiring s;
+    size_t parts;
+    double* partials;
+} matrix__matmul_job;
+
+/// Computes the rows [begin, end) of dest
+MATRIX_DEF void matrix__matmul_rows(void* ctx, size_t begin, size_t end) {
+    matrix__matmul_job const* job = ctx;
+    matrix a_rows = matrix_rows(job->a, begin, end - begin);
+    matrix dest_rows = matrix_rows(job->dest, begin, end - begin);
+
+    matrix__elementwise(MATRIX__EW_FILL, dest_rows.values, NULL, matrix__semiring_zero(job->s),
+                        NULL, matrix_len(&dest_rows));
+    matrix__matmul_accumulate(&a_rows, job->b_values, job->b_height, job->b_width, job->packed,
+                              job->block_n, &dest_rows, job->s);
+}
+
+/// Computes the partial products over the k ranges [begin, end) out of `parts`.
+/// The first one goes straight into dest, and the others into `partials`.
+MATRIX_DEF void matrix__matmul_k_parts(void* ctx, size_t begin, size_t end) {
+    matrix__matmul_job const* job = ctx;
+    size_t len = matrix_len(job->dest);
+
+    for (size_t part = begin; part < end; ++part) {
+        size_t k_begin, k_end;
+        matrix__parallel_range(job->b_height, matrix__tuning().matmul_block_k, part, job->parts,
+                               &k_begin, &k_end);
+
+        matrix partial = *job->dest;
+        if (part)
+            partial.values = job->partials + (part - 1) * len;
+        matrix__elementwise(MATRIX__EW_FILL, partial.values, NULL, 0.0, NULL, len);
+        matrix__matmul_accumulate_k(job->a, job->b_values, job->b_height, job->b_width,
+                                    job->packed, job->block_n, &partial, job->s, k_begin, k_end);
+    }
+}
+
+/// Performs the blocked matrix multiplication of a and b into dest,
+/// see `matrix__matmul_accumulate`. Large products are split by rows of dest across the
+/// thread pool, which doesn't change the order in which cells are accumulated.
+/// Outside of the deterministic mode, products with fewer rows than threads are split
+/// along k instead, and the partial products are added up in a different order.
+MATRIX_DEF void matrix__matmul_blocked(matrix const* a, double const* b_values, size_t b_height,
+                                       size_t b_width, bool packed, size_t block_n, matrix* dest,
+                                       matrix_semiring s) {
+    matrix__matmul_job job = {a, b_values, b_height, b_width, packed, block_n, dest, s, 0, NULL};
+    size_t threads = matrix__parallel_width();
+    if ((double)a->height * a->width * b_width < MATRIX_MATMUL_PARALLEL_THRESHOLD ||
+        threads < 2) {
+        matrix__matmul_rows(&job, 0, a->height);
+        return;
+    }
+
+#ifndef MATRIX_NO_MALLOC
+    size_t k_parts = b_height / matrix__tuning().matmul_block_k;
+    if (!matrix__deterministic && s == MATRIX_SEMIRING_PLUS_TIMES && a->height < threads &&
+        k_parts > 1) {
+        size_t len = matrix_len(dest);
+        job.parts = k_parts < threads ? k_parts : threads;
+        job.partials = matrix__alloc(sizeof(double) * len * (job.parts - 1), false,
+                                     "matmul_partials", dest->height, dest->width);
+        if (job.partials) {
+            matrix__parallel_for(job.parts, 1, matrix__matmul_k_parts, &job);
+            for (size_t part = 1; part < job.parts; ++part)
+                matrix__elementwise(MATRIX__EW_ADD, dest->values, job.partials + (part - 1) * len,
+                                    0.0, NULL, len);
+            matrix__free(job.partials, sizeof(double) * len * (job.parts - 1));
+            return;
+        }
+    }
+#endif  // MATRIX_NO_MALLOC
+
+    matrix__parallel_for(a->height, 1, matrix__matmul_rows, &job);
+}
+
+MATRIX_DEF void matrix_matmul_into(matrix const* a, matrix const* b, matrix* dest) {
+    matrix_matmul_semiring_into(a, b, dest, MATRIX_SEMIRING_PLUS_TIMES);
+}
+
+MATRIX_DEF void matrix_matmul_semiring_into(matrix const* a, matrix const* b, matrix* dest,
+                                            matrix_semiring s) {
+    assert(a && a->values);
+    assert(b && b->values);
+    assert(dest && dest->values);
+    assert(a->width == b->height);
+    assert(dest->height == a->height);
+    assert(dest->width == b->width);
+    MATRIX__OP_BEGIN(MATRIX_OP_MATMUL_SEMIRING_INTO, a->height, a->width);
+    MATRIX__COW_WRITE(dest, false);
+
+    matrix__matmul_blocked(a, b->values, b->height, b->width, false,
+                           matrix__tuning().matmul_block_n, dest, s);
+    MATRIX__OP_END(2.0 * a->height * a->width * b->width,
+                   8.0 * (matrix_len(a) + matrix_len(b) + matrix_len(dest)));
+}
+
+#ifndef MATRIX_NO_MALLOC
+
+MATRIX_DEF matrix_packed matrix_pack_b(matrix const* b) {
+    assert(b && b->values);
+
+    matrix_packed packed;
+    packed.height = b->height;
+    packed.width = b->width;
+    packed.values = matrix__alloc(sizeof(double) * b->height * b->width, false, "matrix_packed",
+                                  b->height, b->width);
+    assert(packed.values);
+
+    matrix_pack_b_into(b, &packed);
+    return packed;
+}
+
+MATRIX_DEF void matrix_packed_del(matrix_packed* m) {
+    assert(m && m->values);
+    matrix__free(m->values, sizeof(double) * m->height * m->width);
+    m->values = NULL;
+}
+
+#endif  // MATRIX_NO_MALLOC
+
+MATRIX_DEF void matrix_pack_b_into(matrix const* b, matrix_packed* dest) {
+    assert(b && b->values);
+    assert(dest && dest->values);
+    assert(dest->height == b->height);
+    assert(dest->width == b->width);
+    MATRIX__OP_BEGIN(MATRIX_OP_PACK_B_INTO, b->height, b->width);
+
+    dest->block_n = matrix__tuning().matmul_block_n;
+
+    for (size_t col = 0; col < b->width; col += dest->block_n) {
+        size_t col_len = b->width - col < dest->block_n ? b->width - col : dest->block_n;
+        double* panel = dest->values + matrix__packed_offset(b->height, 0, col, col_len);
+
+        for (size_t k = 0; k < b->height; ++k)
+            memcpy(panel + k * col_len, b->values + k * b->width + col, sizeof(double) * col_len);
+    }
+    MATRIX__OP_END(0.0, 16.0 * matrix_len(b));
+}
+
+MATRIX_DEF void matrix_matmul_packed(matrix const* a, matrix_packed const* b, matrix* dest) {
+    assert(a && a->values);
+    assert(b && b->values);
+    assert(dest && dest->values);
+    assert(a->width == b->height);
+    assert(dest->height == a->height);
+    assert(dest->width == b->width);
+    MATRIX__OP_BEGIN(MATRIX_OP_MATMUL_PACKED, a->height, a->width);
+    MATRIX__COW_WRITE(dest, false);
+
+    matrix__matmul_blocked(a, b->values, b->height, b->width, true, b->block_n, dest,
+                           MATRIX_SEMIRING_PLUS_TIMES);
+    MATRIX__OP_END(2.0 * a->height * a->width * b->width,
+                   8.0 * (matrix_len(a) + b->height * b->width + matrix_len(dest)));
+}
+
+// Private helpers for the in-place transpose
+
+/// Returns the number with idx'th bit set
+MATRIX_DEF uint64_t matrix__set_bit(uint64_t number, uint64_t idx) {
+    return number | ((uint64_t)1 << idx);
+}
+
+/// Checks whether idx'th bit is set in the number
+MATRIX_DEF bool matrix__has_bit(uint64_t number, uint64_t idx) {
+    return (number & ((uint64_t)1 << idx)) != 0;
+}
+
+/// Sets the idx'th element of the bitset.
+/// Does not check bounds!
+MATRIX_DEF void matrix__bitset_set(uint64_t* bitset, uint64_t idx) {
+    uint64_t h = idx / 64;
+    uint64_t l = idx % 64;
+    bitset[h] |= ((uint64_t)1 << l);
+}
+
+/// Checks the idx'th element of the bitset.
+/// Does not check bounds!
+MATRIX_DEF bool matrix__bitset_has(uint64_t* bitset, uint64_t idx) {
+    uint64_t h = idx / 64;
+    uint64_t l = idx % 64;
+    return (bitset[h] & ((uint64_t)1 << l)) != 0;
+}
+
+MATRIX_DEF void matrix__transpose_rectangle(matrix* m) {
+    size_t size = matrix_len(m) - 1;
+
+    // Initialize the bitset for storing indicies which were already swapped
+    size_t bitset_sz = (size / 64) + 1;
+    uint64_t bitset[bitset_sz];
+    memset(bitset, 0, sizeof(uint64_t) * bitset_sz);
+
+    // Other used attributes
+    size_t i = 1;
+    size_t cycle_begin;
+    size_t next;
+    double temp;
+    double swap_temp;
+
+    while (i < size) {
+        cycle_begin = i;
+        temp = m->values[i];
+
+        do {
+            next = (i * m->height) % size;
+
+            // Swap next with temp
+            swap_temp = m->values[next];
+            m->values[next] = temp;
+            temp = swap_temp;
+
+            matrix__bitset_set(bitset, i);
+            i = next;
+        } while (i != cycle_begin);
+
+        // Find the next cycle
+        for (i = 1; i < size && matrix__bitset_has(bitset, i); ++i);
+    }
+
+    // Swap width and height
+    i = m->height;
+    m->height = m->width;
+    m->width = i;
+}
+
+MATRIX_DEF void matrix__transpose_small_rectangle(matrix* m) {
+    uint64_t swapped_set = 0;
+    size_t size = matrix_len(m) - 1;
+
+    assert(size < 64);
+    swapped_set = matrix__set_bit(swapped_set, 0);
+    swapped_set = matrix__set_bit(swapped_set, size);
+
+    size_t i = 1;
+    size_t cycle_begin;
+    size_t next;
+    double temp;
+    double swap_temp;
+
+    while (i < size) {
+        cycle_begin = i;
+        temp = m->values[i];
+
+        do {
+            next = (i * m->height) % size;
+
+            // Swap next with temp
+            swap_temp = m->values[next];
+            m->values[next] = temp;
+            temp = swap_temp;
+
+            swapped_set = matrix__set_bit(swapped_set, i);
+            i = next;
+        } while (i != cycle_begin);
+
+        // Find the next cycle
+        for (i = 1; i < size && matrix__has_bit(swapped_set, i); ++i);
+    }
+
+    // Swap width and height
+    i = m->height;
+    m->height = m->width;
+    m->width = i;
+}
+
+MATRIX_DEF void matrix__transpose_square(matrix* m) {
+    assert(m->width == m->height);
+    size_t n = m->height;
+    size_t block = matrix__tuning().transpose_block;
+    double temp;
+
+    // Swap (i, j) tiles with (j, i) tiles, so that both stay in the cache
+    for (size_t ii = 0; ii < n; ii += block) {
+        size_t i_end = n - ii < block ? n : ii + block;
+
+        for (size_t jj = ii; jj < n; jj += block) {
+            size_t j_end = n - jj < block ? n : jj + block;
+
+            for (size_t i = ii; i < i_end; ++i) {
+                for (size_t j = jj > i ? jj : i + 1; j < j_end; ++j) {
+                    temp = m->values[i * n + j];
+                    m->values[i * n + j] = m->values[j * n + i];
+                    m->values[j * n + i] = temp;
+                }
+            }
+        }
+    }
+}
+
+MATRIX_DEF void matrix__transpose_single_col_or_row(matrix* m) {
+    assert(m->width == 1 || m->height == 1);
+
+    // Swap width and height
+    int temp = m->height;
+    m->height = m->width;
+    m->width = temp;
+}
+
+MATRIX_DEF void matrix_transpose(matrix* m) {
+    assert(m && m->values);
+    MATRIX__OP_BEGIN(MATRIX_OP_TRANSPOSE, m->height, m->width);
+    MATRIX__COW_WRITE(m, true);
+
+    if (m->width == 1 || m->height == 1)
+        matrix__transpose_single_col_or_row(m);
+    else if (m->width == m->height)
+        matrix__transpose_square(m);
+    else if (matrix_len(m) <= 64)
+        matrix__transpose_small_rectangle(m);
+    else
+        matrix__transpose_rectangle(m);
+    MATRIX__OP_END(0.0, 16.0 * matrix_len(m));
+}
+
+// Autotuning
+
+#ifndef MATRIX_NO_MALLOC
+
+/// Returns the current time in seconds, see `matrix__clock`
+MATRIX_DEF double matrix__seconds(void) {
+    struct timespec ts;
+    matrix__clock(&ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/// Returns the best time (in seconds) out of a few runs of
+/// matrix_matmul_into on the provided matrices with the provided parameters
+MATRIX_DEF double matrix__autotune_matmul(matrix const* a, matrix const* b, matrix* dest,
+                                          matrix_tuning const* t) {
+    matrix_tuning_set(t);
+    double best = INFINITY;
+
+    for (int rep = 0; rep < 3; ++rep) {
+        double start = matrix__seconds();
+        matrix_matmul_into(a, b, dest);
+        double elapsed = matrix__seconds() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    return best;
+}
+
+/// Returns the best time (in seconds) out of a few runs of
+/// matrix_transpose on the provided square matrix with the provided parameters
+MATRIX_DEF double matrix__autotune_transpose(matrix* m, matrix_tuning const* t) {
+    matrix_tuning_set(t);
+    double best = INFINITY;
+
+    for (int rep = 0; rep < 3; ++rep) {
+        double start = matrix__seconds();
+        matrix_transpose(m);
+        double elapsed = matrix__seconds() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    return best;
+}
+
+MATRIX_DEF matrix_tuning matrix_autotune(size_t size) {
+    static size_t const block_k_candidates[] = {32, 64, 128, 256};
+    static size_t const block_n_candidates[] = {64, 128, 256, 512};
+    static size_t const transpose_candidates[] = {8, 16, 32, 64, 128};
+    static size_t const unroll_candidates[] = {1, 2, 4};
+
+    size_t const n = size > 4 ? size : 4;
+    matrix_tuning best = matrix_tuning_get();
+    matrix_tuning t = best;
+
+    // Square and tall-times-wide products
+    matrix square_a = matrix_new_repeated(n, n, 0.5);
+    matrix square_b = matrix_new_repeated(n, n, 0.25);
+    matrix square_dest = matrix_new(n, n);
+    matrix tall_a = matrix_new_repeated(2 * n, n / 4, 0.5);
+    matrix wide_b = matrix_new_repeated(n / 4, 2 * n, 0.25);
+    matrix tall_dest = matrix_new(2 * n, 2 * n);
+
+    double best_time = INFINITY;
+    for (size_t i = 0; i < sizeof(block_k_candidates) / sizeof(size_t); ++i) {
+        for (size_t j = 0; j < sizeof(block_n_candidates) / sizeof(size_t); ++j) {
+            t.matmul_block_k = block_k_candidates[i];
+            t.matmul_block_n = block_n_candidates[j];
+
+            double time = matrix__autotune_matmul(&square_a, &square_b, &square_dest, &t) +
+                          matrix__autotune_matmul(&tall_a, &wide_b, &tall_dest, &t);
+            if (time < best_time) {
+                best_time = time;
+                best.matmul_block_k = t.matmul_block_k;
+                best.matmul_block_n = t.matmul_block_n;
+            }
+        }
+    }
+
+    best_time = INFINITY;
+    t = best;
+    for (size_t i = 0; i < sizeof(unroll_candidates) / sizeof(size_t); ++i) {
+        t.matmul_unroll = unroll_candidates[i];
+
+        double time = matrix__autotune_matmul(&square_a, &square_b, &square_dest, &t) +
+                      matrix__autotune_matmul(&tall_a, &wide_b, &tall_dest, &t);
+        if (time < best_time) {
+            best_time = time;
+            best.matmul_unroll = t.matmul_unroll;
+        }
+    }
+
+    best_time = INFINITY;
+    t = best;
+    for (size_t i = 0; i < sizeof(transpose_candidates) / sizeof(size_t); ++i) {
+        t.transpose_block = transpose_candidates[i];
+
+        double time = matrix__autotune_transpose(&square_a, &t);
+        if (time < best_time) {
+            best_time = time;
+            best.transpose_block = t.transpose_block;
+        }
+    }
+
+    matrix_del(&square_a);
+    matrix_del(&square_b);
+    matrix_del(&square_dest);
+    matrix_del(&tall_a);
+    matrix_del(&wide_b);
+    matrix_del(&tall_dest);
+
+    matrix_tuning_set(&best);
+    return best;
+}
+
+#endif  // MATRIX_NO_MALLOC
+
+// Bit matrices
+
+/// Returns the number of trailing zero bits of a non-zero number
+MATRIX_DEF unsigned matrix__ctz64(uint64_t x) {
+    assert(x);
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(x);
+#else
+    unsigned n = 0;
+    for (; !(x & 1); x >>= 1) ++n;
+    return n;
+#endif
+}
+
+/// Returns the number of set bits of a number
+MATRIX_DEF unsigned matrix__popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_popcountll(x);
+#else
+    unsigned n = 0;
+    for (; x; x &= x - 1) ++n;
+    return n;
+#endif
+}
+
+MATRIX_DEF size_t matrix_bits_row_words(size_t width) {
+    return (width + 63) / 64;
+}
+
+#ifndef MATRIX_NO_MALLOC
+
+MATRIX_DEF matrix_bits matrix_bits_new(size_t height, size_t width) {
+    matrix_bits m;
+    m.height = height;
+    m.width = width;
+    m.words = matrix__alloc(sizeof(uint64_t) * height * matrix_bits_row_words(width), true,
+                            "matrix_bits", height, width);
+    assert(m.words);
+    return m;
+}
+
+MATRIX_DEF matrix_bits matrix_bits_from_matrix(matrix const* m) {
+    assert(m && m->values);
+    matrix_bits b = matrix_bits_new(m->height, m->width);
+    matrix_bits_from_matrix_into(m, &b);
+    return b;
+}
+
+MATRIX_DEF void matrix_bits_del(matrix_bits* m) {
+    assert(m && m->words);
+    matrix__free(m->words, sizeof(uint64_t) * m->height * matrix_bits_row_words(m->width));
+    m->words = NULL;
+}
+
+MATRIX_DEF matrix_bits matrix_bits_matmul(matrix_bits const* a, matrix_bits const* b) {
+    assert(a && a->words);
+    assert(b && b->words);
+    assert(a->width == b->height);
+
+    matrix_bits multiplied = matrix_bits_new(a->height, b->width);
+    matrix_bits_matmul_into(a, b, &multiplied);
+
+    return multiplied;
+}
+
+#endif  // MATRIX_NO_MALLOC
+
+MATRIX_DEF void matrix_bits_from_matrix_into(matrix const* src, matrix_bits* dest) {
+    assert(src && src->values);
+    assert(dest && dest->words);
+    assert(src->height == dest->height);
+    assert(src->width == dest->width);
+
+    size_t row_words = matrix_bits_row_words(dest->width);
+
+    for (size_t row = 0; row < src->height; ++row) {
+        double const* src_row = src->values + row * src->width;
+        uint64_t* dest_row = dest->words + row * row_words;
+
+        for (size_t w = 0; w < row_words; ++w) {
+            size_t col_end = dest->width - w * 64 < 64 ? dest->width : (w + 1) * 64;
+            uint64_t word = 0;
+
+            for (size_t col = w * 64; col < col_end; ++col)
+                word |= (uint64_t)(src_row[col] != 0.0) << (col % 64);
+
+            dest_row[w] = word;
+        }
+    }
+}
+
+MATRIX_DEF void matrix_bits_to_matrix_into(matrix_bits const* src, matrix* dest) {
+    assert(src && src->words);
+    assert(dest && dest->values);
+    assert(src->height == dest->height);
+    assert(src->width == dest->width);
+    MATRIX__COW_WRITE(dest, false);
+
+    size_t row_words = matrix_bits_row_words(src->width);
+
+    for (size_t row = 0; row < src->height; ++row) {
+        uint64_t const* src_row = src->words + row * row_words;
+        double* dest_row = dest->values + row * dest->width;
+
+        for (size_t col = 0; col < src->width; ++col)
+            dest_row[col] = (src_row[col / 64] >> (col % 64)) & 1 ? 1.0 : 0.0;
+    }
+}
+
+MATRIX_DEF bool matrix_bits_get(matrix_bits const* m, size_t row, size_t col) {
+    assert(m && m->words);
+    assert(row < m->height);
+    assert(col < m->width);
+
+    return matrix__bitset_has(m->words + row * matrix_bits_row_words(m->width), col);
+}
+
+MATRIX_DEF void matrix_bits_set(matrix_bits const* m, size_t row, size_t col, bool value) {
+    assert(m && m->words);
+    assert(row < m->height);
+    assert(col < m->width);
+
+    uint64_t* word = m->words + row * matrix_bits_row_words(m->width) + col / 64;
+    uint64_t mask = (uint64_t)1 << (col % 64);
+    *word = value ? *word | mask : *word & ~mask;
+}
+
+MATRIX_DEF size_t matrix_bits_count(matrix_bits const* m) {
+    assert(m && m->words);
+    size_t end = m->height * matrix_bits_row_words(m->width);
+    size_t count = 0;
+
+    for (size_t i = 0; i < end; ++i)
+        count += matrix__popcount64(m->words[i]);
+
+    return count;
+}
+
+MATRIX_DEF void matrix_bits_and(matrix_bits* a, matrix_bits const* b) {
+    assert(a && a->words);
+    assert(b && b->words);
+    assert(a->height == b->height);
+    assert(a->width == b->width);
+    size_t end = a->height * matrix_bits_row_words(a->width);
+
+    for (size_t i = 0; i < end; ++i)
+        a->words[i] &= b->words[i];
+}
+
+MATRIX_DEF void matrix_bits_or(matrix_bits* a, matrix_bits const* b) {
+    assert(a && a->words);
+    assert(b && b->words);
+    assert(a->height == b->height);
+    assert(a->width == b->width);
+    size_t end = a->height * matrix_bits_row_words(a->width);
+
+    for (size_t i = 0; i < end; ++i)
+        a->words[i] |= b->words[i];
+}
+
+MATRIX_DEF void matrix_bits_xor(matrix_bits* a, matrix_bits const* b) {
+    assert(a && a->words);
+    assert(b && b->words);
+    assert(a->height == b->height);
+    assert(a->width == b->width);
+    size_t end = a->height * matrix_bits_row_words(a->width);
+
+    for (size_t i = 0; i < end; ++i)
+        a->words[i] ^= b->words[i];
+}
+
+/// Performs `dest[w] |= src[w]` for every w < len
+MATRIX_DEF void matrix__bits_or_row(uint64_t* restrict dest, uint64_t const* restrict src,
+                                    size_t len) {
+    for (size_t w = 0; w < len; ++w)
+        dest[w] |= src[w];
+}
+
+MATRIX_DEF void matrix_bits_matmul_into(matrix_bits const* a, matrix_bits const* b,
+                                        matrix_bits* dest) {
+    assert(a && a->words);
+    assert(b && b->words);
+    assert(dest && dest->words);
+    assert(a->width == b->height);
+    assert(dest->height == a->height);
+    assert(dest->width == b->width);
+    MATRIX__OP_BEGIN(MATRIX_OP_BITS_MATMUL_INTO, a->height, a->width);
+
+    size_t a_row_words = matrix_bits_row_words(a->width);
+    size_t b_row_words = matrix_bits_row_words(b->width);
+    memset(dest->words, 0, sizeof(uint64_t) * dest->height * b_row_words);
+
+    for (size_t row = 0; row < a->height; ++row) {
+        uint64_t* dest_row = dest->words + row * b_row_words;
+
+        for (size_t w = 0; w < a_row_words; ++w) {
+            // Iterate over set bits only, clearing the lowest one every time
+            for (uint64_t word = a->words[row * a_row_words + w]; word; word &= word - 1) {
+                size_t k = w * 64 + matrix__ctz64(word);
+                matrix__bits_or_row(dest_row, b->words + k * b_row_words, b_row_words);
+            }
+        }
+    }
+    MATRIX__OP_END(0.0, 8.0 * (a->height * a_row_words + (b->height + dest->height) * b_row_words));
+}
+
+MATRIX_DEF void matrix_bits_transitive_closure(matrix_bits* m) {
+    assert(m && m->words);
+    assert(m->height == m->width);
+    MATRIX__OP_BEGIN(MATRIX_OP_BITS_TRANSITIVE_CLOSURE, m->height, m->width);
+
+    size_t row_words = matrix_bits_row_words(m->width);
+
+    for (size_t k = 0; k < m->height; ++k) {
+        uint64_t const* k_row = m->words + k * row_words;
+
+        for (size_t row = 0; row < m->height; ++row) {
+            uint64_t* row_ptr = m->words + row * row_words;
+            if (row != k && matrix__bitset_has(row_ptr, k))
+                matrix__bits_or_row(row_ptr, k_row, row_words);
+        }
+    }
+    MATRIX__OP_END(0.0, 16.0 * m->height * m->height * row_words);
+}
+
+// Structured matrices
+
+MATRIX_DEF size_t matrix_banded_len(matrix_banded const* m) {
+    assert(m);
+    return m->height * (m->lower + m->upper + 1);
+}
+
+MATRIX_DEF size_t matrix_sym_len(matrix_sym const* m) {
+    assert(m);
+    return m->size * (m->size + 1) / 2;
+}
+
+#ifndef MATRIX_NO_MALLOC
+
+MATRIX_DEF matrix_diag matrix_diag_new(size_t size) {
+    matrix_diag m;
+    m.size = size;
+    m.values = matrix__alloc(sizeof(double) * size, true, "matrix_diag", size, size);
+    assert(m.values);
+    return m;
+}
+
+MATRIX_DEF matrix_banded matrix_banded_new(size_t height, size_t width, size_t lower,
+                                           size_t upper) {
+    matrix_banded m;
+    m.height = height;
+    m.width = width;
+    m.lower = lower;
+    m.upper = upper;
+    m.values = matrix__alloc(sizeof(double) * matrix_banded_len(&m), true, "matrix_banded", height,
+                             width);
+    assert(m.values);
+    return m;
+}
+
+MATRIX_DEF matrix_sym matrix_sym_new(size_t size) {
+    matrix_sym m;
+    m.size = size;
+    m.values = matrix__alloc(sizeof(double) * matrix_sym_len(&m), true, "matrix_sym", size, size);
+    assert(m.values);
+    return m;
+}
+
+MATRIX_DEF void matrix_diag_del(matrix_diag* m) {
+    assert(m && m->values);
+    matrix__free(m->values, sizeof(double) * m->size);
+    m->values = NULL;
+}
+
+MATRIX_DEF void matrix_banded_del(matrix_banded* m) {
+    assert(m && m->values);
+    matrix__free(m->values, sizeof(double) * matrix_banded_len(m));
+    m->values = NULL;
+}
+
+MATRIX_DEF void matrix_sym_del(matrix_sym* m) {
+    assert(m && m->values);
+    matrix__free(m->values, sizeof(double) * matrix_sym_len(m));
+    m->values = NULL;
+}
+
+#endif  // MATRIX_NO_MALLOC
+
+/// Returns the first column inside of the band of a particular row
+MATRIX_DEF size_t matrix__banded_col_begin(matrix_banded const* m, size_t row) {
+    size_t begin = row > m->lower ? row - m->lower : 0;
+    return begin < m->width ? begin : m->width;
+}
+
+/// Returns the column after the last one inside of the band of a particular row
+MATRIX_DEF size_t matrix__banded_col_end(matrix_banded const* m, size_t row) {
+    return row + m->upper + 1 < m->width ? row + m->upper + 1 : m->width;
+}
+
+MATRIX_DEF double matrix_banded_get(matrix_banded const* m, size_t row, size_t col) {
+    assert(m && m->values);
+    assert(row < m->height);
+    assert(col < m->width);
+
+    if (col + m->lower < row || col > row + m->upper)
+        return 0.0;
+    return m->values[row * (m->lower + m->upper + 1) + (col + m->lower - row)];
+}
+
+MATRIX_DEF void matrix_banded_set(matrix_banded const* m, size_t row, size_t col, double value) {
+    assert(m && m->values);
+    assert(row < m->height);
+    assert(col < m->width);
+    assert(col + m->lower >= row && col <= row + m->upper);
+
+    m->values[row * (m->lower + m->upper + 1) + (col + m->lower - row)] = value;
+}
+
+MATRIX_DEF double matrix_sym_get(matrix_sym const* m, size_t row, size_t col) {
+    assert(m && m->values);
+    assert(row < m->size);
+    assert(col < m->size);
+
+    if (col > row) {
+        size_t temp = row;
+        row = col;
+        col = temp;
+    }
+    return m->values[row * (row + 1) / 2 + col];
+}
+
+MATRIX_DEF void matrix_sym_set(matrix_sym const* m, size_t row, size_t col, double value) {
+    assert(m && m->values);
+    assert(row < m->size);
+    assert(col < m->size);
+
+    if (col > row) {
+        size_t temp = row;
+        row = col;
+        col = temp;
+    }
+    m->values[row * (row + 1) / 2 + col] = value;
+}
+
+MATRIX_DEF void matrix_diag_from_matrix_into(matrix const* src, matrix_diag* dest) {
+    assert(src && src->values);
+    assert(dest && dest->values);
+    assert(src->height == dest->size);
+    assert(src->width == dest->size);
+
+    for (size_t i = 0; i < dest->size; ++i)
+        dest->values[i] = src->values[i * src->width + i];
+}
+
+MATRIX_DEF void matrix_banded_from_matrix_into(matrix const* src, matrix_banded* dest) {
+    assert(src && src->values);
+    assert(dest && dest->values);
+    assert(src->height == dest->height);
+    assert(src->width == dest->width);
+
+    memset(dest->values, 0, sizeof(double) * matrix_banded_len(dest));
+
+    for (size_t row = 0; row < dest->height; ++row) {
+        size_t col_end = matrix__banded_col_end(dest, row);
+        for (size_t col = matrix__banded_col_begin(dest, row); col < col_end; ++col)
+            matrix_banded_set(dest, row, col, src->values[row * src->width + col]);
+    }
+}
+
+MATRIX_DEF void matrix_sym_from_matrix_into(matrix const* src, matrix_sym* dest) {
+    assert(src && src->values);
+    assert(dest && dest->values);
+    assert(src->height == dest->size);
+    assert(src->width == dest->size);
+
+    double* packed = dest->values;
+    for (size_t row = 0; row < dest->size; ++row) {
+        for (size_t col = 0; col <= row; ++col)
+            *packed++ = src->values[row * src->width + col];
+    }
+}
+
+MATRIX_DEF void matrix_diag_to_matrix_into(matrix_diag const* src, matrix* dest) {
+    assert(src && src->values);
+    assert(dest && dest->values);
+    assert(dest->height == src->size);
+    assert(dest->width == src->size);
+    MATRIX__COW_WRITE(dest, false);
+
+    matrix_fill_scalar(dest, 0.0);
+    for (size_t i = 0; i < src->size; ++i)
+        dest->values[i * dest->width + i] = src->values[i];
+}
+
+MATRIX_DEF void matrix_banded_to_matrix_into(matrix_banded const* src, matrix* dest) {
+    assert(src && src->values);
+    assert(dest && dest->values);
+    assert(dest->height == src->height);
+    assert(dest->width == src->width);
+    MATRIX__COW_WRITE(dest, false);
+
+    matrix_fill_scalar(dest, 0.0);
+    for (size_t row = 0; row < src->height; ++row) {
+        size_t col_end = matrix__banded_col_end(src, row);
+        for (size_t col = matrix__banded_col_begin(src, row); col < col_end; ++col)
+            dest->values[row * dest->width + col] = matrix_banded_get(src, row, col);
+    }
+}
+
+MATRIX_DEF void matrix_sym_to_matrix_into(matrix_sym const* src, matrix* dest) {
+    assert(src && src->values);
+    assert(dest && dest->values);
+    assert(dest->height == src->size);
+    assert(dest->width == src->size);
+    MATRIX__COW_WRITE(dest, false);
+
+    double const* packed = src->values;
+    for (size_t row = 0; row < src->size; ++row) {
+        for (size_t col = 0; col <= row; ++col, ++packed) {
+            dest->values[row * dest->width + col] = *packed;
+            dest->values[col * dest->width + row] = *packed;
+        }
+    }
+}
+
+MATRIX_DEF void matrix_diag_matmul_into(matrix_diag const* a, matrix const* b, matrix* dest) {
+    assert(a && a->values);
+    assert(b && b->values);
+    assert(dest && dest->values);
+    assert(a->size == b->height);
+    assert(dest->height == b->height);
+    assert(dest->width == b->width);
+    MATRIX__OP_BEGIN(MATRIX_OP_DIAG_MATMUL_INTO, a->size, a->size);
+    MATRIX__COW_WRITE(dest, false);
+
+    for (size_t row = 0; row < b->height; ++row) {
+        double d = a->values[row];
+        for (size_t col = 0; col < b->width; ++col)
+            dest->values[row * dest->width + col] = d * b->values[row * b->width + col];
+    }
+    MATRIX__OP_END((double)matrix_len(b), 8.0 * (a->size + matrix_len(b) + matrix_len(dest)));
+}
+
+MATRIX_DEF void matrix_banded_matmul_into(matrix_banded const* a, matrix const* b, matrix* dest) {
+    assert(a && a->values);
+    assert(b && b->values);
+    assert(dest && dest->values);
+    assert(a->width == b->height);
+    assert(dest->height == a->height);
+    assert(dest->width == b->width);
+    MATRIX__OP_BEGIN(MATRIX_OP_BANDED_MATMUL_INTO, a->height, a->width);
+    MATRIX__COW_WRITE(dest, false);
+
+    matrix_fill_scalar(dest, 0.0);
+
+    for (size_t row = 0; row < a->height; ++row) {
+        double* dest_row = dest->values + row * dest->width;
+        size_t k_end = matrix__banded_col_end(a, row);
+
+        for (size_t k = matrix__banded_col_begin(a, row); k < k_end; ++k)
+            matrix__semiring_axpy(MATRIX_SEMIRING_PLUS_TIMES, matrix_banded_get(a, row, k),
+                                  b->values + k * b->width, dest_row, b->width);
+    }
+    MATRIX__OP_END(2.0 * matrix_banded_len(a) * b->width,
+                   8.0 * (matrix_banded_len(a) + matrix_len(b) + matrix_len(dest)));
+}
+
+MATRIX_DEF void matrix_sym_matmul_into(matrix_sym const* a, matrix const* b, matrix* dest) {
+    assert(a && a->values);
+    assert(b && b->values);
+    assert(dest && dest->values);
+    assert(a->size == b->height);
+    assert(dest->height == b->height);
+    assert(dest->width == b->width);
+    MATRIX__OP_BEGIN(MATRIX_OP_SYM_MATMUL_INTO, a->size, a->size);
+    MATRIX__COW_WRITE(dest, false);
+
+    matrix_fill_scalar(dest, 0.0);
+
+    // Every stored a_ij (i > j) contributes to both dest row i and dest row j
+    double const* packed = a->values;
+    for (size_t row = 0; row < a->size; ++row) {
+        double* dest_row = dest->values + row * dest->width;
+
+        for (size_t col = 0; col < row; ++col, ++packed) {
+            matrix__semiring_axpy(MATRIX_SEMIRING_PLUS_TIMES, *packed, b->values + col * b->width,
+                                  dest_row, b->width);
+            matrix__semiring_axpy(MATRIX_SEMIRING_PLUS_TIMES, *packed, b->values + row * b->width,
+                                  dest->values + col * dest->width, b->width);
+        }
+
+        matrix__semiring_axpy(MATRIX_SEMIRING_PLUS_TIMES, *packed++, b->values + row * b->width,
+                              dest_row, b->width);
+    }
+    MATRIX__OP_END(2.0 * a->size * a->size * b->width,
+                   8.0 * (matrix_sym_len(a) + matrix_len(b) + matrix_len(dest)));
+}
+
+MATRIX_DEF void matrix_tridiag_solve(matrix_banded const* a, matrix* b, double* scratch) {
+    assert(a && a->values);
+    assert(b && b->values);
+    assert(scratch);
+    assert(a->height == a->width);
+    assert(a->lower == 1 && a->upper == 1);
+    assert(a->height == b->height);
+
+    size_t n = a->height;
+    if (n == 0)
+        return;
+
+    MATRIX__OP_BEGIN(MATRIX_OP_TRIDIAG_SOLVE, b->height, b->width);
+    MATRIX__COW_WRITE(b, true);
+
+    // Row i of a is stored as {sub_i, diag_i, super_i}
+    double const* t = a->values;
+    double* c = scratch;  // Modified super-diagonal
+
+    // Forward sweep
+    double denom = t[1];
+    c[0] = t[2] / denom;
+    for (size_t col = 0; col < b->width; ++col)
+        b->values[col] /= denom;
+
+    for (size_t i = 1; i < n; ++i) {
+        double sub = t[i * 3];
+        denom = t[i * 3 + 1] - sub * c[i - 1];
+        c[i] = t[i * 3 + 2] / denom;
+
+        double* row = b->values + i * b->width;
+        double const* prev_row = row - b->width;
+        for (size_t col = 0; col < b->width; ++col)
+            row[col] = (row[col] - sub * prev_row[col]) / denom;
+    }
+
+    // Back substitution
+    for (size_t i = n - 1; i-- > 0;) {
+        double* row = b->values + i * b->width;
+        double const* next_row = row + b->width;
+        for (size_t col = 0; col < b->width; ++col)
+            row[col] -= c[i] * next_row[col];
+    }
+    MATRIX__OP_END(5.0 * matrix_len(b), 8.0 * (3 * n + 2 * matrix_len(b)));
+}
+
+// Kronecker products
+
+#ifndef MATRIX_NO_MALLOC
+
+MATRIX_DEF matrix matrix_kron(matrix const* a, matrix const* b) {
+    assert(a && a->values);
+    assert(b && b->values);
+
+    matrix product = matrix_new(a->height * b->height, a->width * b->width);
+    matrix_kron_into(a, b, &product);
+
+    return product;
+}
+
+#endif  // MATRIX_NO_MALLOC
+
+MATRIX_DEF void matrix_kron_into(matrix const* a, matrix const* b, matrix* dest) {
+    assert(a && a->values);
+    assert(b && b->values);
+    assert(dest && dest->values);
+    assert(dest->height == a->height * b->height);
+    assert(dest->width == a->width * b->width);
+    MATRIX__OP_BEGIN(MATRIX_OP_KRON_INTO, a->height, a->width);
+    MATRIX__COW_WRITE(dest, false);
+
+    for (size_t i = 0; i < a->height; ++i) {
+        for (size_t p = 0; p < b->height; ++p) {
+            double* dest_row = dest->values + (i * b->height + p) * dest->width;
+            double const* b_row = b->values + p * b->width;
+
+            for (size_t j = 0; j < a->width; ++j) {
+                double x = a->values[i * a->width + j];
+                for (size_t q = 0; q < b->width; ++q)
+                    dest_row[j * b->width + q] = x * b_row[q];
+            }
+        }
+    }
+    MATRIX__OP_END((double)matrix_len(dest),
+                   8.0 * (matrix_len(a) + matrix_len(b) + matrix_len(dest)));
+}
+
+MATRIX_DEF size_t matrix_kron_scratch_len(matrix_kron_op const* op) {
+    assert(op && op->a && op->b);
+    return op->a->width * op->b->height;
+}
+
+MATRIX_DEF void matrix_kron_matvec(matrix_kron_op const* op, double const* x, double* y,
+                                   double* scratch) {
+    assert(op && op->a && op->a->values);
+    assert(op->b && op->b->values);
+    assert(x && y && scratch);
+
+    matrix const* a = op->a;
+    matrix const* b = op->b;
+    MATRIX__OP_BEGIN(MATRIX_OP_KRON_MATVEC, a->height, a->width);
+
+    // t = X * Bᵀ, so that t_jp is the dot product of rows X_j and B_p
+    for (size_t j = 0; j < a->width; ++j) {
+        double const* x_row = x + j * b->width;
+
+        for (size_t p = 0; p < b->height; ++p) {
+            double const* b_row = b->values + p * b->width;
+            double sum = 0.0;
+
+            for (size_t q = 0; q < b->width; ++q)
+                sum += x_row[q] * b_row[q];
+
+            scratch[j * b->height + p] = sum;
+        }
+    }
+
+    // Y = A * t. y and scratch are raw buffers, so this skips the copy-on-write checks
+    // of matrix_matmul_into - they'd treat y_matrix as a sharer of y if y is a shared buffer
+    matrix t = {a->width, b->height, scratch};
+    matrix y_matrix = {a->height, b->height, y};
+    matrix__matmul_blocked(a, t.values, t.height, t.width, false,
+                           matrix__tuning().matmul_block_n, &y_matrix, MATRIX_SEMIRING_PLUS_TIMES);
+    MATRIX__OP_END(2.0 * (a->width * b->width + a->height * a->width) * b->height,
+                   8.0 * (matrix_len(a) + matrix_len(b) + matrix_len(&t) + matrix_len(&y_matrix)));
+}
+
+// Matrix files and out-of-core multiplication
+
+#define MATRIX__FILE_MAGIC "MATRIX01"
+#define MATRIX__FILE_HEADER_LEN 32
+
+/// Reads and validates the header of a matrix file
+MATRIX_DEF bool matrix__file_read_header(FILE* f, size_t* height, size_t* width) {
+    char magic[8];
+    uint64_t shape[3];
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+        memcmp(magic, MATRIX__FILE_MAGIC, sizeof(magic)) != 0 ||
+        fread(shape, sizeof(uint64_t), 3, f) != 3)
+        return false;
+
+    *height = (size_t)shape[0];
+    *width = (size_t)shape[1];
+    return true;
+}
+
+/// Writes the header of a matrix file
+MATRIX_DEF bool matrix__file_write_header(FILE* f, size_t height, size_t width) {
+    uint64_t shape[3] = {height, width, 0};
+    return fwrite(MATRIX__FILE_MAGIC, 1, 8, f) == 8 && fwrite(shape, sizeof(uint64_t), 3, f) == 3;
+}
+
+/// Moves to a byte offset of a file. Offsets may not fit in a long
+/// (past 2 GiB with 32-bit longs), so the widest seek available is used.
+MATRIX_DEF bool matrix__file_seek(FILE* f, uint64_t offset) {
+#if defined(_WIN32)
+    return offset <= INT64_MAX && _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#elif defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200112L
+    // off_t is 32-bit on ILP32 systems, unless compiled with -D_FILE_OFFSET_BITS=64
+    uint64_t max = sizeof(off_t) >= 8 ? INT64_MAX : INT32_MAX;
+    return offset <= max && fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#else
+    // Plain C only has fseek, so move in steps of at most LONG_MAX bytes
+    if (fseek(f, 0, SEEK_SET))
+        return false;
+    for (; offset > LONG_MAX; offset -= LONG_MAX) {
+        if (fseek(f, LONG_MAX, SEEK_CUR))
+            return false;
+    }
+    return fseek(f, (long)offset, SEEK_CUR) == 0;
+#endif
+}
+
+/// Returns the byte offset of the (row, col) cell of a matrix file with the provided width
+MATRIX_DEF uint64_t matrix__file_offset(size_t width, size_t row, size_t col) {
+    return MATRIX__FILE_HEADER_LEN + sizeof(double) * ((uint64_t)row * width + col);
+}
+
+/// Reads `rows x cols` cells starting at (row, col) of a matrix file with the provided width
+/// into the row-major array `out`
+MATRIX_DEF bool matrix__file_read_block(FILE* f, size_t width, size_t row, size_t col,
+                                        size_t rows, size_t cols, double* out) {
+    for (size_t r = 0; r < rows; ++r) {
+        if (!matrix__file_seek(f, matrix__file_offset(width, row + r, col)) ||
+            fread(out + r * cols, sizeof(double), cols, f) != cols)
+            return false;
+    }
+    return true;
+}
+
+/// Writes the row-major array `in` of `rows x cols` cells at (row, col) of a matrix file
+/// with the provided width
+MATRIX_DEF bool matrix__file_write_block(FILE* f, size_t width, size_t row, size_t col,
+                                         size_t rows, size_t cols, double const* in) {
+    for (size_t r = 0; r < rows; ++r) {
+        if (!matrix__file_seek(f, matrix__file_offset(width, row + r, col)) ||
+            fwrite(in + r * cols, sizeof(double), cols, f) != cols)
+            return false;
+    }
+    return true;
+}
+
+MATRIX_DEF bool matrix_save(matrix const* m, char const* path) {
+    assert(m && m->values);
+    assert(path);
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return false;
 
-    for (size_t i = 0; i < end; ++i) {
-        m->values[i] = func(m->values[i]);
+    size_t len = matrix_len(m);
+    bool ok = matrix__file_write_header(f, m->height, m->width) &&
+              fwrite(m->values, sizeof(double), len, f) == len;
+    return fclose(f) == 0 && ok;
+}
+
+MATRIX_DEF bool matrix_file_shape(char const* path, size_t* height, size_t* width) {
+    assert(path && height && width);
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return false;
+
+    bool ok = matrix__file_read_header(f, height, width);
+    fclose(f);
+    return ok;
+}
+
+MATRIX_DEF bool matrix_load_into(char const* path, matrix* dest) {
+    assert(path);
+    assert(dest && dest->values);
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return false;
+
+    size_t height, width;
+    size_t len = matrix_len(dest);
+    bool ok = matrix__file_read_header(f, &height, &width) && height == dest->height &&
+              width == dest->width;
+    if (ok) {
+        MATRIX__COW_WRITE(dest, false);
+        ok = fread(dest->values, sizeof(double), len, f) == len;
     }
+    fclose(f);
+    return ok;
 }
 
 #ifndef MATRIX_NO_MALLOC
 
-MATRIX_DEF matrix matrix_matmul(matrix const* a, matrix const* b) {
-    assert(a && a->values);
-    assert(b && b->values);
-    assert(a->width == b->height);
+MATRIX_DEF matrix matrix_load(char const* path) {
+    size_t height, width;
+    matrix m = {0, 0, NULL};
+    if (!matrix_file_shape(path, &height, &width))
+        return m;
 
-    matrix multiplied = matrix_new(a->height, b->width);
-    matrix_matmul_into(a, b, &multiplied);
+    m = matrix_new(height, width);
+    if (m.values && !matrix_load_into(path, &m))
+        matrix_del(&m);
+    return m;
+}
 
-    return multiplied;
+/// Tiles of a and b used by a single step of `matrix_matmul_ooc`
+typedef struct {
+    FILE* a_file;
+    FILE* b_file;
+    size_t a_width;
+    size_t b_width;
+    size_t row, k, col;
+    size_t rows, ks, cols;
+    double* a_tile;
+    double* b_tile;
+    bool ok;
+} matrix__ooc_step;
+
+/// Sets the position of a step from its index, see `matrix_matmul_ooc`
+MATRIX_DEF void matrix__ooc_locate(matrix__ooc_step* step, size_t index, size_t tile_n,
+                                   size_t tile_m, size_t tile_p, size_t n, size_t m, size_t p) {
+    size_t k_tiles = m ? (m + tile_m - 1) / tile_m : 1;
+    size_t col_tiles = (p + tile_p - 1) / tile_p;
+
+    step->k = index % k_tiles * tile_m;
+    step->col = index / k_tiles % col_tiles * tile_p;
+    step->row = index / k_tiles / col_tiles * tile_n;
+    step->ks = m - step->k < tile_m ? m - step->k : tile_m;
+    step->cols = p - step->col < tile_p ? p - step->col : tile_p;
+    step->rows = n - step->row < tile_n ? n - step->row : tile_n;
 }
 
-#endif  // MATRIX_NO_MALLOC
+/// Reads the tiles of a step
+MATRIX_DEF void matrix__ooc_read(matrix__ooc_step* step) {
+    step->ok = matrix__file_read_block(step->a_file, step->a_width, step->row, step->k,
+                                       step->rows, step->ks, step->a_tile) &&
+               matrix__file_read_block(step->b_file, step->b_width, step->k, step->col,
+                                       step->ks, step->cols, step->b_tile);
+}
 
-MATRIX_DEF void matrix_matmul_into(matrix const* a, matrix const* b, matrix* dest) {
-    assert(a && a->values);
-    assert(b && b->values);
-    assert(dest && dest->values);
-    assert(a->width == b->height);
-    assert(dest->height == a->height);
-    assert(dest->width == b->width);
+#ifdef MATRIX_THREADS
 
-    size_t common_len = a->width;
+/// Thread reading the tiles of the next step while the current one is multiplied,
+/// started once for the whole `matrix_matmul_ooc` call
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    matrix__ooc_step* pending;  // step being read, NULL when idle
+    bool stop;
+} matrix__ooc_reader;
 
-    for (size_t row = 0; row < dest->height; ++row) {
-        for (size_t col = 0; col < dest->width; ++col) {
-            size_t field = row * dest->width + col;
-            dest->values[field] = 0.0;
+static void* matrix__ooc_reader_main(void* arg) {
+    matrix__ooc_reader* reader = arg;
 
-            for (size_t i = 0; i < common_len; ++i) {
-                dest->values[field] += matrix_get(a, row, i) * matrix_get(b, i, col);
-            }
+    pthread_mutex_lock(&reader->lock);
+    for (;;) {
+        while (!reader->pending && !reader->stop)
+            pthread_cond_wait(&reader->wake, &reader->lock);
+        if (!reader->pending)
+            break;
+
+        matrix__ooc_step* step = reader->pending;
+        pthread_mutex_unlock(&reader->lock);
+        matrix__ooc_read(step);
+        pthread_mutex_lock(&reader->lock);
+
+        reader->pending = NULL;
+        pthread_cond_broadcast(&reader->wake);
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return NULL;
+}
+
+/// Starts the reader thread. Returns false if it couldn't be started.
+MATRIX_DEF bool matrix__ooc_reader_start(matrix__ooc_reader* reader) {
+    reader->pending = NULL;
+    reader->stop = false;
+    if (pthread_mutex_init(&reader->lock, NULL))
+        return false;
+    if (pthread_cond_init(&reader->wake, NULL)) {
+        pthread_mutex_destroy(&reader->lock);
+        return false;
+    }
+    if (pthread_create(&reader->thread, NULL, matrix__ooc_reader_main, reader)) {
+        pthread_cond_destroy(&reader->wake);
+        pthread_mutex_destroy(&reader->lock);
+        return false;
+    }
+    return true;
+}
+
+/// Makes the reader thread read the tiles of a step
+MATRIX_DEF void matrix__ooc_reader_submit(matrix__ooc_reader* reader, matrix__ooc_step* step) {
+    pthread_mutex_lock(&reader->lock);
+    reader->pending = step;
+    pthread_cond_broadcast(&reader->wake);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+/// Waits until the reader thread has read the last submitted step
+MATRIX_DEF void matrix__ooc_reader_wait(matrix__ooc_reader* reader) {
+    pthread_mutex_lock(&reader->lock);
+    while (reader->pending)
+        pthread_cond_wait(&reader->wake, &reader->lock);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+/// Stops and joins the reader thread
+MATRIX_DEF void matrix__ooc_reader_stop(matrix__ooc_reader* reader) {
+    pthread_mutex_lock(&reader->lock);
+    reader->stop = true;
+    pthread_cond_broadcast(&reader->wake);
+    pthread_mutex_unlock(&reader->lock);
+
+    pthread_join(reader->thread, NULL);
+    pthread_cond_destroy(&reader->wake);
+    pthread_mutex_destroy(&reader->lock);
+}
+
+#endif  // MATRIX_THREADS
+
+MATRIX_DEF bool matrix_matmul_ooc(char const* a_path, char const* b_path, char const* dest_path,
+                                  size_t memory_budget) {
+    assert(a_path && b_path && dest_path);
+    FILE* a_file = fopen(a_path, "rb");
+    FILE* b_file = fopen(b_path, "rb");
+    FILE* dest_file = fopen(dest_path, "wb");
+    double* buffer = NULL;
+    size_t buffer_bytes = 0;
+
+    size_t n = 0, m = 0, m2 = 0, p = 0;
+    bool ok = a_file && b_file && dest_file && matrix__file_read_header(a_file, &n, &m) &&
+              matrix__file_read_header(b_file, &m2, &p) && m == m2 &&
+              matrix__file_write_header(dest_file, n, p);
+    MATRIX__OP_BEGIN(MATRIX_OP_MATMUL_OOC, n, m);
+
+    // Square tiles of up to t x t cells: one of dest, and two (current and next) of each of a and b
+    size_t t = (size_t)sqrt((double)(memory_budget / sizeof(double) / 5));
+    size_t tile_n = n < t ? n : t;
+    size_t tile_m = m < t ? m : t;
+    size_t tile_p = p < t ? p : t;
+    ok = ok && t > 0;
+
+    size_t a_len = tile_n * tile_m;
+    size_t b_len = tile_m * tile_p;
+    if (ok && n && p) {
+        buffer_bytes = sizeof(double) * (tile_n * tile_p + 2 * (a_len + b_len));
+        buffer = matrix__alloc(buffer_bytes, false, "matrix_ooc", t, t);
+        ok = buffer != NULL;
+    }
+
+    if (ok && n && p) {
+        double* dest_tile = buffer;
+        matrix__ooc_step steps[2];
+        for (size_t i = 0; i < 2; ++i) {
+            double* tiles = buffer + tile_n * tile_p + i * (a_len + b_len);
+            steps[i] = (matrix__ooc_step){
+                a_file, b_file, m, p, 0, 0, 0, 0, 0, 0, tiles, tiles + a_len, true};
+        }
+
+        // Steps go over k tiles for every dest tile, so that every dest tile
+        // is finished (and written) before moving on to the next one
+        size_t row_tiles = (n + tile_n - 1) / tile_n;
+        size_t col_tiles = (p + tile_p - 1) / tile_p;
+        size_t k_tiles = m ? (m + tile_m - 1) / tile_m : 1;
+        size_t step_count = row_tiles * col_tiles * k_tiles;
+
+        matrix__ooc_locate(&steps[0], 0, tile_n, tile_m, tile_p, n, m, p);
+        matrix__ooc_read(&steps[0]);
+        ok = steps[0].ok;
+
+#ifdef MATRIX_THREADS
+        matrix__ooc_reader reader;
+        bool read_ahead = step_count > 1 && matrix__ooc_reader_start(&reader);
+#else
+        bool read_ahead = false;
+#endif
+
+        for (size_t s = 0; ok && s < step_count; ++s) {
+            matrix__ooc_step* cur = &steps[s % 2];
+            matrix__ooc_step* next = &steps[(s + 1) % 2];
+            bool has_next = s + 1 < step_count;
+            if (has_next)
+                matrix__ooc_locate(next, s + 1, tile_n, tile_m, tile_p, n, m, p);
+#ifdef MATRIX_THREADS
+            if (has_next && read_ahead)
+                matrix__ooc_reader_submit(&reader, next);
+#endif
+
+            matrix a_tile = {cur->rows, cur->ks, cur->a_tile};
+            matrix dest = {cur->rows, cur->cols, dest_tile};
+            if (cur->k == 0)
+                matrix__elementwise(MATRIX__EW_FILL, dest_tile, NULL, 0.0, NULL,
+                                    matrix_len(&dest));
+            matrix__matmul_accumulate(&a_tile, cur->b_tile, cur->ks, cur->cols, false,
+                                      matrix__tuning().matmul_block_n, &dest,
+                                      MATRIX_SEMIRING_PLUS_TIMES);
+            if (cur->k + cur->ks >= m)
+                ok = matrix__file_write_block(dest_file, p, cur->row, cur->col, cur->rows,
+                                              cur->cols, dest_tile);
+
+#ifdef MATRIX_THREADS
+            if (has_next && read_ahead)
+                matrix__ooc_reader_wait(&reader);
+#endif
+            if (has_next && !read_ahead)
+                matrix__ooc_read(next);
+            ok = ok && (!has_next || next->ok);
         }
+
+#ifdef MATRIX_THREADS
+        if (read_ahead)
+            matrix__ooc_reader_stop(&reader);
+#endif
     }
+
+    if (buffer)
+        matrix__free(buffer, buffer_bytes);
+    MATRIX__OP_END(2.0 * n * m * p, 8.0 * (n * m + m * p + n * p));
+
+    if (a_file)
+        fclose(a_file);
+    if (b_file)
+        fclose(b_file);
+    if (dest_file && fclose(dest_file))
+        ok = false;
+    return ok;
 }
 
-// Private helpers for the in-place transpose
+#endif  // MATRIX_NO_MALLOC
 
-/// Returns the number with idx'th bit set
-MATRIX_DEF uint64_t matrix__set_bit(uint64_t number, uint64_t idx) {
-    return number | ((uint64_t)1 << idx);
+#ifdef MATRIX_MMAP
+
+/// Returns the length of the mapping of a matrix file with the provided shape
+MATRIX_DEF size_t matrix__mapped_len(size_t height, size_t width) {
+    return MATRIX__FILE_HEADER_LEN + sizeof(double) * height * width;
 }
 
-/// Checks whether idx'th bit is set in the number
-MATRIX_DEF bool matrix__has_bit(uint64_t number, uint64_t idx) {
-    return (number & ((uint64_t)1 << idx)) != 0;
+/// Maps the matrix file (or shared memory object) open as fd, which must hold
+/// a matrix of the provided shape. If `create` is set and the file is empty,
+/// it's first filled with a zeroed matrix of that shape.
+MATRIX_DEF matrix matrix__map_fd(int fd, size_t height, size_t width, int prot, int flags,
+                                 bool create) {
+    matrix m = {height, width, NULL};
+    size_t len = matrix__mapped_len(height, width);
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok && st.st_size == 0 && create) {
+        char header[MATRIX__FILE_HEADER_LEN] = {0};
+        uint64_t shape[2] = {height, width};
+        memcpy(header, MATRIX__FILE_MAGIC, 8);
+        memcpy(header + 8, shape, sizeof(shape));
+        ok = write(fd, header, sizeof(header)) == (ssize_t)sizeof(header) &&
+             ftruncate(fd, (off_t)len) == 0 && fstat(fd, &st) == 0;
+    }
+    ok = ok && (size_t)st.st_size >= len;
+
+    char* base = ok ? mmap(NULL, len, prot, flags, fd, 0) : MAP_FAILED;
+    if (base == MAP_FAILED)
+        return m;
+
+    uint64_t shape[2];
+    memcpy(shape, base + 8, sizeof(shape));
+    if (memcmp(base, MATRIX__FILE_MAGIC, 8) != 0 || shape[0] != height || shape[1] != width) {
+        munmap(base, len);
+        return m;
+    }
+
+    m.values = (double*)(base + MATRIX__FILE_HEADER_LEN);
+    return m;
 }
 
-/// Sets the idx'th element of the bitset.
-/// Does not check bounds!
-MATRIX_DEF void matrix__bitset_set(uint64_t* bitset, uint64_t idx) {
-    uint64_t h = idx / 64;
-    uint64_t l = idx % 64;
-    bitset[h] |= ((uint64_t)1 << l);
+MATRIX_DEF matrix matrix_open_mapped(char const* path, size_t height, size_t width,
+                                     matrix_map_mode mode) {
+    assert(path);
+    int fd = open(path, mode == MATRIX_MAP_SHARED ? O_RDWR | O_CREAT : O_RDONLY, 0666);
+    if (fd < 0)
+        return (matrix){height, width, NULL};
+
+    int prot = mode == MATRIX_MAP_READ ? PROT_READ : PROT_READ | PROT_WRITE;
+    int flags = mode == MATRIX_MAP_SNAPSHOT ? MAP_PRIVATE : MAP_SHARED;
+    matrix m = matrix__map_fd(fd, height, width, prot, flags, mode == MATRIX_MAP_SHARED);
+    close(fd);
+    return m;
 }
 
-/// Checks the idx'th element of the bitset.
-/// Does not check bounds!
-MATRIX_DEF bool matrix__bitset_has(uint64_t* bitset, uint64_t idx) {
-    uint64_t h = idx / 64;
-    uint64_t l = idx % 64;
-    return (bitset[h] & ((uint64_t)1 << l)) != 0;
+MATRIX_DEF bool matrix_sync(matrix const* m) {
+    assert(m && m->values);
+    char* base = (char*)m->values - MATRIX__FILE_HEADER_LEN;
+    return msync(base, matrix__mapped_len(m->height, m->width), MS_SYNC) == 0;
 }
 
-MATRIX_DEF void matrix__transpose_rectangle(matrix* m) {
-    size_t size = matrix_len(m) - 1;
+MATRIX_DEF void matrix_close_mapped(matrix* m) {
+    assert(m && m->values);
+    char* base = (char*)m->values - MATRIX__FILE_HEADER_LEN;
+    munmap(base, matrix__mapped_len(m->height, m->width));
+    m->values = NULL;
+}
 
-    // Initialize the bitset for storing indicies which were already swapped
-    size_t bitset_sz = (size / 64) + 1;
-    uint64_t bitset[bitset_sz];
-    memset(bitset, 0, sizeof(uint64_t) * bitset_sz);
+#ifdef MATRIX_SHM
 
-    // Other used attributes
-    size_t i = 1;
-    size_t cycle_begin;
-    size_t next;
-    double temp;
-    double swap_temp;
+MATRIX_DEF matrix matrix_shm_create(char const* name, size_t height, size_t width) {
+    assert(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return (matrix){height, width, NULL};
 
-    while (i < size) {
-        cycle_begin = i;
-        temp = m->values[i];
+    matrix m = matrix__map_fd(fd, height, width, PROT_READ | PROT_WRITE, MAP_SHARED, true);
+    close(fd);
+    if (!m.values)
+        shm_unlink(name);
+    return m;
+}
 
-        do {
-            next = (i * m->height) % size;
+MATRIX_DEF matrix matrix_shm_attach(char const* name, size_t height, size_t width,
+                                    bool writable) {
+    assert(name);
+    int fd = shm_open(name, writable ? O_RDWR : O_RDONLY, 0);
+    if (fd < 0)
+        return (matrix){height, width, NULL};
 
-            // Swap next with temp
-            swap_temp = m->values[next];
-            m->values[next] = temp;
-            temp = swap_temp;
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    matrix m = matrix__map_fd(fd, height, width, prot, MAP_SHARED, false);
+    close(fd);
+    return m;
+}
 
-            matrix__bitset_set(bitset, i);
-            i = next;
-        } while (i != cycle_begin);
+MATRIX_DEF void matrix_shm_detach(matrix* m) {
+    matrix_close_mapped(m);
+}
 
-        // Find the next cycle
-        for (i = 1; i < size && matrix__bitset_has(bitset, i); ++i);
+MATRIX_DEF bool matrix_shm_unlink(char const* name) {
+    assert(name);
+    return shm_unlink(name) == 0;
+}
+
+#endif  // MATRIX_SHM
+
+#endif  // MATRIX_MMAP
+
+// Distributed multiplication
+
+#if defined(MATRIX_DIST) && !defined(MATRIX_NO_MALLOC)
+
+/// State of a `matrix_socket_mesh` transport: a socket connected to every other rank
+/// (-1 for the current one), and in rank 0, the worker processes
+typedef struct {
+    int* fds;
+    pid_t* workers;
+} matrix__socket_mesh;
+
+static bool matrix__socket_send(matrix_transport* t, size_t to, void const* data, size_t len) {
+    matrix__socket_mesh* mesh = t->user;
+    char const* bytes = data;
+#ifdef MSG_NOSIGNAL
+    int flags = MSG_NOSIGNAL;
+#else
+    int flags = 0;
+#endif
+    while (len) {
+        ssize_t sent = send(mesh->fds[to], bytes, len, flags);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        len -= (size_t)sent;
     }
+    return true;
+}
 
-    // Swap width and height
-    i = m->height;
-    m->height = m->width;
-    m->width = i;
+static bool matrix__socket_recv(matrix_transport* t, size_t from, void* data, size_t len) {
+    matrix__socket_mesh* mesh = t->user;
+    char* bytes = data;
+    while (len) {
+        ssize_t received = recv(mesh->fds[from], bytes, len, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        bytes += received;
+        len -= (size_t)received;
+    }
+    return true;
 }
 
-MATRIX_DEF void matrix__transpose_small_rectangle(matrix* m) {
-    uint64_t swapped_set = 0;
-    size_t size = matrix_len(m) - 1;
+MATRIX_DEF bool matrix_socket_mesh(size_t size, matrix_transport* t) {
+    assert(size > 0);
+    assert(t);
 
-    assert(size < 64);
-    swapped_set = matrix__set_bit(swapped_set, 0);
-    swapped_set = matrix__set_bit(swapped_set, size);
+    // pairs[i * size + j] (for i < j) are the ends of the socket pair between ranks i and j
+    int* pairs = malloc(sizeof(int) * 2 * size * size);
+    matrix__socket_mesh* mesh = malloc(sizeof(matrix__socket_mesh));
+    int* fds = malloc(sizeof(int) * size);
+    pid_t* workers = calloc(size, sizeof(pid_t));
+    bool ok = pairs && mesh && fds && workers;
 
-    size_t i = 1;
-    size_t cycle_begin;
-    size_t next;
-    double temp;
-    double swap_temp;
+    size_t created = 0;
+    for (size_t i = 0; ok && i < size; ++i) {
+        for (size_t j = i + 1; ok && j < size; ++j, ++created) {
+            ok = socketpair(AF_UNIX, SOCK_STREAM, 0, pairs + 2 * (i * size + j)) == 0;
+            if (!ok)
+                break;
+        }
+    }
 
-    while (i < size) {
-        cycle_begin = i;
-        temp = m->values[i];
+    size_t rank = 0;
+    size_t forked = 1;
+    for (; ok && forked < size; ++forked) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            rank = forked;
+            break;
+        }
+        workers[forked] = pid;
+        ok = pid > 0;
+    }
 
-        do {
-            next = (i * m->height) % size;
+    // Keep the ends of the current rank, and close all the other ones
+    size_t closed = 0;
+    for (size_t i = 0; i < size && closed < created; ++i) {
+        for (size_t j = i + 1; j < size && closed < created; ++j, ++closed) {
+            int* pair = pairs + 2 * (i * size + j);
+            if (ok && i == rank)
+                fds[j] = pair[0];
+            else
+                close(pair[0]);
+            if (ok && j == rank)
+                fds[i] = pair[1];
+            else
+                close(pair[1]);
+        }
+    }
+    free(pairs);
 
-            // Swap next with temp
-            swap_temp = m->values[next];
-            m->values[next] = temp;
-            temp = swap_temp;
+    if (!ok) {
+        // Workers which already started exit once they find their sockets closed
+        for (size_t i = 1; workers && i < size; ++i)
+            if (workers[i] > 0)
+                waitpid(workers[i], NULL, 0);
+        free(mesh);
+        free(fds);
+        free(workers);
+        return false;
+    }
 
-            swapped_set = matrix__set_bit(swapped_set, i);
-            i = next;
-        } while (i != cycle_begin);
+    fds[rank] = -1;
+    mesh->fds = fds;
+    mesh->workers = workers;
+    t->rank = rank;
+    t->size = size;
+    t->send = matrix__socket_send;
+    t->recv = matrix__socket_recv;
+    t->user = mesh;
+    return true;
+}
 
-        // Find the next cycle
-        for (i = 1; i < size && matrix__has_bit(swapped_set, i); ++i);
+MATRIX_DEF bool matrix_socket_mesh_close(matrix_transport* t) {
+    assert(t && t->user);
+    matrix__socket_mesh* mesh = t->user;
+    for (size_t i = 0; i < t->size; ++i)
+        if (mesh->fds[i] >= 0)
+            close(mesh->fds[i]);
+
+    bool ok = true;
+    if (t->rank == 0) {
+        for (size_t i = 1; i < t->size; ++i) {
+            int status;
+            ok = waitpid(mesh->workers[i], &status, 0) == mesh->workers[i] && WIFEXITED(status) &&
+                 WEXITSTATUS(status) == 0 && ok;
+        }
     }
 
-    // Swap width and height
-    i = m->height;
-    m->height = m->width;
-    m->width = i;
+    free(mesh->fds);
+    free(mesh->workers);
+    free(mesh);
+    t->user = NULL;
+    return ok;
 }
 
-MATRIX_DEF void matrix__transpose_square(matrix* m) {
-    assert(m->width == m->height);
-    double temp;
+MATRIX_DEF void matrix_grid_range(size_t n, size_t parts, size_t part, size_t* begin,
+                                  size_t* end) {
+    assert(part < parts);
+    assert(begin && end);
+    matrix__parallel_range(n, 1, part, parts, begin, end);
+}
 
-    for (size_t i = 0; i < m->height - 1; ++i) {
-        for (size_t j = i + 1; j < m->height; ++j) {
-            temp = matrix_get(m, i, j);
-            matrix_set(m, i, j, matrix_get(m, j, i));
-            matrix_set(m, j, i, temp);
-        }
+/// Returns the part of `matrix_grid_range(n, parts, ...)` containing k, and sets `*end` to its end
+MATRIX_DEF size_t matrix__grid_owner(size_t n, size_t parts, size_t k, size_t* end) {
+    size_t begin;
+    for (size_t part = 0;; ++part) {
+        matrix_grid_range(n, parts, part, &begin, end);
+        if (k < *end)
+            return part;
     }
 }
 
-MATRIX_DEF void matrix__transpose_single_col_or_row(matrix* m) {
-    assert(m->width == 1 || m->height == 1);
+/// Sends `len` bytes from `root` to every rank in `ranks` (which must include the current
+/// one and root), or receives them in `data` if the current rank isn't root.
+/// Ranks are `first, first + stride, ...` (`count` of them).
+MATRIX_DEF bool matrix__broadcast(matrix_transport* t, size_t root, size_t first, size_t stride,
+                                  size_t count, void* data, size_t len) {
+    if (t->rank != root)
+        return t->recv(t, root, data, len);
 
-    // Swap width and height
-    int temp = m->height;
-    m->height = m->width;
-    m->width = temp;
+    for (size_t i = 0; i < count; ++i) {
+        size_t to = first + i * stride;
+        if (to != root && !t->send(t, to, data, len))
+            return false;
+    }
+    return true;
 }
 
-MATRIX_DEF void matrix_transpose(matrix* m) {
-    assert(m && m->values);
+MATRIX_DEF bool matrix_matmul_summa(matrix_transport* t, size_t grid_rows, size_t grid_cols,
+                                    size_t m, matrix const* a, matrix const* b, matrix* dest) {
+    assert(t && t->send && t->recv);
+    assert(grid_rows * grid_cols == t->size);
+    assert(a && a->values);
+    assert(b && b->values);
+    assert(dest && dest->values);
+    assert(dest->height == a->height);
+    assert(dest->width == b->width);
 
-    if (m->width == 1 || m->height == 1)
-        matrix__transpose_single_col_or_row(m);
-    else if (m->width == m->height)
-        matrix__transpose_square(m);
-    else if (matrix_len(m) <= 64)
-        matrix__transpose_small_rectangle(m);
-    else
-        matrix__transpose_rectangle(m);
+    size_t row = t->rank / grid_cols;
+    size_t col = t->rank % grid_cols;
+    size_t a_begin, a_end, b_begin, b_end;
+    matrix_grid_range(m, grid_cols, col, &a_begin, &a_end);
+    matrix_grid_range(m, grid_rows, row, &b_begin, &b_end);
+    assert(a->width == a_end - a_begin);
+    assert(b->height == b_end - b_begin);
+    MATRIX__OP_BEGIN(MATRIX_OP_MATMUL_SUMMA, a->height, m);
+    MATRIX__COW_WRITE(dest, false);
+
+    // Hosts may be tuned differently, but every rank must split k the same way,
+    // so the panel width is taken from rank 0
+    matrix_tuning tuning = matrix__tuning();
+    uint64_t panel_width = tuning.matmul_block_k;
+    if (!matrix__broadcast(t, 0, 0, 1, t->size, &panel_width, sizeof(panel_width))) {
+        MATRIX__OP_END(0.0, 0.0);
+        return false;
+    }
+
+    size_t panel = (size_t)panel_width;
+    size_t a_panel_bytes = sizeof(double) * a->height * panel;
+    size_t b_panel_bytes = sizeof(double) * panel * b->width;
+    double* a_panel = matrix__alloc(a_panel_bytes, false, "matrix_summa", a->height, panel);
+    double* b_panel = matrix__alloc(b_panel_bytes, false, "matrix_summa", panel, b->width);
+    bool ok = a_panel && b_panel;
+
+    matrix_fill_scalar(dest, 0.0);
+    for (size_t k = 0; ok && k < m;) {
+        // The panel must come from a single block of A's columns and of B's rows
+        size_t a_owner_end, b_owner_end;
+        size_t a_owner = matrix__grid_owner(m, grid_cols, k, &a_owner_end);
+        size_t b_owner = matrix__grid_owner(m, grid_rows, k, &b_owner_end);
+        size_t k_end = m - k < panel ? m : k + panel;
+        k_end = a_owner_end < k_end ? a_owner_end : k_end;
+        k_end = b_owner_end < k_end ? b_owner_end : k_end;
+        size_t ks = k_end - k;
+
+        if (col == a_owner) {
+            for (size_t r = 0; r < a->height; ++r)
+                memcpy(a_panel + r * ks, a->values + r * a->width + (k - a_begin),
+                       sizeof(double) * ks);
+        }
+        if (row == b_owner)
+            memcpy(b_panel, b->values + (k - b_begin) * b->width, sizeof(double) * ks * b->width);
+
+        ok = matrix__broadcast(t, row * grid_cols + a_owner, row * grid_cols, 1, grid_cols,
+                               a_panel, sizeof(double) * a->height * ks) &&
+             matrix__broadcast(t, b_owner * grid_cols + col, col, grid_cols, grid_rows, b_panel,
+                               sizeof(double) * ks * b->width);
+
+        if (ok) {
+            matrix a_matrix = {a->height, ks, a_panel};
+            matrix__matmul_accumulate(&a_matrix, b_panel, ks, b->width, false,
+                                      tuning.matmul_block_n, dest, MATRIX_SEMIRING_PLUS_TIMES);
+        }
+        k = k_end;
+    }
+
+    if (a_panel)
+        matrix__free(a_panel, a_panel_bytes);
+    if (b_panel)
+        matrix__free(b_panel, b_panel_bytes);
+    MATRIX__OP_END(2.0 * a->height * m * b->width,
+                   8.0 * (a->height * m + m * b->width + matrix_len(dest)));
+    return ok;
 }
 
+#endif  // MATRIX_DIST && !MATRIX_NO_MALLOC
+
 #endif // MATRIX_IMPLEMENTATION
@@ -0,0 +1,587 @@
+/**
+ * Header-only C++ layer over matrix.h: an owning, move-only `Matrix`,
+ * a non-owning `MatrixView`, and elementwise expressions evaluated in a single pass.
+ *
+ * The C implementation has to be compiled separately, in a C translation unit
+ * with external linkage, e.g. `gcc -c -x c -DMATRIX_IMPLEMENTATION -DMATRIX_DEF= matrix.h`.
+ * Unless `MATRIX_DEF` is already defined, this header defines it as empty, so that
+ * the declarations it includes refer to those functions.
+ *
+ * SPDX-License-Identifier: WTFPL
+ *
+ * @copyright Copyright (c) 2021, Mikolaj Kuranowski
+ */
+
+#ifndef MATRIX_HPP
+#define MATRIX_HPP
+
+#ifndef MATRIX_DEF
+#define MATRIX_DEF
+#endif  // MATRIX_DEF
+
+#include "matrix.h"
+
+#include <cassert>  // for assert
+#include <cstddef>  // for size_t
+#include <new>      // for std::bad_alloc
+
+#if defined(__has_include)
+#if __has_include(<mdspan>)
+#include <array>        // for std::array
+#include <type_traits>  // for std::is_same_v
+#include <mdspan>       // for std::mdspan (C++23)
+#endif
+#endif
+
+namespace mx {
+
+/**
+ * Base of every elementwise expression, and of `MatrixView` and `Matrix`.
+ *
+ * Every expression type `E` provides `height()`, `width()` and `operator[](i)`,
+ * which computes the i-th cell (in row-major order) of the result.
+ */
+template <class E>
+struct Expr {
+    E const& self() const noexcept { return static_cast<E const&>(*this); }
+};
+
+namespace detail {
+
+struct Add {
+    static double apply(double a, double b) noexcept { return a + b; }
+};
+
+struct Sub {
+    static double apply(double a, double b) noexcept { return a - b; }
+};
+
+struct Mul {
+    static double apply(double a, double b) noexcept { return a * b; }
+};
+
+struct Div {
+    static double apply(double a, double b) noexcept { return a / b; }
+};
+
+/// Elementwise operation on two expressions of the same shape
+template <class L, class R, class Op>
+class Binary : public Expr<Binary<L, R, Op>> {
+   public:
+    Binary(L const& l, R const& r) : l_(l), r_(r) {
+        assert(l.height() == r.height());
+        assert(l.width() == r.width());
+    }
+
+    size_t height() const noexcept { return l_.height(); }
+    size_t width() const noexcept { return l_.width(); }
+    double operator[](size_t i) const noexcept { return Op::apply(l_[i], r_[i]); }
+
+   private:
+    L l_;
+    R r_;
+};
+
+/// Operation between every cell of an expression and a scalar (on the right if `Swap` is set)
+template <class E, class Op, bool Swap = false>
+class Scalar : public Expr<Scalar<E, Op, Swap>> {
+   public:
+    Scalar(E const& e, double x) : e_(e), x_(x) {}
+
+    size_t height() const noexcept { return e_.height(); }
+    size_t width() const noexcept { return e_.width(); }
+    double operator[](size_t i) const noexcept {
+        return Swap ? Op::apply(x_, e_[i]) : Op::apply(e_[i], x_);
+    }
+
+   private:
+    E e_;
+    double x_;
+};
+
+}  // namespace detail
+
+/**
+ * Non-owning, read-only reference to a row-major matrix of doubles,
+ * e.g. some rows of a const `Matrix`. Every `MatrixView` converts to one.
+ *
+ * Unlike `MatrixView`, it can't be assigned to, and doesn't give access to its cells
+ * for writing; neither does its `c_matrix()`, which must only be passed to functions
+ * which don't modify their argument.
+ */
+class ConstMatrixView : public Expr<ConstMatrixView> {
+   public:
+    ConstMatrixView() noexcept : m_{0, 0, nullptr} {}
+    ConstMatrixView(size_t height, size_t width, double const* values) noexcept
+        : m_{height, width, const_cast<double*>(values)} {}
+    explicit ConstMatrixView(matrix const& m) noexcept : m_(m) {}
+    ConstMatrixView(ConstMatrixView const& other) noexcept = default;
+    ConstMatrixView& operator=(ConstMatrixView const&) = delete;
+
+    size_t height() const noexcept { return m_.height; }
+    size_t width() const noexcept { return m_.width; }
+    size_t size() const noexcept { return m_.height * m_.width; }
+    bool empty() const noexcept { return size() == 0; }
+
+    double const* data() const noexcept { return m_.values; }
+
+    double operator()(size_t row, size_t col) const noexcept {
+        assert(row < m_.height && col < m_.width);
+        return m_.values[row * m_.width + col];
+    }
+
+    /// Cell at the provided index in row-major order
+    double operator[](size_t i) const noexcept { return m_.values[i]; }
+
+    /// Iterators over the cells in row-major order
+    double const* begin() const noexcept { return m_.values; }
+    double const* end() const noexcept { return m_.values + size(); }
+
+    /**
+     * Returns a read-only view of `count` consecutive rows, starting at `row`.
+     */
+    ConstMatrixView rows(size_t row, size_t count) const {
+        return ConstMatrixView(matrix_rows(&m_, row, count));
+    }
+
+    /**
+     * Returns the underlying C matrix, see the note on writes above.
+     */
+    matrix const* c_matrix() const noexcept { return &m_; }
+
+   private:
+    matrix m_;
+};
+
+/**
+ * Non-owning reference to a row-major matrix of doubles, e.g. a `Matrix`,
+ * some of its rows (`rows`), or a buffer owned by somebody else.
+ *
+ * Copying a view doesn't copy the cells, but assigning to a view
+ * (from another view or from an expression) writes into the viewed cells.
+ * Const views only give read access to their cells, and only hand out `ConstMatrixView`s.
+ *
+ * With `MATRIX_COW`, assignments and operators give a matrix sharing its buffer its own copy
+ * first, like the C functions do. Writes through `operator()`, `operator[]` or `data()` don't;
+ * call `matrix_unshare(v.c_matrix())` before them.
+ */
+class MatrixView : public Expr<MatrixView> {
+   public:
+    MatrixView() noexcept : m_{0, 0, nullptr} {}
+    MatrixView(size_t height, size_t width, double* values) noexcept
+        : m_{height, width, values} {}
+    explicit MatrixView(matrix const& m) noexcept : m_(m) {}
+    MatrixView(MatrixView const& other) noexcept = default;
+
+    operator ConstMatrixView() const noexcept { return ConstMatrixView(m_); }
+
+    MatrixView& operator=(MatrixView const& other) {
+        assign(other);
+        return *this;
+    }
+
+    template <class E>
+    MatrixView& operator=(Expr<E> const& e) {
+        assign(e.self());
+        return *this;
+    }
+
+    template <class E>
+    MatrixView& operator+=(Expr<E> const& e) {
+        assign(detail::Binary<MatrixView, E, detail::Add>(*this, e.self()));
+        return *this;
+    }
+
+    template <class E>
+    MatrixView& operator-=(Expr<E> const& e) {
+        assign(detail::Binary<MatrixView, E, detail::Sub>(*this, e.self()));
+        return *this;
+    }
+
+    MatrixView& operator+=(double x) {
+        matrix_add_scalar(&m_, x);
+        return *this;
+    }
+
+    MatrixView& operator-=(double x) {
+        matrix_sub_scalar(&m_, x);
+        return *this;
+    }
+
+    MatrixView& operator*=(double x) {
+        matrix_mul_scalar(&m_, x);
+        return *this;
+    }
+
+    size_t height() const noexcept { return m_.height; }
+    size_t width() const noexcept { return m_.width; }
+    size_t size() const noexcept { return m_.height * m_.width; }
+    bool empty() const noexcept { return size() == 0; }
+
+    double* data() noexcept { return m_.values; }
+    double const* data() const noexcept { return m_.values; }
+
+    double& operator()(size_t row, size_t col) noexcept {
+        assert(row < m_.height && col < m_.width);
+        return m_.values[row * m_.width + col];
+    }
+
+    double operator()(size_t row, size_t col) const noexcept {
+        assert(row < m_.height && col < m_.width);
+        return m_.values[row * m_.width + col];
+    }
+
+    /// Cell at the provided index in row-major order
+    double& operator[](size_t i) noexcept { return m_.values[i]; }
+    double operator[](size_t i) const noexcept { return m_.values[i]; }
+
+    /// Iterators over the cells in row-major order, which make views contiguous ranges
+    double* begin() noexcept { return m_.values; }
+    double* end() noexcept { return m_.values + size(); }
+    double const* begin() const noexcept { return m_.values; }
+    double const* end() const noexcept { return m_.values + size(); }
+
+    /**
+     * Returns a view of `count` consecutive rows, starting at `row`.
+     */
+    MatrixView rows(size_t row, size_t count) {
+        return MatrixView(matrix_rows(&m_, row, count));
+    }
+
+    ConstMatrixView rows(size_t row, size_t count) const {
+        return ConstMatrixView(matrix_rows(&m_, row, count));
+    }
+
+    /**
+     * Sets every cell to `value`.
+     */
+    void fill(double value) { matrix_fill_scalar(&m_, value); }
+
+    /**
+     * Transposes the viewed cells in-place, swapping the height and width of this view.
+     */
+    void transpose() { matrix_transpose(&m_); }
+
+    /**
+     * Returns the underlying C matrix, which can be passed to every matrix.h function.
+     */
+    matrix* c_matrix() noexcept { return &m_; }
+    matrix const* c_matrix() const noexcept { return &m_; }
+
+   protected:
+    /// With `MATRIX_COW`, gives the viewed matrix its own copy of a shared buffer
+    /// before it's written to (see `matrix_unshare`). Expressions hold their own views
+    /// of their operands, so they keep reading the old buffer.
+    void unshare() {
+#ifdef MATRIX_COW
+        if (m_.values && !matrix_unshare(&m_))
+            throw std::bad_alloc();
+#endif
+    }
+
+    /// Writes the result of an expression into the viewed cells in a single pass.
+    /// Cell i of the result may only depend on cell i of the operands,
+    /// so the destination may also appear in the expression (but not partially overlap it).
+    template <class E>
+    void assign(E const& e) {
+        assert(e.height() == m_.height);
+        assert(e.width() == m_.width);
+        unshare();
+        double* out = m_.values;
+        size_t len = size();
+        for (size_t i = 0; i < len; ++i)
+            out[i] = e[i];
+    }
+
+    void assign(ConstMatrixView const& other) {
+        assert(other.height() == m_.height);
+        assert(other.width() == m_.width);
+        if (other.data() != m_.values && !empty())
+            matrix_copy_into(other.c_matrix(), &m_);
+    }
+
+    void assign(MatrixView const& other) { assign(ConstMatrixView(other)); }
+
+    matrix m_;
+};
+
+#ifndef MATRIX_NO_MALLOC
+
+/**
+ * Owning matrix of doubles, released when it goes out of scope.
+ *
+ * Matrices can't be copied implicitly; use `clone()` or construct one from a view.
+ * Moves only transfer the buffer, so they never allocate or throw: move construction leaves
+ * the source empty, and move assignment swaps the buffers, so the old one is freed with the source.
+ * Assigning an expression of a different shape replaces the buffer; otherwise the result
+ * is written in-place.
+ */
+class Matrix : public MatrixView {
+   public:
+    Matrix() noexcept = default;
+
+    /**
+     * Allocates a matrix with the provided size. No guarantees are made as to its contents.
+     * Throws `std::bad_alloc` if the buffer can't be allocated.
+     */
+    Matrix(size_t height, size_t width) {
+        m_.height = height;
+        m_.width = width;
+        if (height && width) {
+            m_ = matrix_new(height, width);
+            if (!m_.values)
+                throw std::bad_alloc();
+        }
+    }
+
+    /**
+     * Allocates a matrix with the provided size, with every cell set to `value`.
+     */
+    Matrix(size_t height, size_t width, double value) : Matrix(height, width) { fill(value); }
+
+    /**
+     * Allocates a matrix with the shape of an expression, and evaluates it.
+     */
+    template <class E>
+    explicit Matrix(Expr<E> const& e) : Matrix(e.self().height(), e.self().width()) {
+        assign(e.self());
+    }
+
+    Matrix(Matrix const&) = delete;
+    Matrix& operator=(Matrix const&) = delete;
+
+    Matrix(Matrix&& other) noexcept : MatrixView(other.m_) { other.m_ = matrix{0, 0, nullptr}; }
+
+    Matrix& operator=(Matrix&& other) noexcept {
+        matrix old = m_;
+        m_ = other.m_;
+        other.m_ = old;
+        return *this;
+    }
+
+    template <class E>
+    Matrix& operator=(Expr<E> const& e) {
+        E const& expr = e.self();
+        if (expr.height() == m_.height && expr.width() == m_.width)
+            assign(expr);
+        else
+            *this = Matrix(expr);
+        return *this;
+    }
+
+    ~Matrix() { reset(); }
+
+    /**
+     * Takes ownership of a matrix allocated by matrix.h (e.g. by `matrix_new`).
+     */
+    static Matrix adopt(matrix m) noexcept {
+        Matrix owned;
+        owned.m_ = m;
+        return owned;
+    }
+
+    /**
+     * Gives up ownership of the buffer, which then has to be freed with `matrix_del`.
+     * Leaves this matrix empty.
+     */
+    matrix release() noexcept {
+        matrix m = m_;
+        m_ = matrix{0, 0, nullptr};
+        return m;
+    }
+
+    /**
+     * Returns a deep copy of this matrix.
+     */
+    Matrix clone() const { return Matrix(ConstMatrixView(*this)); }
+
+    /**
+     * Frees the buffer, leaving this matrix empty.
+     */
+    void reset() noexcept {
+        if (m_.values)
+            matrix_del(&m_);
+        m_ = matrix{0, 0, nullptr};
+    }
+};
+
+#endif  // MATRIX_NO_MALLOC
+
+// Elementwise expressions
+
+template <class L, class R>
+detail::Binary<L, R, detail::Add> operator+(Expr<L> const& l, Expr<R> const& r) {
+    return {l.self(), r.self()};
+}
+
+template <class L, class R>
+detail::Binary<L, R, detail::Sub> operator-(Expr<L> const& l, Expr<R> const& r) {
+    return {l.self(), r.self()};
+}
+
+/**
+ * Elementwise (Hadamard) product; see `matmul` for the matrix multiplication.
+ */
+template <class L, class R>
+detail::Binary<L, R, detail::Mul> hadamard(Expr<L> const& l, Expr<R> const& r) {
+    return {l.self(), r.self()};
+}
+
+template <class E>
+detail::Scalar<E, detail::Mul> operator*(Expr<E> const& e, double x) {
+    return {e.self(), x};
+}
+
+template <class E>
+detail::Scalar<E, detail::Mul> operator*(double x, Expr<E> const& e) {
+    return {e.self(), x};
+}
+
+template <class E>
+detail::Scalar<E, detail::Div> operator/(Expr<E> const& e, double x) {
+    return {e.self(), x};
+}
+
+template <class E>
+detail::Scalar<E, detail::Add> operator+(Expr<E> const& e, double x) {
+    return {e.self(), x};
+}
+
+template <class E>
+detail::Scalar<E, detail::Add> operator+(double x, Expr<E> const& e) {
+    return {e.self(), x};
+}
+
+template <class E>
+detail::Scalar<E, detail::Sub> operator-(Expr<E> const& e, double x) {
+    return {e.self(), x};
+}
+
+template <class E>
+detail::Scalar<E, detail::Sub, true> operator-(double x, Expr<E> const& e) {
+    return {e.self(), x};
+}
+
+template <class E>
+detail::Scalar<E, detail::Mul> operator-(Expr<E> const& e) {
+    return {e.self(), -1.0};
+}
+
+// Library operations
+
+/**
+ * Returns the sum of every cell, see `matrix_sum`.
+ */
+inline double sum(ConstMatrixView m) { return matrix_sum(m.c_matrix()); }
+
+/**
+ * Performs the matrix multiplication of a and b into dest, see `matrix_matmul_into`.
+ * `dest` is taken by reference, so that with `MATRIX_COW` a `Matrix` sharing its buffer
+ * gets its own copy, and not a copy of its view.
+ */
+inline void matmul_into(ConstMatrixView a, ConstMatrixView b, MatrixView& dest) {
+    matrix_matmul_into(a.c_matrix(), b.c_matrix(), dest.c_matrix());
+}
+
+/// Writes into a temporary view, e.g. `m.rows(1, 2)`
+inline void matmul_into(ConstMatrixView a, ConstMatrixView b, MatrixView&& dest) {
+    matmul_into(a, b, dest);
+}
+
+#ifndef MATRIX_NO_MALLOC
+
+/**
+ * Returns the matrix multiplication of a and b, see `matrix_matmul_into`.
+ */
+inline Matrix matmul(ConstMatrixView a, ConstMatrixView b) {
+    Matrix dest(a.height(), b.width());
+    if (!dest.empty())
+        matmul_into(a, b, dest);
+    return dest;
+}
+
+#endif  // MATRIX_NO_MALLOC
+
+#ifdef __cpp_lib_mdspan
+
+// std::mdspan interop
+
+/// Row-major mdspan of a whole matrix
+using mdspan = std::mdspan<double, std::dextents<size_t, 2>>;
+using const_mdspan = std::mdspan<double const, std::dextents<size_t, 2>>;
+
+/// Strided mdspan, e.g. for libraries which take arbitrary layouts
+using strided_mdspan = std::mdspan<double, std::dextents<size_t, 2>, std::layout_stride>;
+
+/**
+ * Returns an mdspan of the cells of a view (or of a `Matrix`), without copying them.
+ */
+inline mdspan to_mdspan(MatrixView& m) noexcept { return mdspan(m.data(), m.height(), m.width()); }
+inline mdspan to_mdspan(MatrixView&& m) noexcept { return to_mdspan(m); }
+inline const_mdspan to_mdspan(ConstMatrixView const& m) noexcept {
+    return const_mdspan(m.data(), m.height(), m.width());
+}
+inline mdspan to_mdspan(matrix const& m) noexcept { return mdspan(m.values, m.height, m.width); }
+
+#ifndef MATRIX_NO_MALLOC
+/// The cells of a temporary matrix are freed at the end of the full-expression
+mdspan to_mdspan(Matrix&& m) = delete;
+#endif  // MATRIX_NO_MALLOC
+
+/**
+ * Returns an mdspan of the cells of a view with `layout_stride`, without copying them.
+ * If `transposed` is set, it describes the transpose of the view.
+ */
+inline strided_mdspan to_strided_mdspan(MatrixView& m, bool transposed = false) noexcept {
+    using extents = std::dextents<size_t, 2>;
+    using mapping = std::layout_stride::mapping<extents>;
+    if (transposed)
+        return strided_mdspan(m.data(), mapping(extents(m.width(), m.height()),
+                                                std::array<size_t, 2>{1, m.width()}));
+    return strided_mdspan(m.data(), mapping(extents(m.height(), m.width()),
+                                            std::array<size_t, 2>{m.width(), 1}));
+}
+
+/**
+ * Returns true if the cells of a rank-2 mdspan form a row-major matrix without gaps,
+ * i.e. if they can be viewed with `from_mdspan`. Always true for `layout_right`.
+ */
+template <class T, class E, class L>
+bool is_row_major(std::mdspan<T, E, L> const& s) {
+    static_assert(E::rank() == 2, "only mdspans of rank 2 are matrices");
+    if constexpr (std::is_same_v<L, std::layout_right>) {
+        return true;
+    } else {
+        if (!s.is_strided())
+            return false;
+        return (s.extent(1) <= 1 || s.stride(1) == 1) &&
+               (s.extent(0) <= 1 || s.stride(0) == s.extent(1));
+    }
+}
+
+/**
+ * Returns a view of the cells of a rank-2 mdspan, without copying them,
+ * so that the library's functions can operate on third-party buffers.
+ * The mdspan must be row-major without gaps, see `is_row_major`.
+ */
+template <class E, class L>
+MatrixView from_mdspan(std::mdspan<double, E, L> const& s) {
+    assert(is_row_major(s));
+    return MatrixView(s.extent(0), s.extent(1), s.data_handle());
+}
+
+/**
+ * Returns a read-only view of the cells of a rank-2 mdspan of const doubles,
+ * see the non-const overload.
+ */
+template <class E, class L>
+ConstMatrixView from_mdspan(std::mdspan<double const, E, L> const& s) {
+    assert(is_row_major(s));
+    return ConstMatrixView(s.extent(0), s.extent(1), s.data_handle());
+}
+
+#endif  // __cpp_lib_mdspan
+
+}  // namespace mx
+
+#endif  // MATRIX_HPP
@@ -1,6 +1,13 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(MATRIX_SHM) || defined(MATRIX_DIST) || defined(MATRIX_THREADS)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #define MATRIX_IMPLEMENTATION
 #include "matrix.h"
@@ -266,6 +273,333 @@ int test_matrix_matmul() {
     TEST_END;
 }
 
+int test_matrix_matmul_blocked() {
+    TEST_START("matmul_blocked");
+    // Shapes bigger than a single block, compared against the naive algorithm
+
+    matrix m1 = matrix_new(5, 300);
+    matrix m2 = matrix_new(300, 270);
+    for (size_t i = 0; i < matrix_len(&m1); ++i) m1.values[i] = (double)(i % 7) - 3.0;
+    for (size_t i = 0; i < matrix_len(&m2); ++i) m2.values[i] = (double)(i % 5) - 2.0;
+
+    matrix m3 = matrix_matmul(&m1, &m2);
+    TEST_SIZE_EQ("m3.height", 5lu, m3.height);
+    TEST_SIZE_EQ("m3.width", 270lu, m3.width);
+
+    for (size_t row = 0; row < m3.height; ++row) {
+        for (size_t col = 0; col < m3.width; ++col) {
+            double expected = 0.0;
+            for (size_t i = 0; i < m1.width; ++i)
+                expected += matrix_get(&m1, row, i) * matrix_get(&m2, i, col);
+            TEST_DEQ("m3 cell", expected, matrix_get(&m3, row, col));
+        }
+    }
+
+    matrix_del(&m1);
+    matrix_del(&m2);
+    matrix_del(&m3);
+    TEST_END;
+}
+
+int test_matrix_matmul_packed() {
+    TEST_START("pack_b/matmul_packed");
+    srand(420);  // To makes test reproducible
+
+    matrix a = matrix_new_uniform(7, 300, -1.0, 1.0);
+    matrix b = matrix_new_uniform(300, 270, -1.0, 1.0);
+    matrix expected = matrix_matmul(&a, &b);
+    matrix got = matrix_new(7, 270);
+
+    matrix_packed packed = matrix_pack_b(&b);
+    TEST_SIZE_EQ("packed.height", 300lu, packed.height);
+    TEST_SIZE_EQ("packed.width", 270lu, packed.width);
+
+    matrix_matmul_packed(&a, &packed, &got);
+    for (size_t i = 0; i < matrix_len(&got); ++i)
+        TEST_DEQ("got cell", expected.values[i], got.values[i]);
+
+    matrix_del(&a);
+    matrix_del(&b);
+    matrix_del(&expected);
+    matrix_del(&got);
+    matrix_packed_del(&packed);
+    TEST_END;
+}
+
+int test_matrix_matmul_semiring() {
+    TEST_START("matmul_semiring/matmul_semiring_into");
+
+    // Edge weights of a 3-node directed graph; INFINITY means no edge
+    double g_vals[9] = {0.0, 4.0, INFINITY, INFINITY, 0.0, 1.0, 2.0, INFINITY, 0.0};
+    matrix g = {3, 3, g_vals};
+
+    matrix d = matrix_matmul_semiring(&g, &g, MATRIX_SEMIRING_MIN_PLUS);
+    TEST_DEQ("min_plus[0][2]", 5.0, matrix_get(&d, 0, 2));
+    TEST_DEQ("min_plus[1][0]", 3.0, matrix_get(&d, 1, 0));
+    TEST_DEQ("min_plus[2][1]", 6.0, matrix_get(&d, 2, 1));
+    TEST_DEQ("min_plus[0][0]", 0.0, matrix_get(&d, 0, 0));
+
+    double m1_vals[4] = {1.0, 2.0, 3.0, 4.0};
+    double m2_vals[2] = {5.0, 6.0};
+    double dest_vals[2];
+    matrix m1 = {2, 2, m1_vals};
+    matrix m2 = {2, 1, m2_vals};
+    matrix dest = {2, 1, dest_vals};
+
+    matrix_matmul_semiring_into(&m1, &m2, &dest, MATRIX_SEMIRING_MAX_PLUS);
+    TEST_DEQ("max_plus[0]", 8.0, dest_vals[0]);
+    TEST_DEQ("max_plus[1]", 10.0, dest_vals[1]);
+
+    matrix_matmul_semiring_into(&m1, &m2, &dest, MATRIX_SEMIRING_MAX_MIN);
+    TEST_DEQ("max_min[0]", 2.0, dest_vals[0]);
+    TEST_DEQ("max_min[1]", 4.0, dest_vals[1]);
+
+    double r_vals[4] = {0.0, 2.0, 0.0, 0.0};
+    double s_vals[4] = {0.0, 0.0, -1.0, 0.0};
+    double reach_vals[4];
+    matrix r = {2, 2, r_vals};
+    matrix s = {2, 2, s_vals};
+    matrix reach = {2, 2, reach_vals};
+
+    matrix_matmul_semiring_into(&r, &s, &reach, MATRIX_SEMIRING_OR_AND);
+    TEST_DEQ("or_and[0][0]", 1.0, reach_vals[0]);
+    TEST_DEQ("or_and[0][1]", 0.0, reach_vals[1]);
+    TEST_DEQ("or_and[1][0]", 0.0, reach_vals[2]);
+    TEST_DEQ("or_and[1][1]", 0.0, reach_vals[3]);
+
+    matrix_del(&d);
+    TEST_END;
+}
+
+int test_matrix_bits() {
+    TEST_START("bits_from_matrix/bits_to_matrix/bits_get/bits_set/bits_count");
+
+    matrix m = matrix_new_zeroed(3, 70);
+    matrix_set(&m, 0, 0, 1.0);
+    matrix_set(&m, 1, 65, -2.0);
+    matrix_set(&m, 2, 69, 0.5);
+
+    matrix_bits b = matrix_bits_from_matrix(&m);
+    TEST_SIZE_EQ("b.height", 3lu, b.height);
+    TEST_SIZE_EQ("b.width", 70lu, b.width);
+    TEST_SIZE_EQ("matrix_bits_count(b)", 3lu, matrix_bits_count(&b));
+    TEST_DEQ("b[1][65]", 1.0, matrix_bits_get(&b, 1, 65) ? 1.0 : 0.0);
+    TEST_DEQ("b[1][64]", 0.0, matrix_bits_get(&b, 1, 64) ? 1.0 : 0.0);
+
+    matrix_bits_set(&b, 2, 69, false);
+    matrix_bits_set(&b, 2, 3, true);
+    matrix_bits_to_matrix_into(&b, &m);
+    TEST_DEQ("m[0][0]", 1.0, matrix_get(&m, 0, 0));
+    TEST_DEQ("m[1][65]", 1.0, matrix_get(&m, 1, 65));
+    TEST_DEQ("m[2][3]", 1.0, matrix_get(&m, 2, 3));
+    TEST_DEQ("m[2][69]", 0.0, matrix_get(&m, 2, 69));
+
+    matrix_bits_del(&b);
+    matrix_del(&m);
+    TEST_END;
+}
+
+int test_matrix_bits_elementwise() {
+    TEST_START("bits_and/bits_or/bits_xor");
+
+    uint64_t a_words[1] = {0xC};  // 0b1100
+    uint64_t b_words[1] = {0xA};  // 0b1010
+    matrix_bits a = {1, 4, a_words};
+    matrix_bits b = {1, 4, b_words};
+
+    matrix_bits_and(&a, &b);
+    TEST_SIZE_EQ("a & b", (size_t)0x8, (size_t)a_words[0]);
+
+    a_words[0] = 0xC;
+    matrix_bits_or(&a, &b);
+    TEST_SIZE_EQ("a | b", (size_t)0xE, (size_t)a_words[0]);
+
+    a_words[0] = 0xC;
+    matrix_bits_xor(&a, &b);
+    TEST_SIZE_EQ("a ^ b", (size_t)0x6, (size_t)a_words[0]);
+
+    TEST_END;
+}
+
+int test_matrix_bits_matmul() {
+    TEST_START("bits_matmul/bits_matmul_into/bits_transitive_closure");
+
+    // Path graph 0 -> 1 -> ... -> 99, compared against the semiring matmul
+    matrix adj = matrix_new_zeroed(100, 100);
+    for (size_t i = 0; i < 99; ++i) matrix_set(&adj, i, i + 1, 1.0);
+    matrix_set(&adj, 70, 3, 1.0);
+
+    matrix_bits b = matrix_bits_from_matrix(&adj);
+    matrix_bits b2 = matrix_bits_matmul(&b, &b);
+    matrix adj2 = matrix_matmul_semiring(&adj, &adj, MATRIX_SEMIRING_OR_AND);
+    matrix got = matrix_new(100, 100);
+    matrix_bits_to_matrix_into(&b2, &got);
+
+    for (size_t i = 0; i < matrix_len(&got); ++i)
+        TEST_DEQ("b2 cell", adj2.values[i], got.values[i]);
+
+    matrix_bits_transitive_closure(&b);
+    TEST_DEQ("closure[0][99]", 1.0, matrix_bits_get(&b, 0, 99) ? 1.0 : 0.0);
+    TEST_DEQ("closure[80][3]", 0.0, matrix_bits_get(&b, 80, 3) ? 1.0 : 0.0);
+    TEST_DEQ("closure[70][70]", 1.0, matrix_bits_get(&b, 70, 70) ? 1.0 : 0.0);
+    TEST_DEQ("closure[71][71]", 0.0, matrix_bits_get(&b, 71, 71) ? 1.0 : 0.0);
+    TEST_DEQ("closure[50][3]", 1.0, matrix_bits_get(&b, 50, 3) ? 1.0 : 0.0);
+
+    matrix_bits_del(&b);
+    matrix_bits_del(&b2);
+    matrix_del(&adj);
+    matrix_del(&adj2);
+    matrix_del(&got);
+    TEST_END;
+}
+
+int test_matrix_structured() {
+    TEST_START("diag/banded/sym from_matrix/to_matrix/matmul");
+    srand(420);  // To makes test reproducible
+
+    matrix dense = matrix_new_uniform(6, 6, -2.0, 2.0);
+    matrix b = matrix_new_uniform(6, 3, -2.0, 2.0);
+    matrix expected = matrix_new(6, 3);
+    matrix got = matrix_new(6, 3);
+    matrix round_trip = matrix_new(6, 6);
+
+    // Diagonal
+    matrix_diag d = matrix_diag_new(6);
+    matrix_diag_from_matrix_into(&dense, &d);
+    matrix_diag_to_matrix_into(&d, &round_trip);
+    TEST_DEQ("diag[2][2]", matrix_get(&dense, 2, 2), matrix_get(&round_trip, 2, 2));
+    TEST_DEQ("diag[2][3]", 0.0, matrix_get(&round_trip, 2, 3));
+
+    matrix_matmul_into(&round_trip, &b, &expected);
+    matrix_diag_matmul_into(&d, &b, &got);
+    for (size_t i = 0; i < matrix_len(&got); ++i)
+        TEST_DEQ("diag_matmul cell", expected.values[i], got.values[i]);
+
+    // Banded
+    matrix_banded band = matrix_banded_new(6, 6, 2, 1);
+    TEST_SIZE_EQ("matrix_banded_len(band)", 24lu, matrix_banded_len(&band));
+    matrix_banded_from_matrix_into(&dense, &band);
+    matrix_banded_to_matrix_into(&band, &round_trip);
+    TEST_DEQ("band[4][2]", matrix_get(&dense, 4, 2), matrix_get(&round_trip, 4, 2));
+    TEST_DEQ("band[4][5]", matrix_get(&dense, 4, 5), matrix_get(&round_trip, 4, 5));
+    TEST_DEQ("band[4][1]", 0.0, matrix_get(&round_trip, 4, 1));
+    TEST_DEQ("band[0][2]", 0.0, matrix_banded_get(&band, 0, 2));
+
+    matrix_matmul_into(&round_trip, &b, &expected);
+    matrix_banded_matmul_into(&band, &b, &got);
+    for (size_t i = 0; i < matrix_len(&got); ++i)
+        TEST_DEQ("banded_matmul cell", expected.values[i], got.values[i]);
+
+    // Tall banded - rows below the width have an empty band
+    matrix tall = matrix_new_uniform(6, 2, -2.0, 2.0);
+    matrix tall_round_trip = matrix_new(6, 2);
+    matrix tall_b = matrix_new_uniform(2, 3, -2.0, 2.0);
+    matrix_banded tall_band = matrix_banded_new(6, 2, 1, 1);
+    matrix_banded_from_matrix_into(&tall, &tall_band);
+    matrix_banded_to_matrix_into(&tall_band, &tall_round_trip);
+    TEST_DEQ("tall_band[2][1]", matrix_get(&tall, 2, 1), matrix_get(&tall_round_trip, 2, 1));
+    TEST_DEQ("tall_band[3][1]", 0.0, matrix_get(&tall_round_trip, 3, 1));
+    TEST_DEQ("tall_band[5][1]", 0.0, matrix_get(&tall_round_trip, 5, 1));
+
+    matrix_matmul_into(&tall_round_trip, &tall_b, &expected);
+    matrix_banded_matmul_into(&tall_band, &tall_b, &got);
+    for (size_t i = 0; i < matrix_len(&got); ++i)
+        TEST_DEQ("tall banded_matmul cell", expected.values[i], got.values[i]);
+
+    // Symmetric
+    matrix_sym sym = matrix_sym_new(6);
+    TEST_SIZE_EQ("matrix_sym_len(sym)", 21lu, matrix_sym_len(&sym));
+    matrix_sym_from_matrix_into(&dense, &sym);
+    matrix_sym_to_matrix_into(&sym, &round_trip);
+    TEST_DEQ("sym[4][1]", matrix_get(&dense, 4, 1), matrix_get(&round_trip, 4, 1));
+    TEST_DEQ("sym[1][4]", matrix_get(&dense, 4, 1), matrix_get(&round_trip, 1, 4));
+
+    matrix_matmul_into(&round_trip, &b, &expected);
+    matrix_sym_matmul_into(&sym, &b, &got);
+    for (size_t i = 0; i < matrix_len(&got); ++i) {
+        if (fabs(expected.values[i] - got.values[i]) > 1e-12) {
+            fprintf(stderr, TEST_FAIL_PREFIX "sym_matmul cell %zu - expected %f, got %f\n", i,
+                    expected.values[i], got.values[i]);
+            failed = 1;
+        }
+    }
+
+    matrix_del(&dense);
+    matrix_del(&b);
+    matrix_del(&expected);
+    matrix_del(&got);
+    matrix_del(&round_trip);
+    matrix_diag_del(&d);
+    matrix_banded_del(&band);
+    matrix_del(&tall);
+    matrix_del(&tall_round_trip);
+    matrix_del(&tall_b);
+    matrix_banded_del(&tall_band);
+    matrix_sym_del(&sym);
+    TEST_END;
+}
+
+int test_matrix_tridiag_solve() {
+    TEST_START("tridiag_solve");
+
+    // {sub, diag, super} for every row; the first sub and last super are outside of the matrix
+    double t_vals[12] = {0.0, 4.0, 1.0, 1.0, 4.0, 1.0, 1.0, 4.0, 1.0, 1.0, 4.0, 0.0};
+    matrix_banded t = {4, 4, 1, 1, t_vals};
+
+    // Right-hand sides for x = {1, 2, 3, 4} and x = {-1, 0, 1, 0}
+    double b_vals[8] = {6.0, -4.0, 12.0, 0.0, 18.0, 4.0, 19.0, 1.0};
+    matrix b = {4, 2, b_vals};
+    double scratch[4];
+
+    matrix_tridiag_solve(&t, &b, scratch);
+
+    double expected[8] = {1.0, -1.0, 2.0, 0.0, 3.0, 1.0, 4.0, 0.0};
+    for (size_t i = 0; i < 8; ++i) {
+        if (fabs(expected[i] - b_vals[i]) > 1e-12) {
+            fprintf(stderr, TEST_FAIL_PREFIX "x[%zu] - expected %f, got %f\n", i, expected[i],
+                    b_vals[i]);
+            failed = 1;
+        }
+    }
+
+    TEST_END;
+}
+
+int test_matrix_kron() {
+    TEST_START("kron/kron_into/kron_matvec");
+
+    double a_vals[6] = {1.0, 2.0, 3.0, -1.0, 0.0, 2.0};
+    double b_vals[4] = {0.0, 5.0, 6.0, 7.0};
+    matrix a = {2, 3, a_vals};
+    matrix b = {2, 2, b_vals};
+
+    matrix k = matrix_kron(&a, &b);
+    TEST_SIZE_EQ("k.height", 4lu, k.height);
+    TEST_SIZE_EQ("k.width", 6lu, k.width);
+    TEST_DEQ("k[0][3]", 10.0, matrix_get(&k, 0, 3));
+    TEST_DEQ("k[1][4]", 18.0, matrix_get(&k, 1, 4));
+    TEST_DEQ("k[3][0]", -6.0, matrix_get(&k, 3, 0));
+    TEST_DEQ("k[3][5]", 14.0, matrix_get(&k, 3, 5));
+
+    double x_vals[6] = {1.0, -2.0, 0.5, 3.0, -1.0, 4.0};
+    double expected_vals[4];
+    double y[4];
+    matrix x = {6, 1, x_vals};
+    matrix expected = {4, 1, expected_vals};
+    matrix_matmul_into(&k, &x, &expected);
+
+    matrix_kron_op op = {&a, &b};
+    TEST_SIZE_EQ("matrix_kron_scratch_len(op)", 6lu, matrix_kron_scratch_len(&op));
+    double scratch[6];
+    matrix_kron_matvec(&op, x_vals, y, scratch);
+
+    for (size_t i = 0; i < 4; ++i)
+        TEST_DEQ("y[i]", expected_vals[i], y[i]);
+
+    matrix_del(&k);
+    TEST_END;
+}
+
 int test_matrix_transpose_column() {
     TEST_START("transpose_column");
 
@@ -338,6 +672,207 @@ int test_matrix_transpose_huge_rectangle() {
     TEST_END;
 }
 
+int test_matrix_transpose_blocked() {
+    TEST_START("transpose_blocked");
+
+    matrix_tuning saved = matrix_tuning_get();
+    matrix_tuning t = saved;
+    t.transpose_block = 2;
+    matrix_tuning_set(&t);
+
+    double m_vals[25];
+    for (size_t i = 0; i < 25; ++i) m_vals[i] = (double)i;
+    matrix m = {5, 5, m_vals};
+
+    matrix_transpose(&m);
+    for (size_t row = 0; row < 5; ++row) {
+        for (size_t col = 0; col < 5; ++col)
+            TEST_DEQ("m cell", (double)(col * 5 + row), matrix_get(&m, row, col));
+    }
+
+    matrix_tuning_set(&saved);
+    TEST_END;
+}
+
+int test_matrix_tuning() {
+    TEST_START("tuning_parse/tuning_save/tuning_load/autotune");
+
+    matrix_tuning saved = matrix_tuning_get();
+    matrix_tuning t = saved;
+
+    if (!matrix_tuning_parse(" matmul_block_k=16\ttranspose_block=4 matmul_unroll=4\n", &t)) {
+        fputs(TEST_FAIL_PREFIX "matrix_tuning_parse returned false\n", stderr);
+        failed = 1;
+    }
+    TEST_SIZE_EQ("t.matmul_block_k", 16lu, t.matmul_block_k);
+    TEST_SIZE_EQ("t.matmul_block_n", saved.matmul_block_n, t.matmul_block_n);
+    TEST_SIZE_EQ("t.transpose_block", 4lu, t.transpose_block);
+    TEST_SIZE_EQ("t.matmul_unroll", 4lu, t.matmul_unroll);
+
+    if (matrix_tuning_parse("matmul_block_k=0", &t) || matrix_tuning_parse("foo=1", &t) ||
+        matrix_tuning_parse("matmul_block_n=8 junk", &t) ||
+        matrix_tuning_parse("matmul_unroll=3", &t) ||
+        matrix_tuning_parse("matmul_block_k=-1", &t) ||
+        matrix_tuning_parse("matmul_block_k= 8", &t) ||
+        matrix_tuning_parse("transpose_block=99999999999999999999999", &t) ||
+        matrix_tuning_parse("matmul_block_n=", &t)) {
+        fputs(TEST_FAIL_PREFIX "matrix_tuning_parse accepted an invalid string\n", stderr);
+        failed = 1;
+    }
+
+    t.matmul_block_k = 3;
+    t.matmul_block_n = 5;
+    t.transpose_block = 7;
+    t.matmul_unroll = 1;
+    if (!matrix_tuning_save(&t, "test_tuning.txt") || !matrix_tuning_load("test_tuning.txt")) {
+        fputs(TEST_FAIL_PREFIX "matrix_tuning_save/load returned false\n", stderr);
+        failed = 1;
+    }
+    remove("test_tuning.txt");
+
+    matrix_tuning loaded = matrix_tuning_get();
+    TEST_SIZE_EQ("loaded.matmul_block_k", 3lu, loaded.matmul_block_k);
+    TEST_SIZE_EQ("loaded.matmul_block_n", 5lu, loaded.matmul_block_n);
+    TEST_SIZE_EQ("loaded.transpose_block", 7lu, loaded.transpose_block);
+    TEST_SIZE_EQ("loaded.matmul_unroll", 1lu, loaded.matmul_unroll);
+
+    // Tiny blocks must still give the same results
+    double m1_vals[6] = {1.0, 2.0, 3.0, 4.0, 5.0, 6.0};
+    double m2_vals[12] = {1.0, 0.0, -1.0, 2.0, 0.5, 1.0, 1.0, 0.0, 2.0, 3.0, -2.0, 1.0};
+    double dest_vals[8];
+    matrix m1 = {2, 3, m1_vals};
+    matrix m2 = {3, 4, m2_vals};
+    matrix dest = {2, 4, dest_vals};
+    matrix_matmul_into(&m1, &m2, &dest);
+    TEST_DEQ("dest[0][0]", 8.0, dest_vals[0]);
+    TEST_DEQ("dest[1][3]", 14.0, dest_vals[7]);
+
+    // Unrolled kernels must give bit-identical results, including the leftover rows
+    srand(420);  // To makes test reproducible
+    matrix a = matrix_new_uniform(7, 9, -1.0, 1.0);
+    matrix b = matrix_new_uniform(9, 5, -1.0, 1.0);
+    matrix expected = matrix_new(7, 5);
+    matrix got = matrix_new(7, 5);
+    matrix_matmul_into(&a, &b, &expected);
+    for (size_t unroll = 2; unroll <= 4; unroll *= 2) {
+        t.matmul_unroll = unroll;
+        matrix_tuning_set(&t);
+        matrix_matmul_into(&a, &b, &got);
+        for (size_t i = 0; i < matrix_len(&got); ++i)
+            TEST_DEQ("unrolled matmul cell", expected.values[i], got.values[i]);
+    }
+    matrix_del(&a);
+    matrix_del(&b);
+    matrix_del(&expected);
+    matrix_del(&got);
+
+    matrix_tuning tuned = matrix_autotune(16);
+    loaded = matrix_tuning_get();
+    TEST_SIZE_EQ("tuned.matmul_block_k", tuned.matmul_block_k, loaded.matmul_block_k);
+    TEST_SIZE_EQ("tuned.transpose_block", tuned.transpose_block, loaded.transpose_block);
+    TEST_SIZE_EQ("tuned.matmul_unroll", tuned.matmul_unroll, loaded.matmul_unroll);
+
+    matrix_tuning_set(&saved);
+    TEST_END;
+}
+
+int test_matrix_streaming() {
+    TEST_START("fill_scalar/copy_into/new_repeated above MATRIX_STREAM_THRESHOLD");
+
+    // Starting in the middle of a 16-byte line, and with an odd length
+    size_t len = MATRIX_STREAM_THRESHOLD + 3;
+    double* a_vals = malloc(sizeof(double) * (len + 1));
+    matrix a = {1, len, a_vals + 1};
+    matrix b = matrix_new(1, len);
+
+    matrix_fill_scalar(&a, 2.5);
+    matrix_copy_into(&a, &b);
+    TEST_DEQ("b[0][0]", 2.5, matrix_get(&b, 0, 0));
+    TEST_DEQ("b[0][len - 1]", 2.5, matrix_get(&b, 0, len - 1));
+
+    matrix_fill_scalar(&a, 0.0);
+    matrix_fill_scalar(&b, -0.0);
+    for (size_t i = 0; i < len; ++i) {
+        if (a.values[i] != 0.0 || signbit(a.values[i]) || !signbit(b.values[i])) {
+            fprintf(stderr, TEST_FAIL_PREFIX "values[%zu] not filled with a signed zero\n", i);
+            failed = 1;
+            break;
+        }
+    }
+
+    matrix zeros = matrix_new_repeated(1, len, 0.0);
+    matrix fives = matrix_new_repeated(1, len, 5.0);
+    TEST_DEQ("zeros[0][len - 1]", 0.0, matrix_get(&zeros, 0, len - 1));
+    TEST_DEQ("fives[0][len - 1]", 5.0, matrix_get(&fives, 0, len - 1));
+
+    free(a_vals);
+    matrix_del(&b);
+    matrix_del(&zeros);
+    matrix_del(&fives);
+    TEST_END;
+}
+
+int test_matrix_matmul_ooc() {
+    TEST_START("save/load/file_shape/matmul_ooc");
+
+    matrix a = matrix_new(7, 5);
+    matrix b = matrix_new(5, 9);
+    for (size_t i = 0; i < matrix_len(&a); ++i)
+        a.values[i] = (double)(i % 7) - 3.0;
+    for (size_t i = 0; i < matrix_len(&b); ++i)
+        b.values[i] = 0.5 * (double)(i % 5);
+    matrix expected = matrix_matmul(&a, &b);
+
+    if (!matrix_save(&a, "test_ooc_a.bin") || !matrix_save(&b, "test_ooc_b.bin")) {
+        fputs(TEST_FAIL_PREFIX "matrix_save returned false\n", stderr);
+        failed = 1;
+    }
+
+    size_t height = 0, width = 0;
+    if (!matrix_file_shape("test_ooc_b.bin", &height, &width)) {
+        fputs(TEST_FAIL_PREFIX "matrix_file_shape returned false\n", stderr);
+        failed = 1;
+    }
+    TEST_SIZE_EQ("height", 5lu, height);
+    TEST_SIZE_EQ("width", 9lu, width);
+
+    // 2x2 tiles, which don't divide any of the dimensions
+    if (!matrix_matmul_ooc("test_ooc_a.bin", "test_ooc_b.bin", "test_ooc_c.bin",
+                           5 * 4 * sizeof(double))) {
+        fputs(TEST_FAIL_PREFIX "matrix_matmul_ooc returned false\n", stderr);
+        failed = 1;
+    }
+
+    matrix c = matrix_load("test_ooc_c.bin");
+    if (!c.values || c.height != 7 || c.width != 9) {
+        fputs(TEST_FAIL_PREFIX "matrix_load failed to read the product\n", stderr);
+        failed = 1;
+    } else {
+        for (size_t i = 0; i < matrix_len(&c); ++i) {
+            if (expected.values[i] != c.values[i]) {
+                fprintf(stderr, TEST_FAIL_PREFIX "c.values[%zu]: expected %f, got %f\n", i,
+                        expected.values[i], c.values[i]);
+                failed = 1;
+                break;
+            }
+        }
+        matrix_del(&c);
+    }
+
+    if (matrix_matmul_ooc("test_ooc_b.bin", "test_ooc_b.bin", "test_ooc_c.bin", 1 << 20) ||
+        matrix_matmul_ooc("test_ooc_a.bin", "test_ooc_b.bin", "test_ooc_c.bin", 0)) {
+        fputs(TEST_FAIL_PREFIX "matrix_matmul_ooc accepted mismatched shapes or budget\n", stderr);
+        failed = 1;
+    }
+
+    remove("test_ooc_a.bin");
+    remove("test_ooc_b.bin");
+    remove("test_ooc_c.bin");
+    matrix_del(&a);
+    matrix_del(&b);
+    matrix_del(&expected);
+    TEST_END;
+}
 
 double random_linear_func(double x) { return 2.0 * x - 4.0; }
 
@@ -357,12 +892,1086 @@ int test_matrix_map() {
     TEST_END;
 }
 
+int test_matrix_sum() {
+    TEST_START("sum/deterministic_set/deterministic_get");
+
+    double m_vals[6] = {1.0, -2.0, 8.0, 0.5, 3.0, -1.5};
+    matrix m = {2, 3, m_vals};
+    TEST_DEQ("small sum", 9.0, matrix_sum(&m));
+
+    // Above MATRIX_PARALLEL_THRESHOLD, with integers so that both modes give exact sums
+    size_t len = 3 * MATRIX_PARALLEL_THRESHOLD + 7;
+    matrix big = {1, len, malloc(sizeof(double) * len)};
+    double expected = 0.0;
+    for (size_t i = 0; i < len; ++i) {
+        big.values[i] = (double)(i % 13) - 6.0;
+        expected += big.values[i];
+    }
+
+    bool was_deterministic = matrix_deterministic_get();
+    matrix_deterministic_set(false);
+    TEST_DEQ("fast sum", expected, matrix_sum(&big));
+    matrix_deterministic_set(true);
+    if (!matrix_deterministic_get()) {
+        fputs(TEST_FAIL_PREFIX "deterministic mode not enabled\n", stderr);
+        failed = 1;
+    }
+    TEST_DEQ("deterministic sum", expected, matrix_sum(&big));
+    matrix_deterministic_set(was_deterministic);
+
+    free(big.values);
+    TEST_END;
+}
+
+#ifdef MATRIX_INSTRUMENT
+
+static int hook_calls[2];
+
+void counting_hook(void* user, matrix_op op, bool end, size_t height, size_t width) {
+    (void)height;
+    (void)width;
+    if (op == *(matrix_op*)user)
+        ++hook_calls[end];
+}
+
+int test_matrix_instrument() {
+    TEST_START("stats_snapshot/stats_reset/set_hook");
+
+    double m1_vals[4] = {1.0, 2.0, 3.0, 4.0};
+    double m2_vals[2] = {5.0, 6.0};
+    double dest_vals[2];
+    matrix m1 = {2, 2, m1_vals};
+    matrix m2 = {2, 1, m2_vals};
+    matrix dest = {2, 1, dest_vals};
+
+    matrix_op hooked = MATRIX_OP_MATMUL_SEMIRING_INTO;
+    matrix_stats_reset();
+    matrix_set_hook(counting_hook, &hooked);
+
+    matrix_add(&m1, &m1);
+    matrix_matmul_into(&m1, &m2, &dest);
+    matrix_matmul_into(&m1, &m2, &dest);
+    matrix_set_hook(NULL, NULL);
+
+    matrix_op_stats stats[MATRIX_OP_COUNT];
+    matrix_stats_snapshot(stats);
+
+    TEST_SIZE_EQ("add.calls", 1lu, (size_t)stats[MATRIX_OP_ADD].calls);
+    TEST_SIZE_EQ("add.flops", 4lu, (size_t)stats[MATRIX_OP_ADD].flops);
+    TEST_SIZE_EQ("add.bytes", 96lu, (size_t)stats[MATRIX_OP_ADD].bytes);
+    TEST_SIZE_EQ("matmul.calls", 2lu, (size_t)stats[MATRIX_OP_MATMUL_SEMIRING_INTO].calls);
+    TEST_SIZE_EQ("matmul.flops", 16lu, (size_t)stats[MATRIX_OP_MATMUL_SEMIRING_INTO].flops);
+
+    // fill_scalar is called internally by matmul, and must be attributed to matmul only
+    TEST_SIZE_EQ("fill_scalar.calls", 0lu, (size_t)stats[MATRIX_OP_FILL_SCALAR].calls);
+
+    TEST_SIZE_EQ("hook begin calls", 2lu, (size_t)hook_calls[0]);
+    TEST_SIZE_EQ("hook end calls", 2lu, (size_t)hook_calls[1]);
+
+    if (strcmp(matrix_op_name(MATRIX_OP_TRANSPOSE), "transpose") != 0) {
+        fputs(TEST_FAIL_PREFIX "matrix_op_name(MATRIX_OP_TRANSPOSE) != \"transpose\"\n", stderr);
+        failed = 1;
+    }
+
+    matrix_stats_reset();
+    matrix_stats_snapshot(stats);
+    TEST_SIZE_EQ("add.calls after reset", 0lu, (size_t)stats[MATRIX_OP_ADD].calls);
+
+    TEST_END;
+}
+
+#endif  // MATRIX_INSTRUMENT
+
+#ifdef MATRIX_TRACE
+
+/// Returns the trace as a string, which has to be freed
+char* trace_dump_string(void) {
+    FILE* f = tmpfile();
+    matrix_trace_dump(f);
+    long len = ftell(f);
+    rewind(f);
+
+    char* json = malloc(len + 1);
+    json[fread(json, 1, len, f)] = '\0';
+    fclose(f);
+    return json;
+}
+
+size_t count_substrings(char const* str, char const* sub) {
+    size_t n = 0;
+    for (str = strstr(str, sub); str; str = strstr(str + 1, sub))
+        ++n;
+    return n;
+}
+
+#ifdef MATRIX_THREADS
+
+void* trace_thread(void* arg) {
+    matrix_add_scalar((matrix*)arg, 1.0);
+    return NULL;
+}
+
+#endif  // MATRIX_THREADS
+
+int test_matrix_trace() {
+    TEST_START("trace_dump/trace_clear/trace_enable");
+
+    double m_vals[6] = {1.0, 2.0, 3.0, 4.0, 5.0, 6.0};
+    matrix m = {2, 3, m_vals};
+
+    matrix_trace_clear();
+    matrix_add_scalar(&m, 1.0);
+    matrix_transpose(&m);
+    matrix_trace_enable(false);
+    matrix_mul_scalar(&m, 2.0);
+    matrix_trace_enable(true);
+
+    char* json = trace_dump_string();
+
+    if (!strstr(json, "\"traceEvents\"") || !strstr(json, "\"name\": \"add_scalar\"") ||
+        !strstr(json, "\"name\": \"transpose\"") ||
+        !strstr(json, "\"args\": {\"height\": 2, \"width\": 3}")) {
+        fprintf(stderr, TEST_FAIL_PREFIX "missing events in the trace:\n%s\n", json);
+        failed = 1;
+    }
+
+    if (strstr(json, "\"name\": \"mul_scalar\"")) {
+        fputs(TEST_FAIL_PREFIX "event recorded while tracing was disabled\n", stderr);
+        failed = 1;
+    }
+    free(json);
+
+#ifdef MATRIX_THREADS
+    // Threads which exited hand their buffers (with their events) over to new ones
+    size_t buffers = 0;
+    for (int i = 0; i < 3; ++i) {
+        pthread_t thread;
+        pthread_create(&thread, NULL, trace_thread, &m);
+        pthread_join(thread, NULL);
+
+        json = trace_dump_string();
+        size_t now = count_substrings(json, "\"thread_name\"");
+        if (i == 0)
+            buffers = now;
+        else if (now != buffers)
+            failed = 1;
+        if (count_substrings(json, "\"name\": \"add_scalar\"") != (size_t)i + 2)
+            failed = 1;
+        free(json);
+    }
+    if (failed)
+        fputs(TEST_FAIL_PREFIX "trace buffers of exited threads not reused\n", stderr);
+
+    // Clearing frees them
+    matrix_trace_clear();
+    json = trace_dump_string();
+    TEST_SIZE_EQ("buffers after clear", buffers - 1, count_substrings(json, "\"thread_name\""));
+    free(json);
+#endif
+
+    TEST_END;
+}
+
+#endif  // MATRIX_TRACE
+
+#ifdef MATRIX_TRACK_ALLOCS
+
+int test_matrix_alloc_stats() {
+    TEST_START("alloc_stats_get/alloc_reset_peak/alloc_report_leaks");
+
+    matrix_alloc_reset_peak();
+    matrix_alloc_stats before = matrix_alloc_stats_get();
+
+    matrix a = matrix_new(3, 4);
+    matrix b = matrix_new_zeroed(5, 5);
+    matrix_alloc_stats during = matrix_alloc_stats_get();
+
+    if (during.live_bytes != before.live_bytes + sizeof(double) * 37 ||
+        during.live_allocations != before.live_allocations + 2 ||
+        during.total_allocations != before.total_allocations + 2 ||
+        during.peak_bytes < during.live_bytes) {
+        fputs(TEST_FAIL_PREFIX "unexpected stats after allocating\n", stderr);
+        failed = 1;
+    }
+
+    FILE* f = tmpfile();
+    size_t leaks = matrix_alloc_report_leaks(f);
+    long len = ftell(f);
+    rewind(f);
+
+    char* report = malloc(len + 1);
+    report[fread(report, 1, len, f)] = '\0';
+    fclose(f);
+
+    if (leaks != during.live_allocations || !strstr(report, "matrix 3 x 4 (96 bytes)") ||
+        !strstr(report, "matrix 5 x 5 (200 bytes)")) {
+        fprintf(stderr, TEST_FAIL_PREFIX "unexpected leak report (%zu):\n%s\n", leaks, report);
+        failed = 1;
+    }
+    free(report);
+
+    matrix_del(&a);
+    matrix_alloc_reset_peak();
+    matrix_del(&b);
+    matrix_alloc_stats after = matrix_alloc_stats_get();
+
+    if (after.live_bytes != before.live_bytes ||
+        after.live_allocations != before.live_allocations ||
+        after.peak_bytes != before.live_bytes + sizeof(double) * 25) {
+        fputs(TEST_FAIL_PREFIX "unexpected stats after freeing\n", stderr);
+        failed = 1;
+    }
+
+    TEST_END;
+}
+
+#endif  // MATRIX_TRACK_ALLOCS
+
+#ifdef MATRIX_MMAP
+
+int test_matrix_mapped() {
+    TEST_START("open_mapped/sync/close_mapped");
+
+    remove("test_mapped.bin");
+    matrix m = matrix_open_mapped("test_mapped.bin", 3, 4, MATRIX_MAP_SHARED);
+    if (!m.values) {
+        fputs(TEST_FAIL_PREFIX "failed to create a mapped matrix\n", stderr);
+        failed = 1;
+        TEST_END;
+    }
+    TEST_DEQ("m[2][3]", 0.0, matrix_get(&m, 2, 3));
+    matrix_fill_scalar(&m, 1.5);
+    matrix_set(&m, 2, 3, -4.0);
+    if (!matrix_sync(&m)) {
+        fputs(TEST_FAIL_PREFIX "matrix_sync returned false\n", stderr);
+        failed = 1;
+    }
+    matrix_close_mapped(&m);
+
+    // A snapshot sees the file, but its changes stay private
+    matrix snapshot = matrix_open_mapped("test_mapped.bin", 3, 4, MATRIX_MAP_SNAPSHOT);
+    if (snapshot.values) {
+        TEST_DEQ("snapshot[2][3]", -4.0, matrix_get(&snapshot, 2, 3));
+        matrix_add_scalar(&snapshot, 1.0);
+        TEST_DEQ("snapshot[0][0]", 2.5, matrix_get(&snapshot, 0, 0));
+        matrix_close_mapped(&snapshot);
+    } else {
+        fputs(TEST_FAIL_PREFIX "failed to open a snapshot\n", stderr);
+        failed = 1;
+    }
+
+    matrix read = matrix_open_mapped("test_mapped.bin", 3, 4, MATRIX_MAP_READ);
+    if (read.values) {
+        TEST_DEQ("read[0][0]", 1.5, matrix_get(&read, 0, 0));
+        TEST_DEQ("read[2][3]", -4.0, matrix_get(&read, 2, 3));
+        matrix_close_mapped(&read);
+    } else {
+        fputs(TEST_FAIL_PREFIX "failed to open a read-only mapping\n", stderr);
+        failed = 1;
+    }
+
+    if (matrix_open_mapped("test_mapped.bin", 4, 3, MATRIX_MAP_READ).values ||
+        matrix_open_mapped("test_missing.bin", 3, 4, MATRIX_MAP_READ).values) {
+        fputs(TEST_FAIL_PREFIX "opened a mismatched or missing file\n", stderr);
+        failed = 1;
+    }
+
+    remove("test_mapped.bin");
+    TEST_END;
+}
+
+#endif  // MATRIX_MMAP
+
+#ifdef MATRIX_SHM
+
+int test_matrix_shm() {
+    TEST_START("shm_create/shm_attach/shm_detach/shm_unlink/rows");
+
+    char name[64];
+    snprintf(name, sizeof(name), "/matrix_test_%ld", (long)getpid());
+    matrix shared = matrix_shm_create(name, 4, 3);
+    if (!shared.values) {
+        fputs(TEST_FAIL_PREFIX "failed to create a shared matrix\n", stderr);
+        failed = 1;
+        TEST_END;
+    }
+
+    // Two producer processes fill disjoint row ranges
+    for (int p = 0; p < 2; ++p) {
+        if (fork() == 0) {
+            matrix mine = matrix_shm_attach(name, 4, 3, true);
+            if (!mine.values)
+                _exit(1);
+            matrix rows = matrix_rows(&mine, 2 * p, 2);
+            matrix_fill_scalar(&rows, p + 1.0);
+            matrix_shm_detach(&mine);
+            _exit(0);
+        }
+    }
+    for (int p = 0; p < 2; ++p) {
+        int status;
+        wait(&status);
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            fputs(TEST_FAIL_PREFIX "producer failed to attach\n", stderr);
+            failed = 1;
+        }
+    }
+
+    matrix reader = matrix_shm_attach(name, 4, 3, false);
+    if (reader.values) {
+        TEST_DEQ("reader[1][2]", 1.0, matrix_get(&reader, 1, 2));
+        TEST_DEQ("reader[2][0]", 2.0, matrix_get(&reader, 2, 0));
+        TEST_DEQ("shared[3][2]", 2.0, matrix_get(&shared, 3, 2));
+        matrix_shm_detach(&reader);
+    } else {
+        fputs(TEST_FAIL_PREFIX "failed to attach to a shared matrix\n", stderr);
+        failed = 1;
+    }
+
+    if (matrix_shm_attach(name, 3, 4, false).values || matrix_shm_create(name, 4, 3).values) {
+        fputs(TEST_FAIL_PREFIX "attached with a wrong shape or recreated an existing matrix\n",
+              stderr);
+        failed = 1;
+    }
+
+    matrix_shm_detach(&shared);
+    if (!matrix_shm_unlink(name) || matrix_shm_attach(name, 4, 3, false).values) {
+        fputs(TEST_FAIL_PREFIX "failed to unlink a shared matrix\n", stderr);
+        failed = 1;
+    }
+    TEST_END;
+}
+
+#endif  // MATRIX_SHM
+
+#ifdef MATRIX_DIST
+
+/// Returns a new matrix with rows [r0, r1) and columns [c0, c1) of m
+matrix block_of(matrix const* m, size_t r0, size_t r1, size_t c0, size_t c1) {
+    matrix block = matrix_new(r1 - r0, c1 - c0);
+    for (size_t r = r0; r < r1; ++r)
+        for (size_t c = c0; c < c1; ++c)
+            matrix_set(&block, r - r0, c - c0, matrix_get(m, r, c));
+    return block;
+}
+
+int test_matrix_summa() {
+    TEST_START("socket_mesh/grid_range/matmul_summa");
+
+    matrix a = matrix_new(5, 7);
+    matrix b = matrix_new(7, 6);
+    for (size_t i = 0; i < matrix_len(&a); ++i)
+        a.values[i] = (double)(i % 5) - 1.0;
+    for (size_t i = 0; i < matrix_len(&b); ++i)
+        b.values[i] = 0.25 * (double)(i % 9);
+    matrix expected = matrix_matmul(&a, &b);
+
+    // Panels of 2 columns, which cross the blocks of the 2x2 grid
+    matrix_tuning saved = matrix_tuning_get();
+    matrix_tuning tuning = saved;
+    tuning.matmul_block_k = 2;
+    matrix_tuning_set(&tuning);
+
+    matrix_transport t;
+    if (!matrix_socket_mesh(4, &t)) {
+        fputs(TEST_FAIL_PREFIX "failed to create a socket mesh\n", stderr);
+        failed = 1;
+        TEST_END;
+    }
+
+    // Workers tuned differently must still follow the panels of rank 0
+    if (t.rank != 0) {
+        tuning.matmul_block_k = 2 + t.rank;
+        matrix_tuning_set(&tuning);
+    }
+
+    size_t r0, r1, k0, k1, c0, c1;
+    matrix_grid_range(5, 2, t.rank / 2, &r0, &r1);
+    matrix_grid_range(7, 2, t.rank % 2, &k0, &k1);
+    matrix a_local = block_of(&a, r0, r1, k0, k1);
+    matrix_grid_range(7, 2, t.rank / 2, &k0, &k1);
+    matrix_grid_range(6, 2, t.rank % 2, &c0, &c1);
+    matrix b_local = block_of(&b, k0, k1, c0, c1);
+    matrix dest_local = matrix_new(r1 - r0, c1 - c0);
+
+    bool ok = matrix_matmul_summa(&t, 2, 2, 7, &a_local, &b_local, &dest_local);
+
+    // Workers send their blocks of the product to rank 0, which checks them
+    if (t.rank != 0) {
+        ok = ok && t.send(&t, 0, dest_local.values, sizeof(double) * matrix_len(&dest_local));
+        matrix_socket_mesh_close(&t);
+        _exit(ok ? 0 : 1);
+    }
+
+    for (size_t rank = 0; ok && rank < 4; ++rank) {
+        matrix_grid_range(5, 2, rank / 2, &r0, &r1);
+        matrix_grid_range(6, 2, rank % 2, &c0, &c1);
+        double block_vals[12];
+        matrix block = {r1 - r0, c1 - c0, rank ? block_vals : dest_local.values};
+        if (rank)
+            ok = t.recv(&t, rank, block_vals, sizeof(double) * matrix_len(&block));
+
+        for (size_t r = r0; ok && r < r1; ++r) {
+            for (size_t c = c0; c < c1; ++c) {
+                if (matrix_get(&block, r - r0, c - c0) != matrix_get(&expected, r, c)) {
+                    fprintf(stderr, TEST_FAIL_PREFIX "dest[%zu][%zu]: expected %f, got %f\n", r,
+                            c, matrix_get(&expected, r, c), matrix_get(&block, r - r0, c - c0));
+                    failed = 1;
+                }
+            }
+        }
+    }
+
+    if (!matrix_socket_mesh_close(&t) || !ok) {
+        fputs(TEST_FAIL_PREFIX "summa or a worker process failed\n", stderr);
+        failed = 1;
+    }
+
+    matrix_tuning_set(&saved);
+    matrix_del(&a_local);
+    matrix_del(&b_local);
+    matrix_del(&dest_local);
+    matrix_del(&a);
+    matrix_del(&b);
+    matrix_del(&expected);
+    TEST_END;
+}
+
+#endif  // MATRIX_DIST
+
+#ifdef MATRIX_COW
+
+int test_matrix_cow() {
+    TEST_START("share/unshare/share_count");
+
+#ifdef MATRIX_TRACK_ALLOCS
+    size_t live_before = matrix_alloc_stats_get().live_allocations;
+#endif
+
+    matrix m = matrix_new_repeated(2, 2, 1.0);
+    matrix s = matrix_share(&m);
+    TEST_SIZE_EQ("share_count(m)", 2lu, matrix_share_count(&m));
+    if (s.values != m.values) {
+        fputs(TEST_FAIL_PREFIX "matrix_share copied the buffer\n", stderr);
+        failed = 1;
+    }
+
+    // The first write gives the writer its own copy
+    matrix_add_scalar(&s, 1.0);
+    TEST_DEQ("s[0][0]", 2.0, matrix_get(&s, 0, 0));
+    TEST_DEQ("m[0][0]", 1.0, matrix_get(&m, 0, 0));
+    TEST_SIZE_EQ("share_count(m)", 1lu, matrix_share_count(&m));
+    TEST_SIZE_EQ("share_count(s)", 1lu, matrix_share_count(&s));
+
+    // Deleting a sharer leaves the buffer to the others, and the last one owns it again
+    matrix t = matrix_share(&m);
+    matrix u = matrix_share(&m);
+    TEST_SIZE_EQ("share_count(u)", 3lu, matrix_share_count(&u));
+    matrix_set(&t, 1, 1, 9.0);
+    TEST_DEQ("t[1][1]", 9.0, matrix_get(&t, 1, 1));
+    TEST_DEQ("u[1][1]", 1.0, matrix_get(&u, 1, 1));
+    matrix_del(&m);
+    TEST_SIZE_EQ("share_count(u)", 1lu, matrix_share_count(&u));
+    double* u_values = u.values;
+    matrix_fill_scalar(&u, 3.0);
+    if (u.values != u_values) {
+        fputs(TEST_FAIL_PREFIX "unshared matrix copied on write\n", stderr);
+        failed = 1;
+    }
+
+    // Overwriting a shared destination doesn't touch the other sharers
+    matrix v = matrix_share(&u);
+    matrix_copy_into(&s, &v);
+    TEST_DEQ("v[0][1]", 2.0, matrix_get(&v, 0, 1));
+    TEST_DEQ("u[0][1]", 3.0, matrix_get(&u, 0, 1));
+
+    matrix w = matrix_share(&u);
+    matrix_unshare(&w);
+    TEST_DEQ("w[1][0]", 3.0, matrix_get(&w, 1, 0));
+    if (w.values == u.values) {
+        fputs(TEST_FAIL_PREFIX "matrix_unshare kept the shared buffer\n", stderr);
+        failed = 1;
+    }
+
+    // Many shared buffers at once, removed in a different order than added
+    matrix many[100], shares[100];
+    for (int i = 0; i < 100; ++i) {
+        many[i] = matrix_new_repeated(1, 1, (double)i);
+        shares[i] = matrix_share(&many[i]);
+    }
+    for (int i = 0; i < 100; i += 2)
+        matrix_del(&many[i]);
+    for (int i = 0; i < 100; ++i) {
+        size_t expected = i % 2 ? 2 : 1;
+        if (matrix_share_count(&shares[i]) != expected ||
+            matrix_get(&shares[i], 0, 0) != (double)i) {
+            fprintf(stderr, TEST_FAIL_PREFIX "shares[%d] broken\n", i);
+            failed = 1;
+            break;
+        }
+    }
+    for (int i = 0; i < 100; ++i) {
+        matrix_del(&shares[i]);
+        if (i % 2)
+            matrix_del(&many[i]);
+    }
+
+    // Views starting at the first row of a shared matrix don't hold a reference to its buffer
+    matrix x = matrix_new_repeated(4, 2, 5.0);
+    matrix y = matrix_share(&x);
+    matrix top = matrix_rows(&x, 0, 2);
+    TEST_SIZE_EQ("share_count(top)", 1lu, matrix_share_count(&top));
+    if (!matrix_unshare(&top) || top.values != x.values) {
+        fputs(TEST_FAIL_PREFIX "matrix_unshare copied a view\n", stderr);
+        failed = 1;
+    }
+    TEST_SIZE_EQ("share_count(x)", 2lu, matrix_share_count(&x));
+    matrix z = matrix_share(&top);
+    if (z.values == x.values) {
+        fputs(TEST_FAIL_PREFIX "matrix_share shared a view\n", stderr);
+        failed = 1;
+    }
+    TEST_SIZE_EQ("share_count(x)", 2lu, matrix_share_count(&x));
+    TEST_DEQ("z[1][1]", 5.0, matrix_get(&z, 1, 1));
+
+    // Functions writing into raw buffers don't treat their own wrappers as sharers
+    matrix ident = matrix_new_zeroed(2, 2);
+    matrix_set(&ident, 0, 0, 1.0);
+    matrix_set(&ident, 1, 1, 1.0);
+    matrix_kron_op op = {&ident, &ident};
+    matrix y1 = matrix_new_zeroed(2, 2);
+    matrix y2 = matrix_share(&y1);
+    double x_vals[4] = {1.0, 2.0, 3.0, 4.0};
+    double scratch[4];
+    matrix_kron_matvec(&op, x_vals, y1.values, scratch);
+    TEST_SIZE_EQ("share_count(y1)", 2lu, matrix_share_count(&y1));
+    TEST_DEQ("y2[1][1]", 4.0, matrix_get(&y2, 1, 1));
+
+    matrix_del(&s);
+    matrix_del(&t);
+    matrix_del(&u);
+    matrix_del(&v);
+    matrix_del(&w);
+    matrix_del(&x);
+    matrix_del(&y);
+    matrix_del(&z);
+    matrix_del(&ident);
+    matrix_del(&y1);
+    matrix_del(&y2);
+
+#ifdef MATRIX_TRACK_ALLOCS
+    TEST_SIZE_EQ("live_allocations", live_before, matrix_alloc_stats_get().live_allocations);
+#endif
+
+    TEST_END;
+}
+
+#endif  // MATRIX_COW
+
+#ifdef MATRIX_THREADS
+
+typedef struct {
+    int touched[1000];
+    int misaligned;
+} parallel_for_ctx;
+
+void touch_range(void* ctx, size_t begin, size_t end) {
+    parallel_for_ctx* c = ctx;
+    if (begin % 8)
+        c->misaligned = 1;
+    for (size_t i = begin; i < end; ++i)
+        ++c->touched[i];
+}
+
+int test_matrix_threads() {
+    TEST_START("threads_init/threads_count/parallel_for");
+
+    if (matrix_threads_count() != 4 || matrix_threads_init(2)) {
+        fputs(TEST_FAIL_PREFIX "thread pool not running with 4 threads\n", stderr);
+        failed = 1;
+    }
+
+    for (int round = 0; round < 3; ++round) {
+        parallel_for_ctx ctx = {{0}, 0};
+        matrix__parallel_for(1000, 8, touch_range, &ctx);
+
+        for (size_t i = 0; i < 1000; ++i) {
+            if (ctx.touched[i] != 1) {
+                fprintf(stderr, TEST_FAIL_PREFIX "element %zu touched %d times\n", i,
+                        ctx.touched[i]);
+                failed = 1;
+                break;
+            }
+        }
+        if (ctx.misaligned) {
+            fputs(TEST_FAIL_PREFIX "range not aligned to the grain\n", stderr);
+            failed = 1;
+        }
+    }
+
+#ifdef MATRIX_HUGEPAGES
+    matrix big = matrix_new_zeroed(512, 512);
+    if ((uintptr_t)big.values % 64) {
+        fputs(TEST_FAIL_PREFIX "huge page matrix not aligned\n", stderr);
+        failed = 1;
+    }
+    for (size_t i = 0; i < 512 * 512; ++i) {
+        if (big.values[i] != 0.0) {
+            fprintf(stderr, TEST_FAIL_PREFIX "huge page matrix not zeroed at %zu\n", i);
+            failed = 1;
+            break;
+        }
+    }
+    matrix_fill_scalar(&big, 2.0);
+    if (big.values[512 * 512 - 1] != 2.0) {
+        fputs(TEST_FAIL_PREFIX "huge page matrix not writable\n", stderr);
+        failed = 1;
+    }
+    matrix_del(&big);
+#endif
+
+    TEST_END;
+}
+
+double halve(double x) { return 0.5 * x; }
+
+int test_matrix_parallel_elementwise() {
+    TEST_START("parallel add/sub/mul/scalar ops/fill_scalar/map/copy_into");
+
+    // Above MATRIX_PARALLEL_THRESHOLD, and starting in the middle of a cache line
+    size_t len = 3 * MATRIX_PARALLEL_THRESHOLD + 5;
+    double* a_vals = malloc(sizeof(double) * (len + 1));
+    double* b_vals = malloc(sizeof(double) * len);
+    matrix a = {1, len, a_vals + 1};
+    matrix b = {1, len, b_vals};
+
+    matrix_fill_scalar(&a, 3.0);
+    for (size_t i = 0; i < len; ++i)
+        b.values[i] = (double)(i % 17);
+
+    matrix_add(&a, &b);          // 3 + b
+    matrix_mul_scalar(&a, 2.0);  // 6 + 2b
+    matrix_sub(&a, &b);          // 6 + b
+    matrix_mul(&a, &b);          // 6b + b^2
+    matrix_add_scalar(&a, 9.0);  // (b + 3)^2
+    matrix_pow_scalar(&a, 0.5);  // b + 3
+    matrix_sub_scalar(&a, 1.0);  // b + 2
+    matrix_map(&a, halve);       // b/2 + 1
+    matrix_copy_into(&a, &b);
+
+    for (size_t i = 0; i < len; ++i) {
+        double expected = (double)(i % 17) / 2.0 + 1.0;
+        if (b.values[i] != expected) {
+            fprintf(stderr, TEST_FAIL_PREFIX "values[%zu]: expected %f, got %f\n", i, expected,
+                    b.values[i]);
+            failed = 1;
+            break;
+        }
+    }
+
+    free(a_vals);
+    free(b_vals);
+    TEST_END;
+}
+
+/// Computes a sum and two products (short and tall) on `threads` threads
+void run_reductions(size_t threads, matrix const* v, matrix const* a, matrix const* b,
+                    double* sum, matrix* short_dest, matrix* tall_dest) {
+    matrix_threads_shutdown();
+    matrix_threads_init(threads);
+
+    *sum = matrix_sum(v);
+    matrix a_short = matrix_rows(a, 0, short_dest->height);
+    matrix_matmul_into(&a_short, b, short_dest);
+    matrix_matmul_into(a, b, tall_dest);
+}
+
+/// Returns true if a and b have bit-identical cells
+bool same_bits(matrix const* a, matrix const* b) {
+    return memcmp(a->values, b->values, sizeof(double) * matrix_len(a)) == 0;
+}
+
+int test_matrix_deterministic() {
+    TEST_START("deterministic sum/matmul across thread counts");
+
+    // Sums of such values depend on the order of the additions
+    size_t len = 5 * MATRIX_PARALLEL_THRESHOLD + 3;
+    matrix v = matrix_new(1, len);
+    for (size_t i = 0; i < len; ++i)
+        v.values[i] = 1.0 / (double)(i + 1);
+
+    // Above MATRIX_MATMUL_PARALLEL_THRESHOLD, with several k panels
+    matrix a = matrix_new(64, 4 * MATRIX_MATMUL_BLOCK_K + 5);
+    matrix b = matrix_new(4 * MATRIX_MATMUL_BLOCK_K + 5, 300);
+    for (size_t i = 0; i < matrix_len(&a); ++i)
+        a.values[i] = 1.0 / (double)(i % 97 + 1);
+    for (size_t i = 0; i < matrix_len(&b); ++i)
+        b.values[i] = 1.0 / (double)(i % 89 + 1) - 0.02;
+
+    matrix short_dests[3], tall_dests[3];
+    double sums[3];
+    size_t thread_counts[3] = {1, 3, 4};
+    bool was_deterministic = matrix_deterministic_get();
+
+    for (int mode = 0; mode < 2; ++mode) {
+        matrix_deterministic_set(mode == 1);
+        for (int i = 0; i < 3; ++i) {
+            short_dests[i] = matrix_new(2, b.width);
+            tall_dests[i] = matrix_new(a.height, b.width);
+            run_reductions(thread_counts[i], &v, &a, &b, &sums[i], &short_dests[i],
+                           &tall_dests[i]);
+        }
+
+        for (int i = 1; i < 3; ++i) {
+            // Splitting by rows never changes the results
+            if (!same_bits(&tall_dests[0], &tall_dests[i])) {
+                fprintf(stderr, TEST_FAIL_PREFIX "tall matmul differs on %zu threads\n",
+                        thread_counts[i]);
+                failed = 1;
+            }
+
+            if (mode == 1 && (sums[i] != sums[0] || !same_bits(&short_dests[0], &short_dests[i]))) {
+                fprintf(stderr, TEST_FAIL_PREFIX "deterministic results differ on %zu threads\n",
+                        thread_counts[i]);
+                failed = 1;
+            }
+
+            if (fabs(sums[i] - sums[0]) > 1e-9) {
+                fprintf(stderr, TEST_FAIL_PREFIX "sum on %zu threads: expected %f, got %f\n",
+                        thread_counts[i], sums[0], sums[i]);
+                failed = 1;
+            }
+            for (size_t j = 0; j < matrix_len(&short_dests[0]); ++j) {
+                if (fabs(short_dests[i].values[j] - short_dests[0].values[j]) > 1e-9) {
+                    fprintf(stderr, TEST_FAIL_PREFIX "short matmul differs on %zu threads\n",
+                            thread_counts[i]);
+                    failed = 1;
+                    break;
+                }
+            }
+        }
+
+        for (int i = 0; i < 3; ++i) {
+            matrix_del(&short_dests[i]);
+            matrix_del(&tall_dests[i]);
+        }
+    }
+
+    matrix_deterministic_set(was_deterministic);
+    matrix_threads_shutdown();
+    matrix_threads_init(4);
+    matrix_del(&v);
+    matrix_del(&a);
+    matrix_del(&b);
+    TEST_END;
+}
+
+int test_matrix_async() {
+    TEST_START("matmul_async/transpose_async/copy_into_async/fill_scalar_async/poll/wait");
+
+    matrix a = matrix_new(40, 30);
+    matrix b = matrix_new(30, 20);
+    for (size_t i = 0; i < matrix_len(&a); ++i)
+        a.values[i] = (double)(i % 11) - 5.0;
+    for (size_t i = 0; i < matrix_len(&b); ++i)
+        b.values[i] = (double)(i % 7);
+    matrix expected = matrix_matmul(&a, &b);
+    matrix dest = matrix_new(40, 20);
+    matrix copy = matrix_new(40, 30);
+
+    matrix_future* product = matrix_matmul_async(&a, &b, &dest);
+    matrix_future* copied = matrix_copy_into_async(&a, &copy);
+    matrix_wait(copied);
+    matrix_future* transposed = matrix_transpose_async(&copy);
+
+    // Many small tasks, so that some are waited for before any thread starts them
+    double fill_vals[16][4];
+    matrix fills[16];
+    matrix_future* filled[16];
+    for (int i = 0; i < 16; ++i) {
+        fills[i] = (matrix){2, 2, fill_vals[i]};
+        filled[i] = matrix_fill_scalar_async(&fills[i], i);
+    }
+    for (int i = 15; i >= 0; --i) {
+        matrix_wait(filled[i]);
+        TEST_DEQ("fills[i][1][1]", (double)i, matrix_get(&fills[i], 1, 1));
+    }
+
+    matrix_wait(product);
+    matrix_wait(transposed);
+    for (size_t i = 0; i < matrix_len(&dest); ++i) {
+        if (dest.values[i] != expected.values[i]) {
+            fprintf(stderr, TEST_FAIL_PREFIX "dest.values[%zu]: expected %f, got %f\n", i,
+                    expected.values[i], dest.values[i]);
+            failed = 1;
+            break;
+        }
+    }
+    TEST_SIZE_EQ("copy.height", 30lu, copy.height);
+    TEST_DEQ("copy[7][3]", matrix_get(&a, 3, 7), matrix_get(&copy, 7, 3));
+
+    // Without a pool, operations are done before returning
+    matrix_threads_shutdown();
+    matrix_future* sync = matrix_fill_scalar_async(&dest, 1.0);
+    if (!matrix_poll(sync)) {
+        fputs(TEST_FAIL_PREFIX "operation not done without a pool\n", stderr);
+        failed = 1;
+    }
+    matrix_wait(sync);
+    TEST_DEQ("dest[0][0]", 1.0, matrix_get(&dest, 0, 0));
+    matrix_threads_init(4);
+
+    matrix_del(&a);
+    matrix_del(&b);
+    matrix_del(&expected);
+    matrix_del(&dest);
+    matrix_del(&copy);
+    TEST_END;
+}
+
+/// Pool task occupying a pool thread until released
+typedef struct {
+    matrix__task task;
+    atomic_bool started;
+    atomic_bool release;
+    atomic_bool finished;
+} blocking_task;
+
+void blocking_task_run(matrix__task* task) {
+    blocking_task* t = (blocking_task*)task;
+    atomic_store(&t->started, true);
+    while (!atomic_load(&t->release))
+        sched_yield();
+    atomic_store(&t->finished, true);
+}
+
+/// Range function checking whether at least 2 ranges ever run at the same time
+typedef struct {
+    atomic_size_t running;
+    atomic_bool overlapped;
+} overlap_ctx;
+
+void overlap_range(void* ctx, size_t begin, size_t end) {
+    (void)begin;
+    (void)end;
+    overlap_ctx* c = ctx;
+    atomic_fetch_add(&c->running, 1);
+
+    time_t deadline = time(NULL) + 2;
+    while (atomic_load(&c->running) < 2 && time(NULL) < deadline)
+        sched_yield();
+    if (atomic_load(&c->running) >= 2)
+        atomic_store(&c->overlapped, true);
+}
+
+/// Pool task running a parallel loop of `overlap_range`
+typedef struct {
+    matrix__task task;
+    overlap_ctx ctx;
+    atomic_bool finished;
+} overlap_task;
+
+void overlap_task_run(matrix__task* task) {
+    overlap_task* t = (overlap_task*)task;
+    matrix__parallel_for(4, 1, overlap_range, &t->ctx);
+    atomic_store(&t->finished, true);
+}
+
+int test_matrix_async_overlap() {
+    TEST_START("async/parallel_for overlap");
+
+    // A parallel loop must not wait for a pool thread busy with a queued task
+    blocking_task blocker = {{blocking_task_run, NULL}, false, false, false};
+    matrix__pool_submit(&blocker.task);
+    while (!atomic_load(&blocker.started))
+        sched_yield();
+
+    parallel_for_ctx ctx = {{0}, 0};
+    matrix__parallel_for(1000, 8, touch_range, &ctx);
+    for (size_t i = 0; i < 1000; ++i) {
+        if (ctx.touched[i] != 1) {
+            fprintf(stderr, TEST_FAIL_PREFIX "element %zu touched %d times\n", i,
+                    ctx.touched[i]);
+            failed = 1;
+            break;
+        }
+    }
+
+    // ...and a loop inside of a queued task is split across the idle pool threads
+    overlap_task overlapping = {{overlap_task_run, NULL}, {0, false}, false};
+    matrix__pool_submit(&overlapping.task);
+    while (!atomic_load(&overlapping.finished))
+        sched_yield();
+    if (!atomic_load(&overlapping.ctx.overlapped)) {
+        fputs(TEST_FAIL_PREFIX "parallel loop of a queued task ran serially\n", stderr);
+        failed = 1;
+    }
+
+    atomic_store(&blocker.release, true);
+    while (!atomic_load(&blocker.finished))
+        sched_yield();
+    TEST_END;
+}
+
+int test_matrix_async_fork() {
+    TEST_START("async/fork");
+
+    matrix a = matrix_new_repeated(64, 64, 0.5);
+    matrix b = matrix_new_repeated(64, 64, 2.0);
+    matrix dest = matrix_new(64, 64);
+    double fill_vals[32][4];
+    matrix fills[32];
+    matrix_future* filled[32];
+
+    // Fork while operations are queued and running on the pool
+    matrix_future* product = matrix_matmul_async(&a, &b, &dest);
+    for (int i = 0; i < 32; ++i) {
+        fills[i] = (matrix){2, 2, fill_vals[i]};
+        filled[i] = matrix_fill_scalar_async(&fills[i], i);
+    }
+    pid_t pid = fork();
+
+    // Both processes must finish every operation, and keep using the library afterwards
+    matrix_wait(product);
+    for (int i = 0; i < 32; ++i) {
+        matrix_wait(filled[i]);
+        TEST_DEQ("fills[i][0][1]", (double)i, matrix_get(&fills[i], 0, 1));
+    }
+    TEST_DEQ("dest[5][7]", 64.0, matrix_get(&dest, 5, 7));
+
+    matrix big = matrix_new_repeated(600, 600, 1.0);
+    TEST_DEQ("sum(big)", 360000.0, matrix_sum(&big));
+    matrix_del(&big);
+
+    if (pid == 0)
+        _exit(failed);
+
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        fputs(TEST_FAIL_PREFIX "forked child failed\n", stderr);
+        failed = 1;
+    }
+
+    matrix_del(&a);
+    matrix_del(&b);
+    matrix_del(&dest);
+    TEST_END;
+}
+
+typedef struct {
+    matrix const* a;
+    matrix const* b;
+    matrix* dest;
+} tile_matmul_ctx;
+
+void tile_matmul_add(void* ctx) {
+    tile_matmul_ctx* c = ctx;
+    double product_vals[16];
+    matrix product = {c->dest->height, c->dest->width, product_vals};
+    matrix_matmul_into(c->a, c->b, &product);
+    matrix_add(c->dest, &product);
+}
+
+typedef struct {
+    int* log;
+    int* log_len;
+    int value;
+} log_ctx;
+
+void append_to_log(void* ctx) {
+    log_ctx* c = ctx;
+    c->log[(*c->log_len)++] = c->value;
+}
+
+int test_matrix_graph() {
+    TEST_START("graph_new/graph_add/graph_run/graph_del");
+
+    // 3x3 grid of 4x4 tiles: dest_ij = sum_k a_ik * b_kj
+    double a_vals[9][16], b_vals[9][16], dest_vals[9][16];
+    matrix a[9], b[9], dest[9];
+    for (int t = 0; t < 9; ++t) {
+        for (int i = 0; i < 16; ++i) {
+            a_vals[t][i] = (double)((t * 16 + i) % 13) - 6.0;
+            b_vals[t][i] = (double)((t * 7 + i) % 5);
+        }
+        a[t] = (matrix){4, 4, a_vals[t]};
+        b[t] = (matrix){4, 4, b_vals[t]};
+        dest[t] = (matrix){4, 4, dest_vals[t]};
+        matrix_fill_scalar(&dest[t], 0.0);
+    }
+
+    matrix_graph* g = matrix_graph_new();
+    tile_matmul_ctx ctxs[27];
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            for (int k = 0; k < 3; ++k) {
+                tile_matmul_ctx* c = &ctxs[(i * 3 + j) * 3 + k];
+                *c = (tile_matmul_ctx){&a[i * 3 + k], &b[k * 3 + j], &dest[i * 3 + j]};
+                void const* reads[3] = {c->a->values, c->b->values, c->dest->values};
+                void const* writes[1] = {c->dest->values};
+                if (!matrix_graph_add(g, tile_matmul_add, c, reads, 3, writes, 1))
+                    failed = 1;
+            }
+        }
+    }
+    if (!matrix_graph_run(g))
+        failed = 1;
+
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            double expected_vals[16] = {0}, product_vals[16];
+            matrix expected = {4, 4, expected_vals};
+            matrix product = {4, 4, product_vals};
+            for (int k = 0; k < 3; ++k) {
+                matrix_matmul_into(&a[i * 3 + k], &b[k * 3 + j], &product);
+                matrix_add(&expected, &product);
+            }
+            for (int c = 0; c < 16; ++c) {
+                if (expected_vals[c] != dest_vals[i * 3 + j][c]) {
+                    fprintf(stderr, TEST_FAIL_PREFIX "tile (%d, %d)[%d]: expected %f, got %f\n",
+                            i, j, c, expected_vals[c], dest_vals[i * 3 + j][c]);
+                    failed = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Writes of the same data keep their order, and reads wait for them
+    int log[64], log_len = 0;
+    log_ctx logs[64];
+    void const* data[1] = {log};
+    for (int i = 0; i < 64; ++i) {
+        logs[i] = (log_ctx){log, &log_len, i};
+        matrix_graph_add(g, append_to_log, &logs[i], NULL, 0, data, 1);
+    }
+    matrix_graph_run(g);
+    TEST_SIZE_EQ("log_len", 64lu, (size_t)log_len);
+    for (int i = 0; i < log_len; ++i) {
+        if (log[i] != i) {
+            fprintf(stderr, TEST_FAIL_PREFIX "log[%d]: expected %d, got %d\n", i, i, log[i]);
+            failed = 1;
+            break;
+        }
+    }
+
+    matrix_graph_del(g);
+    TEST_END;
+}
+
+#endif  // MATRIX_THREADS
+
 // Entry point
 
 int main() {
-    int total_tests = 18;
+    int total_tests = 32;
     int failed = 0;
 
+#ifdef MATRIX_THREADS
+    matrix_threads_init(4);
+#endif
+
     failed += test_matrix_new_get_set();
     failed += test_matrix_new_zeroed();
     failed += test_matrix_new_repeated();
@@ -376,11 +1985,72 @@ int main() {
     failed += test_matrix_mul_scalar();
     failed += test_matrix_pow_scalar();
     failed += test_matrix_map();
+    failed += test_matrix_sum();
     failed += test_matrix_matmul();
+    failed += test_matrix_matmul_blocked();
+    failed += test_matrix_matmul_packed();
+    failed += test_matrix_matmul_semiring();
+    failed += test_matrix_bits();
+    failed += test_matrix_bits_elementwise();
+    failed += test_matrix_bits_matmul();
+    failed += test_matrix_structured();
+    failed += test_matrix_tridiag_solve();
+    failed += test_matrix_kron();
     failed += test_matrix_transpose_column();
     failed += test_matrix_transpose_square();
     failed += test_matrix_transpose_rectangle();
     failed += test_matrix_transpose_huge_rectangle();
+    failed += test_matrix_transpose_blocked();
+    failed += test_matrix_tuning();
+    failed += test_matrix_streaming();
+    failed += test_matrix_matmul_ooc();
+
+#ifdef MATRIX_INSTRUMENT
+    total_tests += 1;
+    failed += test_matrix_instrument();
+#endif
+
+#ifdef MATRIX_TRACE
+    total_tests += 1;
+    failed += test_matrix_trace();
+#endif
+
+#ifdef MATRIX_TRACK_ALLOCS
+    total_tests += 1;
+    failed += test_matrix_alloc_stats();
+#endif
+
+#ifdef MATRIX_MMAP
+    total_tests += 1;
+    failed += test_matrix_mapped();
+#endif
+
+#ifdef MATRIX_SHM
+    total_tests += 1;
+    failed += test_matrix_shm();
+#endif
+
+#ifdef MATRIX_DIST
+    total_tests += 1;
+    failed += test_matrix_summa();
+#endif
+
+#ifdef MATRIX_COW
+    total_tests += 1;
+    failed += test_matrix_cow();
+#endif
+
+#ifdef MATRIX_THREADS
+    total_tests += 7;
+    failed += test_matrix_threads();
+    failed += test_matrix_parallel_elementwise();
+    failed += test_matrix_deterministic();
+    failed += test_matrix_async();
+    failed += test_matrix_async_overlap();
+    failed += test_matrix_async_fork();
+    failed += test_matrix_graph();
+    matrix_threads_shutdown();
+#endif
 
     int succeeded = total_tests - failed;
     fprintf(stderr,
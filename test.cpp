@@ -0,0 +1,296 @@
+#include <cstdio>
+#include <type_traits>
+#include <utility>
+
+#include "matrix.hpp"
+
+// Small helper macros
+
+#define TEST_START(name_str) \
+    int failed = 0;          \
+    fputs("Running test: " name_str "\n", stderr);
+
+#define TEST_END                    \
+    if (!failed)                    \
+        fputs("    ✅\n\n", stderr); \
+    else                            \
+        fputc('\n', stderr);        \
+    return failed;
+
+#define TEST_FAIL_PREFIX "    ❌ "
+
+#define TEST_DEQ(msg, expected, got)                                          \
+    if ((expected) != (got)) {                                                \
+        fprintf(stderr, TEST_FAIL_PREFIX "%s - expected %f, got %f\n", (msg), \
+                (expected), (got));                                           \
+        failed = 1;                                                           \
+    }
+
+#define TEST_SIZE_EQ(msg, expected, got)                                 \
+    if ((expected) != (got)) {                                           \
+        fprintf(stderr, TEST_FAIL_PREFIX "%s - expected %zu, got %zu\n", \
+                (msg), (expected), (got));                               \
+        failed = 1;                                                      \
+    }
+
+#define TEST_TRUE(msg, cond)                              \
+    if (!(cond)) {                                        \
+        fprintf(stderr, TEST_FAIL_PREFIX "%s\n", (msg)); \
+        failed = 1;                                       \
+    }
+
+// Compile-time guarantees
+
+static_assert(!std::is_copy_constructible<mx::Matrix>::value, "Matrix must be move-only");
+static_assert(!std::is_copy_assignable<mx::Matrix>::value, "Matrix must be move-only");
+static_assert(std::is_nothrow_move_constructible<mx::Matrix>::value, "moves must not throw");
+static_assert(std::is_nothrow_move_assignable<mx::Matrix>::value, "moves must not throw");
+static_assert(std::is_trivially_copy_constructible<mx::MatrixView>::value,
+              "views must be cheap to copy");
+static_assert(!std::is_convertible<mx::MatrixView, mx::Matrix>::value,
+              "expressions must only be evaluated into new matrices explicitly");
+static_assert(std::is_same<decltype(std::declval<mx::Matrix const&>().rows(0, 1)),
+                           mx::ConstMatrixView>::value,
+              "const matrices must only give read-only views");
+static_assert(!std::is_convertible<mx::ConstMatrixView, mx::MatrixView>::value,
+              "read-only views must not become writable");
+
+// Test functions
+
+int test_matrix_ownership() {
+    TEST_START("Matrix moves/adopt/release/clone");
+
+    mx::Matrix a(2, 3, 1.5);
+    TEST_SIZE_EQ("a.height()", 2lu, a.height());
+    TEST_SIZE_EQ("a.width()", 3lu, a.width());
+    TEST_DEQ("a(1, 2)", 1.5, a(1, 2));
+
+    double const* buffer = a.data();
+    mx::Matrix b(std::move(a));
+    TEST_TRUE("move didn't transfer the buffer", b.data() == buffer);
+    TEST_TRUE("moved-from matrix not empty", a.empty() && a.data() == nullptr);
+
+    mx::Matrix c(4, 4);
+    double const* old_buffer = c.data();
+    c = std::move(b);
+    TEST_TRUE("move assignment didn't transfer the buffer", c.data() == buffer);
+    TEST_TRUE("move assignment didn't swap the buffers", b.data() == old_buffer);
+    TEST_SIZE_EQ("c.height()", 2lu, c.height());
+    TEST_SIZE_EQ("b.height()", 4lu, b.height());
+
+    mx::Matrix d = c.clone();
+    d(0, 0) = -1.0;
+    TEST_TRUE("clone shares the buffer", d.data() != c.data());
+    TEST_DEQ("c(0, 0)", 1.5, c(0, 0));
+
+    matrix raw = d.release();
+    TEST_TRUE("released matrix not empty", d.empty());
+    mx::Matrix e = mx::Matrix::adopt(raw);
+    TEST_DEQ("e(0, 0)", -1.0, e(0, 0));
+
+    e.reset();
+    TEST_TRUE("reset matrix not empty", e.empty() && e.data() == nullptr);
+
+    mx::Matrix empty(0, 5);
+    TEST_SIZE_EQ("empty.width()", 5lu, empty.width());
+    TEST_TRUE("0x5 matrix has a buffer", empty.data() == nullptr);
+
+    TEST_END;
+}
+
+int test_matrix_expressions() {
+    TEST_START("Matrix/MatrixView expressions");
+
+    mx::Matrix a(2, 2), b(2, 2);
+    for (size_t i = 0; i < 4; ++i) {
+        a[i] = (double)i;
+        b[i] = 10.0 * (double)(i + 1);
+    }
+
+    mx::Matrix c(a * 2.0 + b);
+    TEST_DEQ("c[0]", 10.0, c[0]);
+    TEST_DEQ("c[3]", 46.0, c[3]);
+
+    // Same shape - evaluated in-place, even with c among the operands
+    double const* buffer = c.data();
+    c = (c - b) / 2.0 - 1.0;
+    TEST_TRUE("assignment reallocated", c.data() == buffer);
+    TEST_DEQ("c[1]", 0.0, c[1]);
+    TEST_DEQ("c[3]", 2.0, c[3]);
+
+    c = -a + 3.0 * mx::hadamard(a, a) + (1.0 - a);
+    TEST_DEQ("c[2]", 9.0, c[2]);
+
+    c += a;
+    c -= 2.0 * a;
+    c *= 2.0;
+    c += 1.0;
+    TEST_DEQ("c[2]", 15.0, c[2]);
+
+    // Different shape - the buffer is replaced
+    mx::Matrix row(1, 2, 5.0);
+    c = row * 2.0;
+    TEST_SIZE_EQ("c.height()", 1lu, c.height());
+    TEST_DEQ("c(0, 1)", 10.0, c(0, 1));
+
+    // Views write into the viewed cells
+    mx::MatrixView bottom = b.rows(1, 1);
+    bottom = row + row;
+    TEST_DEQ("b(1, 0)", 10.0, b(1, 0));
+    TEST_DEQ("b(0, 1)", 20.0, b(0, 1));
+
+    double ext_vals[2] = {0.0, 0.0};
+    mx::MatrixView ext(1, 2, ext_vals);
+    ext = bottom;
+    TEST_DEQ("ext_vals[1]", 10.0, ext_vals[1]);
+
+    TEST_END;
+}
+
+int test_matrix_library_ops() {
+    TEST_START("sum/matmul/transpose/c_matrix");
+
+    mx::Matrix a(2, 3), b(3, 2);
+    for (size_t i = 0; i < 6; ++i) {
+        a[i] = (double)(i + 1);
+        b[i] = (double)(6 - i);
+    }
+
+    TEST_DEQ("sum(a)", 21.0, mx::sum(a));
+
+    mx::Matrix c = mx::matmul(a, b);
+    TEST_SIZE_EQ("c.height()", 2lu, c.height());
+    TEST_DEQ("c(0, 0)", 20.0, c(0, 0));
+    TEST_DEQ("c(1, 1)", 41.0, c(1, 1));
+
+    a.transpose();
+    TEST_SIZE_EQ("a.height()", 3lu, a.height());
+    TEST_DEQ("a(2, 0)", 3.0, a(2, 0));
+
+    matrix_mul_scalar(c.c_matrix(), 0.5);
+    TEST_DEQ("c(0, 0)", 10.0, c(0, 0));
+
+    double total = 0.0;
+    for (double x : a.rows(1, 2))
+        total += x;
+    TEST_DEQ("sum of a.rows(1, 2)", 16.0, total);
+
+    mx::Matrix const& ca = a;
+    mx::ConstMatrixView top = ca.rows(0, 1);
+    TEST_DEQ("sum(ca.rows(0, 1))", 5.0, mx::sum(top));
+    mx::Matrix d = mx::matmul(top, c);
+    TEST_SIZE_EQ("d.width()", 2lu, d.width());
+    TEST_DEQ("d(0, 0)", 122.0, d(0, 0));
+
+    TEST_END;
+}
+
+#ifdef MATRIX_COW
+
+int test_matrix_cow() {
+    TEST_START("assignments to shared matrices");
+
+    mx::Matrix a(2, 2, 1.0);
+    matrix shared = matrix_share(a.c_matrix());
+
+    // Same shape - evaluated in-place, into a copy of the shared buffer
+    a = a * 2.0 + 1.0;
+    TEST_DEQ("a(1, 1)", 3.0, a(1, 1));
+    TEST_DEQ("shared[1][1]", 1.0, matrix_get(&shared, 1, 1));
+    TEST_SIZE_EQ("share_count(shared)", 1lu, matrix_share_count(&shared));
+
+    // v takes over the reference held by `shared`
+    mx::MatrixView v(shared);
+    matrix again = matrix_share(&shared);
+    v += a;
+    TEST_DEQ("v(0, 1)", 4.0, v(0, 1));
+    TEST_DEQ("again[0][1]", 1.0, matrix_get(&again, 0, 1));
+
+    matrix_del(v.c_matrix());
+    matrix_del(&again);
+
+    // Library operations write into the Matrix itself, not into a copy of its view
+    mx::Matrix m(2, 2, 0.0);
+    matrix m_shared = matrix_share(m.c_matrix());
+    mx::matmul_into(a, a, m);
+    TEST_DEQ("m(1, 0)", 18.0, m(1, 0));
+    TEST_DEQ("m_shared[1][0]", 0.0, matrix_get(&m_shared, 1, 0));
+    TEST_SIZE_EQ("share_count(m_shared)", 1lu, matrix_share_count(&m_shared));
+    matrix_del(&m_shared);
+
+    mx::matmul_into(a.rows(0, 1), a, m.rows(1, 1));
+    TEST_DEQ("m(1, 1)", 18.0, m(1, 1));
+    TEST_END;
+}
+
+#endif  // MATRIX_COW
+
+#ifdef __cpp_lib_mdspan
+
+int test_matrix_mdspan() {
+    TEST_START("to_mdspan/to_strided_mdspan/from_mdspan/is_row_major");
+
+    mx::Matrix a(2, 3);
+    for (size_t i = 0; i < 6; ++i)
+        a[i] = (double)i;
+
+    mx::mdspan s = mx::to_mdspan(a);
+    TEST_TRUE("mdspan doesn't share the cells", s.data_handle() == a.data());
+    TEST_DEQ("s[1, 2]", 5.0, (s[1, 2]));
+
+    mx::strided_mdspan t = mx::to_strided_mdspan(a, true);
+    TEST_SIZE_EQ("t.extent(0)", 3lu, t.extent(0));
+    TEST_DEQ("t[2, 1]", 5.0, (t[2, 1]));
+    TEST_TRUE("transposed mdspan is row-major", !mx::is_row_major(t));
+
+    // Third-party buffers can be passed to the library's kernels
+    double ext_vals[6] = {1.0, 2.0, 3.0, 4.0, 5.0, 6.0};
+    std::mdspan<double, std::extents<size_t, 3, 2>> ext(ext_vals);
+    mx::MatrixView v = mx::from_mdspan(ext);
+    TEST_TRUE("view doesn't share the cells", v.data() == ext_vals);
+    mx::Matrix c = mx::matmul(a, v);
+    TEST_DEQ("c(1, 1)", 52.0, c(1, 1));
+
+    mx::MatrixView row_major = mx::from_mdspan(mx::to_strided_mdspan(c));
+    row_major *= 2.0;
+    TEST_DEQ("c(0, 0)", 26.0, c(0, 0));
+
+    std::mdspan<double const, std::dextents<size_t, 2>> cs(ext_vals, 2, 3);
+    static_assert(std::is_same_v<decltype(mx::from_mdspan(cs)), mx::ConstMatrixView>,
+                  "const mdspans must only give read-only views");
+    TEST_DEQ("sum(from_mdspan(cs))", 21.0, mx::sum(mx::from_mdspan(cs)));
+
+    mx::Matrix const& ca = a;
+    mx::const_mdspan top = mx::to_mdspan(ca.rows(0, 1));
+    TEST_SIZE_EQ("top.extent(1)", 3lu, top.extent(1));
+    TEST_DEQ("top[0, 2]", 2.0, (top[0, 2]));
+
+    TEST_END;
+}
+
+#endif  // __cpp_lib_mdspan
+
+int main() {
+    int total_tests = 3;
+    int failed = 0;
+
+    failed += test_matrix_ownership();
+    failed += test_matrix_expressions();
+    failed += test_matrix_library_ops();
+
+#ifdef MATRIX_COW
+    total_tests += 1;
+    failed += test_matrix_cow();
+#endif
+
+#ifdef __cpp_lib_mdspan
+    total_tests += 1;
+    failed += test_matrix_mdspan();
+#endif
+
+    int succeeded = total_tests - failed;
+    fprintf(stderr,
+            "--- Summary: Total %d tests; %d succeeded, %d failed ---\n",
+            total_tests, succeeded, failed);
+    return failed ? 1 : 0;
+}